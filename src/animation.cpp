@@ -11,17 +11,26 @@
 #include <cstdio>
 #include <cerrno>
 #include <cstring>
+#include <cstdint>
 #include <string>
 #include <algorithm>
 #include <stdexcept>
 #include <system_error>
 
+#include <QFile>
+
 #include "animation.h"
 
 
 static const float epsilon = 0.0001f;
 
-Animation::Animation()
+// Binary format, see save_binary()
+static const char binary_magic[8] = { 'P', 'M', 'D', 'S', 'I', 'M', 'K', 'F' };
+static const uint32_t binary_bom = 0x01020304;
+static const uint32_t binary_record_size = sizeof(long long) + 7 * sizeof(float);
+static const size_t binary_header_size = 8 + 4 + 4 + 8;
+
+Animation::Animation() : _cursor(0)
 {
 }
 
@@ -76,6 +85,60 @@ static void slerp(const float quat_a[4], const float quat_b[4], float alpha, flo
     quat[3] = (qa[3] * tmp_a + qb[3] * tmp_b);
 }
 
+size_t Animation::lookup(long long t)
+{
+    assert(keyframes.size() >= 2);
+    assert(t >= keyframes.front().t && t < keyframes.back().t);
+    size_t i = (_cursor < keyframes.size() - 1 ? _cursor : 0);
+    if (keyframes[i].t <= t) {
+        // Walk forward a few keyframes; this covers sampling at increasing
+        // points in time, which is the common case.
+        for (int steps = 0; steps < 8; steps++) {
+            if (t < keyframes[i + 1].t) {
+                _cursor = i;
+                return i;
+            }
+            i++;
+        }
+    } else {
+        i = 0;
+    }
+    // Binary search for the first keyframe after t in the remaining range
+    std::vector<Keyframe>::const_iterator it = keyframes.begin() + i;
+    size_t count = keyframes.size() - i;
+    while (count > 0) {
+        size_t step = count / 2;
+        if (it[step].t <= t) {
+            it += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+    _cursor = (it - keyframes.begin()) - 1;
+    return _cursor;
+}
+
+void Animation::interpolate(size_t i, long long t, float pos[3], float rot[4]) const
+{
+    const Keyframe& a = keyframes[i];
+    const Keyframe& b = keyframes[i + 1];
+    if (t == a.t) {
+        copy_keyframe(a, pos, rot);
+        return;
+    }
+    // Compute alpha value for interpolation.
+    float alpha = static_cast<float>(b.t - t) / (b.t - a.t);
+
+    // Interpolate position
+    pos[0] = alpha * a.pos[0] + (1.0f - alpha) * b.pos[0];
+    pos[1] = alpha * a.pos[1] + (1.0f - alpha) * b.pos[1];
+    pos[2] = alpha * a.pos[2] + (1.0f - alpha) * b.pos[2];
+
+    // Interpolate rotation
+    slerp(a.rot, b.rot, alpha, rot);
+}
+
 void Animation::interpolate(long long t, float pos[3], float rot[4])
 {
     // Catch corner cases
@@ -88,37 +151,21 @@ void Animation::interpolate(long long t, float pos[3], float rot[4])
         copy_keyframe(keyframes[keyframes.size() - 1], pos, rot);
         return;
     }
+    // At this point we know that there are at least two keyframes.
+    interpolate(lookup(t), t, pos, rot);
+}
 
-    // Binary search for the two nearest keyframes.
-    // At this point we know that if we have only one keyframe, then its
-    // time stamp is the requested time stamp so we have an exact match below.
-    int a = 0;
-    int b = keyframes.size() - 1;
-    while (b >= a) {
-        int c = (a + b) / 2;
-        if (keyframes[c].t < t) {
-            a = c + 1;
-        } else if (keyframes[c].t > t) {
-            b = c - 1;
-        } else {
-            // exact match
-            copy_keyframe(keyframes[c], pos, rot);
-            return;
-        }
+void Animation::interpolate(size_t n, const long long* t, float* pos, float* rot)
+{
+    for (size_t j = 0; j < n; j++) {
+        assert(j == 0 || t[j] >= t[j - 1]);
+        float p[3], r[4];
+        interpolate(t[j], p, r);
+        for (int k = 0; k < 3; k++)
+            pos[k * n + j] = p[k];
+        for (int k = 0; k < 4; k++)
+            rot[k * n + j] = r[k];
     }
-    // Now we have two keyframes: b is the lower one and a is the higher one.
-    // Swap them so that a is the lower one and b the higher one, to avoid confusion.
-    std::swap(a, b);
-    // Compute alpha value for interpolation.
-    float alpha = static_cast<float>(keyframes[b].t - t) / (keyframes[b].t - keyframes[a].t);
-
-    // Interpolate position
-    pos[0] = alpha * keyframes[a].pos[0] + (1.0f - alpha) * keyframes[b].pos[0];
-    pos[1] = alpha * keyframes[a].pos[1] + (1.0f - alpha) * keyframes[b].pos[1];
-    pos[2] = alpha * keyframes[a].pos[2] + (1.0f - alpha) * keyframes[b].pos[2];
-
-    // Interpolate rotation
-    slerp(keyframes[a].rot, keyframes[b].rot, alpha, rot);
 }
 
 static float to_rad(float deg)
@@ -172,9 +219,113 @@ static void quat_mult(const float a[4], const float b[4], float q[4])
     q[3] = a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2];
 }
 
+static bool keyframe_less(const Animation::Keyframe& a, const Animation::Keyframe& b)
+{
+    return a.t < b.t;
+}
+
+class KeyframeIndexLess
+{
+private:
+    const std::vector<Animation::Keyframe>& _kf;
+public:
+    KeyframeIndexLess(const std::vector<Animation::Keyframe>& kf) : _kf(kf) {}
+    bool operator()(int a, int b) const { return _kf[a].t < _kf[b].t; }
+};
+
+// Sort keyframes by time. If a time is defined more than once, the last
+// definition in the file wins. The lines are the file line numbers of the keyframes.
+static void sort_keyframes(const std::string& filename,
+        std::vector<Animation::Keyframe>* keyframes, const std::vector<int>& lines)
+{
+    std::vector<Animation::Keyframe>& kf = *keyframes;
+    std::vector<int> order;
+    if (!std::is_sorted(kf.begin(), kf.end(), keyframe_less)) {
+        // Sort a permutation, so that we still know the lines for the messages
+        // below. A stable sort keeps definitions with equal times in file order.
+        order.resize(kf.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), KeyframeIndexLess(kf));
+        std::vector<Animation::Keyframe> sorted(kf.size());
+        for (size_t i = 0; i < order.size(); i++)
+            sorted[i] = kf[order[i]];
+        kf.swap(sorted);
+    }
+    // Remove duplicates, keeping the last one
+    size_t n = 0;
+    for (size_t i = 0; i < kf.size(); i++) {
+        if (n > 0 && kf[n - 1].t == kf[i].t) {
+            fprintf(stderr, "%s line %d: overwriting previously defined keyframe\n", filename.c_str(),
+                    lines[order.empty() ? i : order[i]]);
+            kf[n - 1] = kf[i];
+        } else {
+            kf[n++] = kf[i];
+        }
+    }
+    kf.resize(n);
+}
+
+static void load_binary(const std::string& filename, std::vector<Animation::Keyframe>* keyframes)
+{
+    const std::runtime_error invalid(
+            std::string("Cannot read ").append(filename).append(": not a valid animation description"));
+    QFile file(filename.c_str());
+    if (!file.open(QIODevice::ReadOnly))
+        throw std::runtime_error(std::string("Cannot open ").append(filename));
+    size_t size = file.size();
+    const unsigned char* data = (size >= binary_header_size ? file.map(0, size) : NULL);
+    if (!data)
+        throw invalid;
+    uint32_t bom, record_size;
+    uint64_t n;
+    std::memcpy(&bom, data + 8, 4);
+    std::memcpy(&record_size, data + 12, 4);
+    std::memcpy(&n, data + 16, 8);
+    if (bom != binary_bom || record_size != binary_record_size
+            || n > (size - binary_header_size) / binary_record_size)
+        throw invalid;
+    // Copy the packed records into the (padded) keyframe structures
+    keyframes->resize(n);
+    const unsigned char* p = data + binary_header_size;
+    for (size_t i = 0; i < n; i++, p += binary_record_size) {
+        Animation::Keyframe& k = (*keyframes)[i];
+        std::memcpy(&k.t, p, sizeof(long long));
+        std::memcpy(k.pos, p + sizeof(long long), 3 * sizeof(float));
+        std::memcpy(k.rot, p + sizeof(long long) + 3 * sizeof(float), 4 * sizeof(float));
+        if (i > 0 && k.t <= (*keyframes)[i - 1].t)
+            throw invalid;
+    }
+}
+
+void Animation::save_binary(const std::string& filename) const
+{
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        throw std::system_error(errno, std::system_category(),
+                std::string("Cannot open ").append(filename));
+    }
+    uint64_t n = keyframes.size();
+    fwrite(binary_magic, 8, 1, f);
+    fwrite(&binary_bom, 4, 1, f);
+    fwrite(&binary_record_size, 4, 1, f);
+    fwrite(&n, 8, 1, f);
+    for (size_t i = 0; i < keyframes.size(); i++) {
+        fwrite(&keyframes[i].t, sizeof(long long), 1, f);
+        fwrite(keyframes[i].pos, sizeof(float), 3, f);
+        fwrite(keyframes[i].rot, sizeof(float), 4, f);
+    }
+    fflush(f);
+    if (ferror(f) || fclose(f) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                std::string("Cannot write ").append(filename));
+    }
+}
+
 void Animation::load(const std::string& filename)
 {
     Animation newanimation;
+    std::vector<int> keyframe_lines;
     const size_t linebuf_size = 512;
     char linebuf[linebuf_size];
     int fileformat_version = 0;
@@ -184,6 +335,14 @@ void Animation::load(const std::string& filename)
         throw std::system_error(errno, std::system_category(),
                 std::string("Cannot open ").append(filename));
     }
+    char magic[8];
+    if (fread(magic, 8, 1, f) == 1 && std::memcmp(magic, binary_magic, 8) == 0) {
+        fclose(f);
+        load_binary(filename, &newanimation.keyframes);
+        *this = newanimation;
+        return;
+    }
+    rewind(f);
     if (!fgets(linebuf, linebuf_size, f)
             || (sscanf(linebuf, "PMDSIM ANIMATION VERSION %d", &fileformat_version) != 1
                 && sscanf(linebuf, "PMDSIMTAP ANIMATION VERSION %d", &fileformat_version) != 1)
@@ -205,17 +364,8 @@ void Animation::load(const std::string& filename)
                         &tmprot[0], &tmprot[1], &tmprot[2], &tmprot[3]) == 8) {
                 keyframe.t = tmpt * 1e6f;
                 angle_axis_to_quat(to_rad(tmprot[0]), tmprot + 1, keyframe.rot);
-                // Insert new keyframe at correct position. We use stupid inefficient
-                // linear search for simplicity; performance does not matter here.
-                size_t i = 0;
-                while (i < newanimation.keyframes.size() && newanimation.keyframes[i].t < keyframe.t)
-                    i++;
-                if (i < newanimation.keyframes.size() && newanimation.keyframes[i].t == keyframe.t) {
-                    fprintf(stderr, "%s line %d: overwriting previously defined keyframe\n", filename.c_str(), line_index);
-                    newanimation.keyframes[i] = keyframe;
-                } else {
-                    newanimation.keyframes.insert(newanimation.keyframes.begin() + i, keyframe);
-                }
+                newanimation.keyframes.push_back(keyframe);
+                keyframe_lines.push_back(line_index);
                 continue;
             } else {
                 // ignore unknown entries, for future compatibility
@@ -331,17 +481,8 @@ void Animation::load(const std::string& filename)
                     float oq[4] = { keyframe.rot[0], keyframe.rot[1], keyframe.rot[2], keyframe.rot[3] };
                     quat_mult(q, oq, keyframe.rot);
                 }
-                // Insert new keyframe at correct position. We use stupid inefficient
-                // linear search for simplicity; performance does not matter here.
-                size_t i = 0;
-                while (i < newanimation.keyframes.size() && newanimation.keyframes[i].t < keyframe.t)
-                    i++;
-                if (i < newanimation.keyframes.size() && newanimation.keyframes[i].t == keyframe.t) {
-                    fprintf(stderr, "%s line %d: overwriting previously defined keyframe\n", filename.c_str(), line_index);
-                    newanimation.keyframes[i] = keyframe;
-                } else {
-                    newanimation.keyframes.insert(newanimation.keyframes.begin() + i, keyframe);
-                }
+                newanimation.keyframes.push_back(keyframe);
+                keyframe_lines.push_back(line_index);
                 continue;
             } else {
                 // ignore unknown entries, for future compatibility
@@ -353,5 +494,6 @@ void Animation::load(const std::string& filename)
         throw std::system_error(errno, std::system_category(),
                 std::string("Cannot read ").append(filename));
     }
+    sort_keyframes(filename, &newanimation.keyframes, keyframe_lines);
     *this = newanimation;
 }
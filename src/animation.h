@@ -21,6 +21,8 @@
  */
 
 #include <cassert>
+#include <cstddef>
+#include <string>
 #include <vector>
 
 /**
@@ -73,6 +75,18 @@ public:
      */
     std::vector<Keyframe> keyframes;
 
+private:
+    // Index of the keyframe found by the last lookup
+    size_t _cursor;
+
+    // Return the index i of the keyframe with keyframes[i].t <= t < keyframes[i+1].t,
+    // starting the search at the cursor.
+    // t must be inside the animation.
+    size_t lookup(long long t);
+
+    // Interpolate between keyframes i and i+1
+    void interpolate(size_t i, long long t, float pos[3], float rot[4]) const;
+
 public:
     /** \brief Constructor
      *
@@ -123,10 +137,39 @@ public:
      */
     void interpolate(long long t, float pos[3], float rot[4]);
 
+    /** \brief Interpolate position and orientation for many points in time.
+     *
+     * \param n         Number of points in time
+     * \param t         Points in time, in microseconds, sorted by ascending time
+     * \param pos       The positions, in meters, as 3 arrays of n x, y, and z components
+     * \param rot       The orientations as quaternions, as 4 arrays of n x, y, z, and w components
+     *
+     * This gives the same results as calling interpolate() for each point in time,
+     * but the keyframe search continues where it stopped for the previous point in
+     * time, which takes constant time if keyframes are dense.
+     * The animation must be valid!
+     */
+    void interpolate(size_t n, const long long* t, float* pos, float* rot);
+
     /** \brief Load animation description from a file
      *
+     * The file can be in one of the text formats or in the binary format
+     * written by save_binary().
      * This throws a std::exception on failure. */
     void load(const std::string& filename);
+
+    /** \brief Save the keyframes to a file in binary format
+     *
+     * The binary format consists of a 24 byte header: the 8 characters
+     * "PMDSIMKF", the 32 bit value 0x01020304 to detect the byte order, the
+     * 32 bit record size 36, and the 64 bit number of keyframes. It is followed
+     * by one packed record per keyframe, sorted by ascending time: the 64 bit
+     * time in microseconds, 3 floats position, and 4 floats quaternion.
+     * All values are in the byte order of the writing machine.
+     *
+     * Loading this format does not require any parsing.
+     * This throws a std::exception on failure. */
+    void save_binary(const std::string& filename) const;
 };
 
 #endif
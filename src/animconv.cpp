@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+/* pmdsim-animconv: convert an animation description in one of the text
+ * formats to the binary keyframe format, which loads without parsing.
+ * See Animation::save_binary() for the format. */
+
+#include <cstdio>
+#include <cstring>
+#include <clocale>
+#include <exception>
+
+#include "animation.h"
+
+
+int main(int argc, char *argv[])
+{
+    // Force the C locale so that we read the decimal point '.'
+    setlocale(LC_NUMERIC, "C");
+
+    if (argc == 2 && std::strcmp(argv[1], "--help") == 0) {
+        printf("Usage: %s INPUT OUTPUT\n"
+                "Convert the animation description INPUT (text or binary format)\n"
+                "to the binary keyframe format and write it to OUTPUT.\n", argv[0]);
+        return 0;
+    } else if (argc != 3) {
+        fprintf(stderr, "Usage: %s INPUT OUTPUT\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        Animation animation;
+        animation.load(argv[1]);
+        animation.save_binary(argv[2]);
+    }
+    catch (std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#include <QDesktopServices>
+#include <QCoreApplication>
+#include <QDir>
+
+#include "cachefile.h"
+
+
+std::string cache_dir(const char* subdir)
+{
+    std::string dir;
+    QString d = QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+    if (!d.isEmpty()) {
+        d += "/";
+        d += subdir;
+        if (QDir().mkpath(d))
+            dir = qPrintable(d);
+    }
+    return dir;
+}
+
+CacheFileWriter::CacheFileWriter(const std::string& filename) :
+    _filename(filename),
+    _tmpname(filename + "." + qPrintable(QString::number(QCoreApplication::applicationPid())) + ".tmp"),
+    _f(std::fopen(_tmpname.c_str(), "wb"))
+{
+}
+
+CacheFileWriter::~CacheFileWriter()
+{
+    if (_f)
+        commit(false);
+}
+
+void CacheFileWriter::commit(bool ok)
+{
+    if (!_f)
+        return;
+    ok = (std::fclose(_f) == 0 && ok);
+    _f = NULL;
+    if (!ok || !QDir().rename(_tmpname.c_str(), _filename.c_str()))
+        QDir().remove(_tmpname.c_str());
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef CACHEFILE_H
+#define CACHEFILE_H
+
+#include <cstdio>
+#include <string>
+
+
+/* Return the subdirectory of the user's cache directory with the given name,
+ * creating it if necessary. Returns an empty string if there is none. */
+std::string cache_dir(const char* subdir);
+
+/* Writes a cache file so that readers never see a partial file: the data is
+ * written to a temporary file that replaces the cache file in commit(). The
+ * temporary name includes the process id, so that concurrent processes do not
+ * write to the same file. Errors are not reported; the cache file is simply
+ * not written. */
+
+class CacheFileWriter
+{
+private:
+    std::string _filename;
+    std::string _tmpname;
+    FILE* _f;
+
+public:
+    CacheFileWriter(const std::string& filename);
+    /* Removes the temporary file if commit() was not called. */
+    ~CacheFileWriter();
+
+    /* The temporary file to write to, or NULL if it cannot be created. */
+    FILE* file() { return _f; }
+
+    /* Close the temporary file and, if ok is true and the file was written
+     * without errors, rename it to the cache file. Otherwise, remove it. */
+    void commit(bool ok);
+};
+
+#endif
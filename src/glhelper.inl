@@ -45,12 +45,8 @@ void xglKillCrlf(std::string& str)
         str[--l] = '\0';
 }
 
-GLuint xglCompileShader(GLenum type, const char* src, const std::string& where = "")
+bool xglCheckShader(GLuint shader, const std::string& where = "")
 {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &src, NULL);
-    glCompileShader(shader);
-
     std::string log;
     GLint e, l;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &e);
@@ -73,6 +69,21 @@ GLuint xglCompileShader(GLenum type, const char* src, const std::string& where =
         std::fprintf(stderr, "%sOpenGL compiler error: %s\n", pfx.c_str(), log.c_str());
         std::exit(1);
     }
+    return true;
+}
+
+GLuint xglCompileShaderUnchecked(GLenum type, const char* src)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, NULL);
+    glCompileShader(shader);
+    return shader;
+}
+
+GLuint xglCompileShader(GLenum type, const char* src, const std::string& where = "")
+{
+    GLuint shader = xglCompileShaderUnchecked(type, src);
+    xglCheckShader(shader, where);
     return shader;
 }
 
@@ -88,10 +99,8 @@ GLuint xglCreateProgram(GLuint vshader, GLuint gshader, GLuint fshader)
     return program;
 }
 
-void xglLinkProgram(const GLuint prg, const std::string& where = "")
+bool xglCheckProgram(const GLuint prg, const std::string& where = "")
 {
-    glLinkProgram(prg);
-
     std::string log;
     GLint e, l;
     glGetProgramiv(prg, GL_LINK_STATUS, &e);
@@ -114,6 +123,13 @@ void xglLinkProgram(const GLuint prg, const std::string& where = "")
         std::fprintf(stderr, "%sOpenGL linker error: %s\n", pfx.c_str(), log.c_str());
         std::exit(1);
     }
+    return true;
+}
+
+void xglLinkProgram(const GLuint prg, const std::string& where = "")
+{
+    glLinkProgram(prg);
+    xglCheckProgram(prg, where);
 }
 
 void xglDeleteProgram(GLuint program)
@@ -6,13 +6,18 @@
  * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
  */
 
+#include <cassert>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 
 #include <GL/glew.h>
 
 #include <QMessageBox>
 
 #include "glwidget.h"
+#include "cachefile.h"
+#include "hash.h"
 
 
 GLWidget::GLWidget(QGLWidget* sharing_widget) : QGLWidget(NULL, sharing_widget)
@@ -32,3 +37,154 @@ void GLWidget::update_simulator(const Simulator& simulator)
 {
     _simulator = simulator;
 }
+
+static bool have_program_binaries()
+{
+    if (!(GLEW_ARB_get_program_binary || GLEW_VERSION_4_1))
+        return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+static const std::string& program_cache_dir()
+{
+    static const std::string dir = cache_dir("programs");
+    return dir;
+}
+
+static std::string program_cache_file(const char* vs_src, const char* fs_src)
+{
+    // The binary is only valid for the same driver and the same sources
+    const GLenum driver_strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+    unsigned long long hash = hash_init;
+    for (int i = 0; i < 4; i++) {
+        const char* str = reinterpret_cast<const char*>(glGetString(driver_strings[i]));
+        if (str)
+            hash = hash_data(str, std::strlen(str) + 1, hash);
+    }
+    const char* sources[2] = { vs_src ? vs_src : "", fs_src ? fs_src : "" };
+    for (int i = 0; i < 2; i++)
+        hash = hash_data(sources[i], std::strlen(sources[i]) + 1, hash);
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.bin", hash);
+    return program_cache_dir() + name;
+}
+
+static bool load_program_binary(GLuint prg, const std::string& filename)
+{
+    FILE* f = std::fopen(filename.c_str(), "rb");
+    if (!f)
+        return false;
+    std::vector<char> data;
+    GLenum format;
+    bool ok = (std::fread(&format, sizeof(format), 1, f) == 1);
+    if (ok) {
+        char buf[4096];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0)
+            data.insert(data.end(), buf, buf + n);
+        ok = (!std::ferror(f) && !data.empty());
+    }
+    std::fclose(f);
+    if (!ok)
+        return false;
+    glProgramBinary(prg, format, &(data[0]), data.size());
+    GLint status = GL_FALSE;
+    glGetProgramiv(prg, GL_LINK_STATUS, &status);
+    // Clear a possible error from an incompatible binary; the caller falls back to compiling
+    glGetError();
+    return (status == GL_TRUE);
+}
+
+static void save_program_binary(GLuint prg, const std::string& filename)
+{
+    GLint size = 0;
+    glGetProgramiv(prg, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0)
+        return;
+    std::vector<char> data(size);
+    GLenum format;
+    glGetProgramBinary(prg, size, NULL, &format, &(data[0]));
+    CacheFileWriter writer(filename);
+    FILE* f = writer.file();
+    if (!f)
+        return;
+    writer.commit(std::fwrite(&format, sizeof(format), 1, f) == 1
+            && std::fwrite(&(data[0]), 1, data.size(), f) == data.size());
+}
+
+void GLWidget::build_programs(const std::vector<ProgramSource>& programs)
+{
+    makeCurrent();
+    bool use_cache = have_program_binaries() && !program_cache_dir().empty();
+    std::vector<std::string> cache_files(programs.size());
+    std::vector<bool> linked(programs.size(), false);
+
+    // Load cached binaries
+    for (size_t i = 0; i < programs.size(); i++) {
+        *programs[i].prg = glCreateProgram();
+        if (use_cache) {
+            cache_files[i] = program_cache_file(programs[i].vs_src, programs[i].fs_src);
+            linked[i] = load_program_binary(*programs[i].prg, cache_files[i]);
+        }
+    }
+
+    // Compile and link everything else, without waiting for results in between
+    bool parallel_compile = false;
+#ifdef GL_KHR_parallel_shader_compile
+    if (GLEW_KHR_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(0xffffffffU);
+        parallel_compile = true;
+    }
+#endif
+#ifdef GL_ARB_parallel_shader_compile
+    if (!parallel_compile && GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xffffffffU);
+#endif
+    std::vector<GLuint> vshaders(programs.size(), 0);
+    std::vector<GLuint> fshaders(programs.size(), 0);
+    for (size_t i = 0; i < programs.size(); i++) {
+        if (linked[i])
+            continue;
+        if (programs[i].vs_src)
+            vshaders[i] = xglCompileShaderUnchecked(GL_VERTEX_SHADER, programs[i].vs_src);
+        if (programs[i].fs_src)
+            fshaders[i] = xglCompileShaderUnchecked(GL_FRAGMENT_SHADER, programs[i].fs_src);
+    }
+    for (size_t i = 0; i < programs.size(); i++) {
+        if (linked[i])
+            continue;
+        GLuint prg = *programs[i].prg;
+        if (vshaders[i] != 0)
+            glAttachShader(prg, vshaders[i]);
+        if (fshaders[i] != 0)
+            glAttachShader(prg, fshaders[i]);
+        if (use_cache)
+            glProgramParameteri(prg, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(prg);
+    }
+
+    // Check the results and store the new binaries
+    for (size_t i = 0; i < programs.size(); i++) {
+        if (linked[i])
+            continue;
+        if (vshaders[i] != 0)
+            xglCheckShader(vshaders[i], programs[i].where);
+        if (fshaders[i] != 0)
+            xglCheckShader(fshaders[i], programs[i].where);
+        xglCheckProgram(*programs[i].prg, programs[i].where);
+        if (use_cache)
+            save_program_binary(*programs[i].prg, cache_files[i]);
+        // The linked program does not need the shader objects anymore
+        if (vshaders[i] != 0) {
+            glDetachShader(*programs[i].prg, vshaders[i]);
+            glDeleteShader(vshaders[i]);
+        }
+        if (fshaders[i] != 0) {
+            glDetachShader(*programs[i].prg, fshaders[i]);
+            glDeleteShader(fshaders[i]);
+        }
+    }
+    assert(xglCheckError(XGL_HERE));
+}
@@ -10,6 +10,8 @@
 #define GLWIDGET_H
 
 #include <cstdio>
+#include <string>
+#include <vector>
 
 #include <GL/glew.h>
 
@@ -25,6 +27,23 @@ class GLWidget : public QGLWidget
 protected:
     Simulator _simulator;
 
+    /* A GLSL program to be built by build_programs(). The vertex or fragment
+     * shader source may be NULL. */
+    class ProgramSource
+    {
+    public:
+        GLuint* prg;
+        const char* vs_src;
+        const char* fs_src;
+        const char* where;
+    };
+
+    /* Build all given programs at once. Linked program binaries are loaded
+     * from an on-disk cache when possible. All remaining shaders are compiled
+     * and linked before any of them is checked, so that the driver can work
+     * on them in parallel. Newly linked programs are stored in the cache. */
+    void build_programs(const std::vector<ProgramSource>& programs);
+
 public:
     GLWidget(QGLWidget* sharing_widget);
 
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#include <cassert>
+
+#include <GL/glew.h>
+
+#include "gpuscenecache.h"
+
+
+GPUSceneCache::GPUSceneCache(int max_scenes) :
+    _max_scenes(max_scenes), _size(0)
+{
+    assert(_max_scenes >= 1);
+}
+
+GPUSceneCache::~GPUSceneCache()
+{
+    // The GL context may be gone already, so we cannot release buffers here.
+    // Call clear() while the context is still current.
+}
+
+template<typename T>
+static GLuint create_buffer(GLenum target, const SharedArray<T>& array, size_t* size)
+{
+    if (array.empty())
+        return 0;
+    GLuint buf;
+    glGenBuffers(1, &buf);
+    glBindBuffer(target, buf);
+    glBufferData(target, array.size() * sizeof(T), array.data(), GL_STATIC_DRAW);
+    *size += array.size() * sizeof(T);
+    return buf;
+}
+
+GPUSceneCache::Buffers* GPUSceneCache::acquire(const TrianglePatch& tp)
+{
+    std::map<unsigned long long, Buffers>::iterator it = _buffers.find(tp.hash);
+    if (it == _buffers.end()) {
+        Buffers b;
+        b.size = 0;
+        b.scenes = 0;
+        b.key = tp.hash;
+        b.vertex = create_buffer(GL_ARRAY_BUFFER, tp.vertex_array, &b.size);
+        assert(!tp.normal_array.empty());
+        b.normal = create_buffer(GL_ARRAY_BUFFER, tp.normal_array, &b.size);
+        b.color = create_buffer(GL_ARRAY_BUFFER, tp.color_array, &b.size);
+        b.texcoord = create_buffer(GL_ARRAY_BUFFER, tp.texcoord_array, &b.size);
+        b.index = create_buffer(GL_ELEMENT_ARRAY_BUFFER, tp.index_array, &b.size);
+        _size += b.size;
+        it = _buffers.insert(std::make_pair(tp.hash, b)).first;
+    }
+    it->second.scenes++;
+    return &(it->second);
+}
+
+void GPUSceneCache::release(Buffers* b)
+{
+    assert(b->scenes > 0);
+    b->scenes--;
+    if (b->scenes == 0) {
+        GLuint bufs[5] = { b->vertex, b->normal, b->color, b->texcoord, b->index };
+        for (int i = 0; i < 5; i++)
+            if (bufs[i] != 0)
+                glDeleteBuffers(1, &bufs[i]);
+        _size -= b->size;
+        _buffers.erase(b->key);
+    }
+}
+
+const std::vector<GPUSceneCache::Buffers*>& GPUSceneCache::get(int scene_id, const std::vector<TrianglePatch>& scene)
+{
+    // Known scene?
+    for (std::list<Scene>::iterator it = _scenes.begin(); it != _scenes.end(); it++) {
+        if (it->id == scene_id && it->buffers.size() == scene.size()) {
+            _scenes.splice(_scenes.begin(), _scenes, it);
+            return _scenes.front().buffers;
+        }
+    }
+    // New scene. Acquire its buffers first, so that geometry shared with
+    // scenes that are about to be evicted is not uploaded again.
+    _scenes.push_front(Scene());
+    _scenes.front().id = scene_id;
+    _scenes.front().buffers.resize(scene.size(), NULL);
+    for (size_t i = 0; i < scene.size(); i++)
+        if (!scene[i].vertex_array.empty())
+            _scenes.front().buffers[i] = acquire(scene[i]);
+    while (static_cast<int>(_scenes.size()) > _max_scenes) {
+        for (size_t i = 0; i < _scenes.back().buffers.size(); i++)
+            if (_scenes.back().buffers[i])
+                release(_scenes.back().buffers[i]);
+        _scenes.pop_back();
+    }
+    return _scenes.front().buffers;
+}
+
+void GPUSceneCache::clear()
+{
+    while (!_scenes.empty()) {
+        for (size_t i = 0; i < _scenes.back().buffers.size(); i++)
+            if (_scenes.back().buffers[i])
+                release(_scenes.back().buffers[i]);
+        _scenes.pop_back();
+    }
+    assert(_buffers.empty());
+    assert(_size == 0);
+}
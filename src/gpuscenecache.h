@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef GPUSCENECACHE_H
+#define GPUSCENECACHE_H
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "trianglepatch.h"
+
+
+/* Manages the GPU buffers of triangle patches.
+ *
+ * Buffers are shared by all patches with the same geometry (identified by
+ * TrianglePatch::hash), so that a new scene that reuses geometry from a
+ * previous scene (e.g. when only the background changed) does not need to
+ * upload it again. A fixed number of scenes is kept; the buffers of the
+ * least recently used scene are released when a new scene is added.
+ *
+ * Each OpenGL context (or group of sharing contexts) needs its own cache,
+ * and all functions must be called with such a context current. */
+
+class GPUSceneCache
+{
+public:
+    class Buffers
+    {
+    public:
+        GLuint vertex, normal, color, texcoord, index;  // zero if not present
+        size_t size;                                    // size of all buffers in bytes
+        int scenes;                                     // number of scenes using these buffers
+        unsigned long long key;                         // TrianglePatch::hash of the geometry
+    };
+
+private:
+    class Scene
+    {
+    public:
+        int id;
+        std::vector<Buffers*> buffers;                  // one entry per patch; NULL for empty patches
+    };
+
+    int _max_scenes;
+    std::map<unsigned long long, Buffers> _buffers;
+    std::list<Scene> _scenes;                           // most recently used scene first
+    size_t _size;
+
+    Buffers* acquire(const TrianglePatch& tp);
+    void release(Buffers* b);
+
+public:
+    GPUSceneCache(int max_scenes = 1);
+    ~GPUSceneCache();
+
+    // Get the buffers for all patches of the given scene, uploading
+    // geometry that is not yet available on the GPU. The returned vector
+    // has one entry per patch; entries for empty patches are NULL.
+    const std::vector<Buffers*>& get(int scene_id, const std::vector<TrianglePatch>& scene);
+
+    // Release all buffers.
+    void clear();
+
+    // Number of scenes and geometry buffer sets currently held on the GPU.
+    int scenes() const { return _scenes.size(); }
+    int buffer_sets() const { return _buffers.size(); }
+
+    // Memory footprint of all buffers in bytes.
+    size_t memory_footprint() const { return _size; }
+};
+
+#endif
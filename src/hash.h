@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstring>
+
+/**
+ * \file hash.h
+ * \brief Non-cryptographic hashing of memory blocks.
+ *
+ * These hashes identify data, e.g. to find out if geometry that is already
+ * uploaded to the GPU can be reused. They are not suitable for security
+ * purposes.
+ */
+
+/** \brief Initial value for hash_data() */
+static const unsigned long long hash_init = 14695981039346656037ULL;
+
+/** \brief Hash a block of memory
+ *
+ * \param data      The data
+ * \param size      The size of the data in bytes
+ * \param hash      The hash value to continue, or hash_init to start a new hash
+ *
+ * This is a variant of FNV-1a that processes 64 bit words instead of bytes, so
+ * that hashing large vertex arrays is fast.
+ */
+inline unsigned long long hash_data(const void* data, size_t size, unsigned long long hash = hash_init)
+{
+    const unsigned long long prime = 1099511628211ULL;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    size_t words = size / sizeof(unsigned long long);
+    for (size_t i = 0; i < words; i++) {
+        unsigned long long w;
+        std::memcpy(&w, p + i * sizeof(unsigned long long), sizeof(unsigned long long));
+        hash = (hash ^ w) * prime;
+    }
+    for (size_t i = words * sizeof(unsigned long long); i < size; i++)
+        hash = (hash ^ p[i]) * prime;
+    // Final mixing, so that all input bits affect all output bits
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+#endif
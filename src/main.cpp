@@ -33,6 +33,7 @@ int main(int argc, char *argv[])
     bool export_animation = false;
     double export_frame = 1.0 / 0.0;
     bool minimize_window = false;
+    QString stats_file;
     for (int i = 1; i < cmdline.size(); i++) {
         bool conv_ok = true;
         if (cmdline.at(i).startsWith("--simulator=")) {
@@ -52,13 +53,15 @@ int main(int argc, char *argv[])
                 && conv_ok) {
         } else if (cmdline.at(i).compare("--minimize") == 0) {
             minimize_window = true;
+        } else if (cmdline.at(i).startsWith("--stats=")) {
+            stats_file = cmdline.at(i).section('=', 1);
         } else {
             qWarning() << "Invalid argument" << cmdline.at(i);
             return 1;
         }
     }
     MainWindow* mainwindow = new MainWindow(simulator_file, background_file, target_file, animation_file,
-            export_dir, export_animation, export_frame, minimize_window);
+            export_dir, export_animation, export_frame, minimize_window, stats_file);
     int ret = app.exec();
     delete mainwindow;
     return ret;
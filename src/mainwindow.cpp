@@ -6,6 +6,7 @@
  * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
  */
 
+#include <cassert>
 #include <stdexcept>
 #include <system_error>
 #include <cerrno>
@@ -38,6 +39,7 @@
 #include <QCheckBox>
 #include <QRadioButton>
 #include <QLabel>
+#include <QFont>
 #include <QElapsedTimer>
 #include <QProgressDialog>
 #include <QThread>
@@ -50,10 +52,13 @@
 
 #include "mainwindow.h"
 #include "simwidget.h"
+#include "simthread.h"
 #include "osgwidget.h"
 #include "view2dwidget.h"
 #include "animwidget.h"
 
+static const char noise_model_unsupported[] =
+    "The noise model requires OpenGL 3.0, which is not available.";
 
 MainWindow::MainWindow(
             QString script_simulator_file,
@@ -63,7 +68,8 @@ MainWindow::MainWindow(
             QString script_export_dir,
             bool script_export_animation,
             double script_export_frame,
-            bool script_minimize_window) :
+            bool script_minimize_window,
+            QString script_stats_file) :
     QMainWindow(NULL)
 {
     bool script_mode = (!script_simulator_file.isEmpty()
@@ -73,7 +79,8 @@ MainWindow::MainWindow(
             || !script_export_dir.isEmpty()
             || script_export_animation
             || std::isfinite(script_export_frame)
-            || script_minimize_window);
+            || script_minimize_window
+            || !script_stats_file.isEmpty());
 
     // Set application properties
     setWindowTitle("PMDSim");
@@ -103,21 +110,26 @@ MainWindow::MainWindow(
     fmt.setSwapInterval(0);
     QGLFormat::setDefaultFormat(fmt);
     connect(this, SIGNAL(update_scene(const Target&, const Target&)), this, SLOT(reset_scene()));
+    _sim_revision = 0;
+    _last_frame_sim_revision = -1;
+    _last_frame_scene_id = -1;
+    _frame_counter = 0;
+    _last_frame_number = 0;
+    connect(this, SIGNAL(update_simulator(const Simulator&)), this, SLOT(invalidate_simulation()));
+    // The simulation widget gets its simulator with each job of the simulation thread
     _sim_widget = new SimWidget();
-    connect(this, SIGNAL(update_simulator(const Simulator&)), _sim_widget, SLOT(update_simulator(const Simulator&)));
+    _sim_widget->set_stats(&_stats);
+    _stats_file = script_stats_file;
+    _stats.set_keep_totals(!_stats_file.isEmpty());
     _osg_widget = new OSGWidget(_sim_widget);
     connect(this, SIGNAL(update_simulator(const Simulator&)), _osg_widget, SLOT(update_simulator(const Simulator&)));
     connect(this, SIGNAL(update_scene(const Target&, const Target&)), _osg_widget, SLOT(update_scene(const Target&, const Target&)));
     _depthmap_widget = new View2DWidget(_sim_widget);
     connect(this, SIGNAL(update_simulator(const Simulator&)), _depthmap_widget, SLOT(update_simulator(const Simulator&)));
-    _phase_widgets[0] = new View2DWidget(_sim_widget);
-    connect(this, SIGNAL(update_simulator(const Simulator&)), _phase_widgets[0], SLOT(update_simulator(const Simulator&)));
-    _phase_widgets[1] = new View2DWidget(_sim_widget);
-    connect(this, SIGNAL(update_simulator(const Simulator&)), _phase_widgets[1], SLOT(update_simulator(const Simulator&)));
-    _phase_widgets[2] = new View2DWidget(_sim_widget);
-    connect(this, SIGNAL(update_simulator(const Simulator&)), _phase_widgets[2], SLOT(update_simulator(const Simulator&)));
-    _phase_widgets[3] = new View2DWidget(_sim_widget);
-    connect(this, SIGNAL(update_simulator(const Simulator&)), _phase_widgets[3], SLOT(update_simulator(const Simulator&)));
+    for (int i = 0; i < Simulator::phases; i++) {
+        _phase_widgets[i] = new View2DWidget(_sim_widget);
+        connect(this, SIGNAL(update_simulator(const Simulator&)), _phase_widgets[i], SLOT(update_simulator(const Simulator&)));
+    }
     _pmd_depth_widget = new View2DWidget(_sim_widget);
     connect(this, SIGNAL(update_simulator(const Simulator&)), _pmd_depth_widget, SLOT(update_simulator(const Simulator&)));
     _pmd_amp_widget = new View2DWidget(_sim_widget);
@@ -135,6 +147,8 @@ MainWindow::MainWindow(
         try {
             if (!script_simulator_file.isEmpty())
                 _simulator.load(script_simulator_file.toLocal8Bit().constData());
+            if (_simulator.noise_model == 1 && !_sim_widget->have_noise_model())
+                throw std::runtime_error(noise_model_unsupported);
             if (!script_background_file.isEmpty())
                 _background.load(script_background_file.toLocal8Bit().constData());
             if (!script_target_file.isEmpty())
@@ -155,6 +169,8 @@ MainWindow::MainWindow(
         if (!simulator_filename.isEmpty()) {
             try { _simulator.load(simulator_filename.toLocal8Bit().constData()); } catch (...) { }
         }
+        if (_simulator.noise_model == 1 && !_sim_widget->have_noise_model())
+            _simulator.noise_model = 0;
         emit update_simulator(_simulator);
         QString background_filename = _settings->value("Session/background").toString();
         if (!background_filename.isEmpty()) {
@@ -179,10 +195,9 @@ MainWindow::MainWindow(
     QGridLayout* row1_layout = new QGridLayout;
     row1_layout->addWidget(_osg_widget, 0, 0, 2, 2);
     row1_layout->addWidget(_depthmap_widget, 0, 2, 2, 2);
-    row1_layout->addWidget(_phase_widgets[0], 0, 4);
-    row1_layout->addWidget(_phase_widgets[1], 0, 5);
-    row1_layout->addWidget(_phase_widgets[2], 1, 4);
-    row1_layout->addWidget(_phase_widgets[3], 1, 5);
+    // The phase images are arranged in two rows
+    for (int i = 0; i < Simulator::phases; i++)
+        row1_layout->addWidget(_phase_widgets[i], i / ((Simulator::phases + 1) / 2), 4 + i % ((Simulator::phases + 1) / 2));
     QGridLayout* row2_layout = new QGridLayout;
     row2_layout->addWidget(_pmd_depth_widget, 0, 0);
     row2_layout->addWidget(_pmd_amp_widget, 0, 1);
@@ -228,6 +243,10 @@ MainWindow::MainWindow(
     QAction* simulator_export_modelfile_act = new QAction("Export to &model file...", this);
     connect(simulator_export_modelfile_act, SIGNAL(triggered()), this, SLOT(simulator_export_modelfile()));
     simulator_menu->addAction(simulator_export_modelfile_act);
+    _stats_act = new QAction("Show &statistics", this);
+    _stats_act->setCheckable(true);
+    connect(_stats_act, SIGNAL(toggled(bool)), this, SLOT(simulator_show_stats(bool)));
+    simulator_menu->addAction(_stats_act);
     simulator_menu->addSeparator();
     QAction* simulator_reset_act = new QAction("&Reset...", this);
     connect(simulator_reset_act, SIGNAL(triggered()), this, SLOT(simulator_reset()));
@@ -297,8 +316,29 @@ MainWindow::MainWindow(
         show();
     }
 
+    // Run the simulation pipeline in its own thread with the context of the
+    // simulation widget
+    _sim_thread = new SimThread(_sim_widget);
+    connect(_sim_thread, SIGNAL(frame_ready()), this, SLOT(simulation_frame_ready()));
+    _sim_thread->start_simulation();
+
+    // Statistics window, updated once per second while visible
+    _stats_label = new QLabel(this, Qt::Tool);
+    _stats_label->setWindowTitle("Statistics");
+    _stats_label->setFont(QFont("Monospace"));
+    _stats_label->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    _stats_label->setMargin(8);
+    // Closing the window must uncheck the menu entry, which also stops the timer
+    _stats_label->installEventFilter(this);
+    _stats_timer = new QTimer(this);
+    connect(_stats_timer, SIGNAL(timeout()), this, SLOT(simulator_update_stats()));
+
     _sim_timer = new QTimer(this);
     connect(_sim_timer, SIGNAL(timeout()), this, SLOT(simulation_step()));
+    _sim_timer_waiting = false;
+    _view_timer = new QTimer(this);
+    _view_timer->setSingleShot(true);
+    connect(_view_timer, SIGNAL(timeout()), this, SLOT(view_step()));
     _anim_time_requested = false;
     _sim_timer->start(0);
     if (script_mode && (std::isfinite(script_export_frame) || script_export_animation)) {
@@ -333,12 +373,23 @@ MainWindow::MainWindow(
                 std::exit(1);
             }
         }
+        _sim_thread->stop_simulation();
+        if (!_stats_file.isEmpty()) {
+            try {
+                _stats.save(_stats_file.toLocal8Bit().constData());
+            }
+            catch (std::exception& e) {
+                QMessageBox::critical(this, "Error", e.what());
+                std::exit(1);
+            }
+        }
         std::exit(0);
     }
 }
 
 MainWindow::~MainWindow()
 {
+    delete _sim_thread;
     delete _settings;
 }
 
@@ -348,15 +399,49 @@ public:
     static void usleep(unsigned long usecs) { QThread::usleep(usecs); }
 };
 
-static void active_wait(QElapsedTimer& timer, long long until_usecs)
+// Store the transformations of all patches, 16 floats per patch. Returns
+// whether they differ from what was stored before.
+static bool update_transformations(const std::vector<TrianglePatch>& scene, float* transformations)
+{
+    bool changed = false;
+    for (size_t i = 0; i < scene.size(); i++) {
+        float* t = transformations + i * 16;
+        if (!changed && std::memcmp(t, scene[i].transformation, 16 * sizeof(float)) != 0)
+            changed = true;
+        std::memcpy(t, scene[i].transformation, 16 * sizeof(float));
+    }
+    return changed;
+}
+
+// Set the target transformation from sample i of animation samples in SoA layout
+static void set_target_transformation(OSGWidget* osg_widget,
+        const std::vector<float>& pos, const std::vector<float>& rot, int i)
+{
+    size_t n = pos.size() / 3;
+    float p[3] = { pos[i], pos[n + i], pos[2 * n + i] };
+    float r[4] = { rot[i], rot[n + i], rot[2 * n + i], rot[3 * n + i] };
+    osg_widget->set_fixed_target_transformation(p, r);
+}
+
+static void process_events_until(QElapsedTimer& timer, long long until_usecs)
 {
     // Allow Qt to process events while waiting, so that e.g. the OSG interaction
     // can move on. Otherwise we would always have identical phase images.
+    // We do not poll: the event loop blocks until the next event arrives, and a
+    // single-shot timer makes sure that there is one at the deadline. Timers have
+    // millisecond resolution, so the rest is slept.
     long long usecs;
     bool waited = false;
+    QTimer deadline;
+    deadline.setSingleShot(true);
     while ((usecs = timer.nsecsElapsed() / 1000) < until_usecs) {
-        QApplication::processEvents(QEventLoop::AllEvents, (until_usecs - usecs) / 1000);
-        SleepThread::usleep(10); // prevent busy looping
+        long long remaining = until_usecs - usecs;
+        if (remaining >= 1000) {
+            deadline.start(remaining / 1000);
+            QApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        } else {
+            SleepThread::usleep(remaining);
+        }
         waited = true;
     }
     if (!waited) {
@@ -367,18 +452,22 @@ static void active_wait(QElapsedTimer& timer, long long until_usecs)
 
 void MainWindow::simulation_step()
 {
-    float ambiguity_range = static_cast<double>(Simulator::c) / static_cast<double>(_simulator.modulation_frequency) * 0.5;
-    float max_energy = _simulator.lightsource_simple_power * 1e4f;
-    float max_pmd_amp = max_energy * static_cast<float>(M_PI) / static_cast<float>(M_SQRT1_2);
-    float max_pmd_intensity = 2.0f * max_energy;
-
     long long anim_time = 0;
+    unsigned int frame = 0;
     QElapsedTimer timer;
+    QElapsedTimer stage_timer;
     AnimWidget::state_t anim_state = _anim_widget->state();
+    // In a running animation, every frame must be simulated. Do not replace a job
+    // that the simulation thread did not start yet; continue when it reports a frame.
+    if (anim_state == AnimWidget::state_active && _sim_thread->job_pending()) {
+        _sim_timer->stop();
+        _sim_timer_waiting = true;
+        return;
+    }
     if (anim_state == AnimWidget::state_stopped) {
         anim_time = _animation.start_time();
     } else if (anim_state == AnimWidget::state_active || anim_state == AnimWidget::state_paused) {
-        long long total_frame_duration = 4 * (_simulator.exposure_time + _simulator.readout_time);
+        long long total_frame_duration = Simulator::phases * (_simulator.exposure_time + _simulator.readout_time);
         if (_anim_time_requested) {
             anim_time = ((_anim_time_request - _animation.start_time()) / total_frame_duration)
                 * total_frame_duration + _animation.start_time();
@@ -397,30 +486,62 @@ void MainWindow::simulation_step()
         }
         _last_anim_time = anim_time;
         _anim_widget->update(anim_time);
+        frame = (anim_time - _animation.start_time()) / total_frame_duration;
     } else {
         timer.start();
+        frame = _frame_counter++;
     }
 
-    // Simulate the four phase images
-    for (int i = 0; i < 4; i++) {
+    // Record the scene transformations for all time samples of this frame; the
+    // simulation thread renders the phase images from them.
+    // If the simulator, the scene, and all patch transformations are the same as in the
+    // previous frame, then the results are the same, and we skip the GPU work.
+    // With noise, the frame number is an input, too.
+    int samples = _simulator.exposure_time_samples;
+    // The transformations are compared to those of the previous frame while
+    // they overwrite them.
+    bool frame_unchanged = (_last_frame_sim_revision == _sim_revision
+            && _last_frame_scene_id == _scene_id
+            && (_simulator.noise_model == 0 || _last_frame_number == frame));
+    // Sample the animation for the start of all time steps of this frame at once.
+    std::vector<long long> sample_times;
+    std::vector<float> sample_pos, sample_rot;
+    if (anim_state != AnimWidget::state_disabled) {
+        int n = Simulator::phases * samples;
+        sample_times.resize(n);
+        for (int i = 0; i < Simulator::phases; i++) {
+            long long phase_start_time = anim_time + i * (_simulator.exposure_time + _simulator.readout_time);
+            for (int j = 0; j < samples; j++)
+                sample_times[i * samples + j] = phase_start_time + j * _simulator.exposure_time / samples;
+        }
+        sample_pos.resize(3 * n);
+        sample_rot.resize(4 * n);
+        _animation.interpolate(n, &sample_times[0], &sample_pos[0], &sample_rot[0]);
+    }
+    for (int i = 0; i < Simulator::phases; i++) {
         long long phase_start_time = anim_time + i * (_simulator.exposure_time + _simulator.readout_time);
         for (int j = 0; j < _simulator.exposure_time_samples; j++) {
-            long long phase_step_time = phase_start_time + j * _simulator.exposure_time / _simulator.exposure_time_samples;
-            if (anim_state != AnimWidget::state_disabled) {
-                float pos[3], rot[4];
-                _animation.interpolate(phase_step_time, pos, rot);
-                _osg_widget->set_fixed_target_transformation(pos, rot);
-            }
+            if (anim_state != AnimWidget::state_disabled)
+                set_target_transformation(_osg_widget, sample_pos, sample_rot, i * samples + j);
             // Draw target in OSG for navigation and visual control
+            stage_timer.start();
             _osg_widget->draw_frame();
-            // Render the energy map
+            _stats.add_cpu_time(Stats::stage_draw_frame, stage_timer.nsecsElapsed() / 1e3);
+            // Get the scene for the energy map
+            stage_timer.start();
             if (_scene.size() == 0)
                 _osg_widget->capture_scene(&_scene);
             else
                 _osg_widget->update_scene(&_scene);
-            _sim_widget->render_map(_scene_id, _scene, i);
-            // Compute a phase image time step from the reduced map
-            _sim_widget->simulate_phase_img(i, j);
+            _stats.add_cpu_time(Stats::stage_capture_scene, stage_timer.nsecsElapsed() / 1e3);
+            size_t sample_size = _scene.size() * 16;
+            if (_last_frame_transformations.size() != Simulator::phases * samples * sample_size) {
+                _last_frame_transformations.resize(Simulator::phases * samples * sample_size);
+                frame_unchanged = false;
+            }
+            if (sample_size > 0 && update_transformations(_scene,
+                        &(_last_frame_transformations[(i * samples + j) * sample_size])))
+                frame_unchanged = false;
             // Let time pass in free interaction mode.
             if (anim_state == AnimWidget::state_disabled) {
                 long long wait_until;
@@ -428,30 +549,90 @@ void MainWindow::simulation_step()
                     wait_until = phase_start_time + (j + 1) * _simulator.exposure_time / _simulator.exposure_time_samples;
                 else // wait until next phase start time
                     wait_until = anim_time + (i + 1) * (_simulator.exposure_time + _simulator.readout_time);
-                active_wait(timer, wait_until);
+                process_events_until(timer, wait_until);
             }
         }
-        // Show the ideal depth from the last time sample
-        _depthmap_widget->view(_sim_widget->get_map(), _simulator.map_aspect_ratio(),
-                2, 0.0f, std::min(ambiguity_range, _simulator.far_plane));
-        // Show the phase image
-        _phase_widgets[i]->view(_sim_widget->get_phase(i), _simulator.aspect_ratio(), 0, -max_energy, +max_energy, false);
         // Let time pass in free interaction mode.
         if (anim_state == AnimWidget::state_disabled)
-            active_wait(timer, (i + 1) * (_simulator.exposure_time + _simulator.readout_time));
+            process_events_until(timer, (i + 1) * (_simulator.exposure_time + _simulator.readout_time));
+    }
+    if (!frame_unchanged) {
+        // Hand the frame over to the simulation thread. The job comes back with
+        // the buffers of an older job, so assigning to it does not allocate.
+        _sim_job.simulator = _simulator;
+        _sim_job.scene_id = _scene_id;
+        _sim_job.scene = _scene;
+        _sim_job.transformations.assign(_last_frame_transformations.begin(), _last_frame_transformations.end());
+        _sim_job.frame = frame;
+        _sim_thread->submit(_sim_job);
+        // Remember the inputs of this frame
+        _last_frame_sim_revision = _sim_revision;
+        _last_frame_scene_id = _scene_id;
+        _last_frame_number = frame;
     }
-    // Compute the results from the four phase images
-    _sim_widget->simulate_result();
-    // Show the results
-    _pmd_depth_widget->view(_sim_widget->get_result(), _simulator.aspect_ratio(),
-            0, 0.0f, std::min(ambiguity_range, _simulator.far_plane));
-    _pmd_amp_widget->view(_sim_widget->get_result(), _simulator.aspect_ratio(),
-            1, 0.0f, max_pmd_amp);
-    _pmd_intensity_widget->view(_sim_widget->get_result(), _simulator.aspect_ratio(),
-            2, 0.0f, max_pmd_intensity);
     // Let time pass in free interaction mode.
     if (anim_state == AnimWidget::state_disabled)
-        active_wait(timer, (3 + 1) * (_simulator.exposure_time + _simulator.readout_time));
+        process_events_until(timer, Simulator::phases * (_simulator.exposure_time + _simulator.readout_time));
+    // A stopped or paused animation only changes through user input, so wait
+    // for that instead of simulating the same frame again at full speed.
+    // The time limit bounds the delay for changes that do not come with an event.
+    if (frame_unchanged && (anim_state == AnimWidget::state_stopped || anim_state == AnimWidget::state_paused)) {
+        QTimer limit;
+        limit.setSingleShot(true);
+        limit.start(100);
+        QApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+}
+
+void MainWindow::simulation_frame_ready()
+{
+    // The simulation thread took the next job, if any, so the simulation loop can go on
+    if (_sim_timer_waiting) {
+        _sim_timer_waiting = false;
+        _sim_timer->start(0);
+    }
+    // Show the newest frame at the next display refresh. The simulation may
+    // publish frames much faster than they can be seen; drawing each of them
+    // would cost a context switch and a buffer swap per view.
+    if (!_view_timer->isActive())
+        _view_timer->start(1000 / 60);
+}
+
+void MainWindow::view_step()
+{
+    // Frames that were published in the meantime are skipped
+    if (_sim_thread->update_frame())
+        show_frame();
+}
+
+void MainWindow::show_frame()
+{
+    const SimFrame& frame = _sim_thread->frame();
+    const Simulator& sim = frame.simulator;
+    int w = sim.sensor_width;
+    int h = sim.sensor_height;
+    float ambiguity_range = sim.ambiguity_range();
+    float max_energy = sim.lightsource_simple_power * 1e4f;
+    float max_pmd_amp = max_energy * static_cast<float>(M_PI) / static_cast<float>(M_SQRT1_2);
+    float max_pmd_intensity = 2.0f * max_energy;
+
+    // Show the ideal depth from the last time sample
+    _depthmap_widget->view(frame.map, 4, w, h, sim.map_aspect_ratio(),
+            2, 0.0f, std::min(ambiguity_range, sim.far_plane));
+    // Show the phase images
+    for (int i = 0; i < Simulator::phases; i++)
+        _phase_widgets[i]->view(frame.phases[0][i], 4, w, h, sim.aspect_ratio(), 0, -max_energy, +max_energy, false);
+    // Show the results. With multiple modulation frequencies, show the unwrapped depth.
+    if (sim.modulation_frequencies() > 1)
+        _pmd_depth_widget->view(frame.unwrapped_result, 3, w, h, sim.aspect_ratio(),
+                0, 0.0f, std::min(sim.extended_ambiguity_range(), sim.far_plane));
+    else
+        _pmd_depth_widget->view(frame.results[0], 3, w, h, sim.aspect_ratio(),
+                0, 0.0f, std::min(ambiguity_range, sim.far_plane));
+    _pmd_amp_widget->view(frame.results[0], 3, w, h, sim.aspect_ratio(),
+            1, 0.0f, max_pmd_amp);
+    _pmd_intensity_widget->view(frame.results[0], 3, w, h, sim.aspect_ratio(),
+            2, 0.0f, max_pmd_intensity);
 }
 
 void MainWindow::reset_scene()
@@ -460,6 +641,11 @@ void MainWindow::reset_scene()
     _scene_id++;
 }
 
+void MainWindow::invalidate_simulation()
+{
+    _sim_revision++;
+}
+
 void MainWindow::animation_state_changed()
 {
     AnimWidget::state_t state = _anim_widget->state();
@@ -483,38 +669,58 @@ void MainWindow::closeEvent(QCloseEvent *event)
     _settings->setValue("window_state", saveState());
     _settings->endGroup();
 
+    _sim_thread->stop_simulation();
+    if (!_stats_file.isEmpty()) {
+        try {
+            _stats.save(_stats_file.toLocal8Bit().constData());
+        }
+        catch (std::exception& e) {
+            QMessageBox::critical(this, "Error", e.what());
+        }
+    }
     event->accept();
 }
 
 void MainWindow::get_sim_data(int w, int h)
 {
-    _sim_widget->makeCurrent();
-
-    GLint tex_bak;
-    glGetIntegerv(GL_TEXTURE_BINDING_2D, &tex_bak);
-
-    _export_phase0.resize(4 * w * h);
-    _export_phase1.resize(4 * w * h);
-    _export_phase2.resize(4 * w * h);
-    _export_phase3.resize(4 * w * h);
-    _export_result.resize(3 * w * h);
-
-    glBindTexture(GL_TEXTURE_2D, _sim_widget->get_phase(0));
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &_export_phase0[0]);
-    glBindTexture(GL_TEXTURE_2D, _sim_widget->get_phase(1));
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &_export_phase1[0]);
-    glBindTexture(GL_TEXTURE_2D, _sim_widget->get_phase(2));
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &_export_phase2[0]);
-    glBindTexture(GL_TEXTURE_2D, _sim_widget->get_phase(3));
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &_export_phase3[0]);
-    glBindTexture(GL_TEXTURE_2D, _sim_widget->get_result());
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, &_export_result[0]);
-
-    glBindTexture(GL_TEXTURE_2D, tex_bak);
+    QElapsedTimer stage_timer;
+    stage_timer.start();
+
+    // Get the frame of the last submitted job
+    _sim_thread->wait_for_results();
+    if (_sim_thread->update_frame())
+        show_frame();
+    const SimFrame& frame = _sim_thread->frame();
+    if (frame.simulator.sensor_width != w || frame.simulator.sensor_height != h
+            || frame.simulator.modulation_frequencies() != _simulator.modulation_frequencies()
+            || frame.results[0].empty())
+        throw std::runtime_error("No simulation data available.");
+
+    for (int i = 0; i < Simulator::phases; i++)
+        _export_phases[i] = frame.phases[0][i];
+    _export_result = frame.results[0];
+    _export_frame_number = frame.frame;
+    for (int f = 1; f < _simulator.modulation_frequencies(); f++) {
+        for (int i = 0; i < Simulator::phases; i++)
+            _export_additional_phases[f - 1][i] = frame.phases[f][i];
+        _export_additional_results[f - 1] = frame.results[f];
+    }
+    if (_simulator.modulation_frequencies() > 1)
+        _export_unwrapped_result = frame.unwrapped_result;
+    _stats.add_cpu_time(Stats::stage_get_sim_data, stage_timer.nsecsElapsed() / 1e3);
 }
 
-static std::string export_worker(const std::string& filename, const Simulator& sim, bool compute_coords, int stride, const float* data)
+class ExportResult
 {
+public:
+    std::string error;  // empty on success
+    double usecs;       // time taken, for the statistics
+};
+
+static ExportResult export_worker(const std::string& filename, const Simulator& sim, bool compute_coords, int stride, const float* data)
+{
+    QElapsedTimer timer;
+    timer.start();
     int w = sim.sensor_width;
     int h = sim.sensor_height;
     float aa = sim.aperture_angle * static_cast<float>(M_PI) / 180.0f;
@@ -580,7 +786,10 @@ static std::string export_worker(const std::string& filename, const Simulator& s
     catch (std::exception& e) {
         exc_what = e.what();
     }
-    return exc_what;
+    ExportResult result;
+    result.error = exc_what;
+    result.usecs = timer.nsecsElapsed() / 1e3;
+    return result;
 }
 
 void MainWindow::export_frame(const std::string& dirname, int frameno)
@@ -588,6 +797,10 @@ void MainWindow::export_frame(const std::string& dirname, int frameno)
     int w = _simulator.sensor_width;
     int h = _simulator.sensor_height;
     get_sim_data(w, h);
+    // The noise depends on the frame number, and pmdsim-phase2depth --add-noise
+    // takes it from the file name prefix, so with noise the prefix is always written.
+    if (frameno < 0 && _simulator.noise_model != 0)
+        frameno = _export_frame_number;
     std::string framestr;
     if (frameno >= 0)
         framestr = QString("%1").arg(QString::number(frameno), 5, QChar('0')).toStdString() + "-";
@@ -599,60 +812,60 @@ void MainWindow::export_frame(const std::string& dirname, int frameno)
     // Force the C locale so that we get the decimal point '.'
     const char* locbak = setlocale(LC_NUMERIC, "C");
 #endif
-    QFuture<std::string> f_rd0 = QtConcurrent::run(export_worker, base + "raw-depth-0" + ext, _simulator, false, 4, &_export_phase0[2]);
-    QFuture<std::string> f_rd1 = QtConcurrent::run(export_worker, base + "raw-depth-1" + ext, _simulator, false, 4, &_export_phase1[2]);
-    QFuture<std::string> f_rd2 = QtConcurrent::run(export_worker, base + "raw-depth-2" + ext, _simulator, false, 4, &_export_phase2[2]);
-    QFuture<std::string> f_rd3 = QtConcurrent::run(export_worker, base + "raw-depth-3" + ext, _simulator, false, 4, &_export_phase3[2]);
-    QFuture<std::string> f_rc0 = QtConcurrent::run(export_worker, base + "raw-coords-0" + ext, _simulator, true, 4, &_export_phase0[2]);
-    QFuture<std::string> f_rc1 = QtConcurrent::run(export_worker, base + "raw-coords-1" + ext, _simulator, true, 4, &_export_phase1[2]);
-    QFuture<std::string> f_rc2 = QtConcurrent::run(export_worker, base + "raw-coords-2" + ext, _simulator, true, 4, &_export_phase2[2]);
-    QFuture<std::string> f_rc3 = QtConcurrent::run(export_worker, base + "raw-coords-3" + ext, _simulator, true, 4, &_export_phase3[2]);
-    QFuture<std::string> f_re0 = QtConcurrent::run(export_worker, base + "raw-energy-0" + ext, _simulator, false, 4, &_export_phase0[3]);
-    QFuture<std::string> f_re1 = QtConcurrent::run(export_worker, base + "raw-energy-1" + ext, _simulator, false, 4, &_export_phase1[3]);
-    QFuture<std::string> f_re2 = QtConcurrent::run(export_worker, base + "raw-energy-2" + ext, _simulator, false, 4, &_export_phase2[3]);
-    QFuture<std::string> f_re3 = QtConcurrent::run(export_worker, base + "raw-energy-3" + ext, _simulator, false, 4, &_export_phase3[3]);
-    QFuture<std::string> f_pa0 = QtConcurrent::run(export_worker, base + "sim-phase-a-0" + ext, _simulator, false, 4, &_export_phase0[0]);
-    QFuture<std::string> f_pa1 = QtConcurrent::run(export_worker, base + "sim-phase-a-1" + ext, _simulator, false, 4, &_export_phase1[0]);
-    QFuture<std::string> f_pa2 = QtConcurrent::run(export_worker, base + "sim-phase-a-2" + ext, _simulator, false, 4, &_export_phase2[0]);
-    QFuture<std::string> f_pa3 = QtConcurrent::run(export_worker, base + "sim-phase-a-3" + ext, _simulator, false, 4, &_export_phase3[0]);
-    QFuture<std::string> f_pb0 = QtConcurrent::run(export_worker, base + "sim-phase-b-0" + ext, _simulator, false, 4, &_export_phase0[1]);
-    QFuture<std::string> f_pb1 = QtConcurrent::run(export_worker, base + "sim-phase-b-1" + ext, _simulator, false, 4, &_export_phase1[1]);
-    QFuture<std::string> f_pb2 = QtConcurrent::run(export_worker, base + "sim-phase-b-2" + ext, _simulator, false, 4, &_export_phase2[1]);
-    QFuture<std::string> f_pb3 = QtConcurrent::run(export_worker, base + "sim-phase-b-3" + ext, _simulator, false, 4, &_export_phase3[1]);
-    QFuture<std::string> f_sd = QtConcurrent::run(export_worker, base + "sim-depth" + ext, _simulator, false, 3, &_export_result[0]);
-    QFuture<std::string> f_sa = QtConcurrent::run(export_worker, base + "sim-amplitude" + ext, _simulator, false, 3, &_export_result[1]);
-    QFuture<std::string> f_si = QtConcurrent::run(export_worker, base + "sim-intensity" + ext, _simulator, false, 3, &_export_result[2]);
-    QFuture<std::string> f_sc = QtConcurrent::run(export_worker, base + "sim-coords" + ext, _simulator, true, 3, &_export_result[0]);
+    std::vector<QFuture<ExportResult> > futures;
+    for (int i = 0; i < Simulator::phases; i++) {
+        std::string index = std::string(1, static_cast<char>('0' + i));
+        futures.push_back(QtConcurrent::run(export_worker, base + "raw-depth-" + index + ext,
+                    _simulator, false, 4, &_export_phases[i][2]));
+        futures.push_back(QtConcurrent::run(export_worker, base + "raw-coords-" + index + ext,
+                    _simulator, true, 4, &_export_phases[i][2]));
+        futures.push_back(QtConcurrent::run(export_worker, base + "raw-energy-" + index + ext,
+                    _simulator, false, 4, &_export_phases[i][3]));
+        futures.push_back(QtConcurrent::run(export_worker, base + "sim-phase-a-" + index + ext,
+                    _simulator, false, 4, &_export_phases[i][0]));
+        futures.push_back(QtConcurrent::run(export_worker, base + "sim-phase-b-" + index + ext,
+                    _simulator, false, 4, &_export_phases[i][1]));
+    }
+    futures.push_back(QtConcurrent::run(export_worker, base + "sim-depth" + ext, _simulator, false, 3, &_export_result[0]));
+    futures.push_back(QtConcurrent::run(export_worker, base + "sim-amplitude" + ext, _simulator, false, 3, &_export_result[1]));
+    futures.push_back(QtConcurrent::run(export_worker, base + "sim-intensity" + ext, _simulator, false, 3, &_export_result[2]));
+    futures.push_back(QtConcurrent::run(export_worker, base + "sim-coords" + ext, _simulator, true, 3, &_export_result[0]));
+    // Additional modulation frequencies get the suffix -fN; the raw data does not
+    // depend on the frequency and is not repeated.
+    for (int f = 1; f < _simulator.modulation_frequencies(); f++) {
+        std::string suffix = std::string("-f") + static_cast<char>('0' + f) + ext;
+        for (int i = 0; i < Simulator::phases; i++) {
+            std::string index = std::string(1, static_cast<char>('0' + i));
+            futures.push_back(QtConcurrent::run(export_worker, base + "sim-phase-a-" + index + suffix,
+                        _simulator, false, 4, &_export_additional_phases[f - 1][i][0]));
+            futures.push_back(QtConcurrent::run(export_worker, base + "sim-phase-b-" + index + suffix,
+                        _simulator, false, 4, &_export_additional_phases[f - 1][i][1]));
+        }
+        futures.push_back(QtConcurrent::run(export_worker, base + "sim-depth" + suffix,
+                    _simulator, false, 3, &_export_additional_results[f - 1][0]));
+        futures.push_back(QtConcurrent::run(export_worker, base + "sim-amplitude" + suffix,
+                    _simulator, false, 3, &_export_additional_results[f - 1][1]));
+        futures.push_back(QtConcurrent::run(export_worker, base + "sim-intensity" + suffix,
+                    _simulator, false, 3, &_export_additional_results[f - 1][2]));
+    }
+    if (_simulator.modulation_frequencies() > 1) {
+        futures.push_back(QtConcurrent::run(export_worker, base + "sim-depth-unwrapped" + ext,
+                    _simulator, false, 3, &_export_unwrapped_result[0]));
+        futures.push_back(QtConcurrent::run(export_worker, base + "sim-coords-unwrapped" + ext,
+                    _simulator, true, 3, &_export_unwrapped_result[0]));
+    }
 #ifdef HAVE_GTA
 #else
     // Restore original locale
     setlocale(LC_NUMERIC, locbak);
 #endif
     std::string result;
-    if (result.empty()) result = f_rd0.result();
-    if (result.empty()) result = f_rd1.result();
-    if (result.empty()) result = f_rd2.result();
-    if (result.empty()) result = f_rd3.result();
-    if (result.empty()) result = f_rc0.result();
-    if (result.empty()) result = f_rc1.result();
-    if (result.empty()) result = f_rc2.result();
-    if (result.empty()) result = f_rc3.result();
-    if (result.empty()) result = f_re0.result();
-    if (result.empty()) result = f_re1.result();
-    if (result.empty()) result = f_re2.result();
-    if (result.empty()) result = f_re3.result();
-    if (result.empty()) result = f_pa0.result();
-    if (result.empty()) result = f_pa1.result();
-    if (result.empty()) result = f_pa2.result();
-    if (result.empty()) result = f_pa3.result();
-    if (result.empty()) result = f_pb0.result();
-    if (result.empty()) result = f_pb1.result();
-    if (result.empty()) result = f_pb2.result();
-    if (result.empty()) result = f_pb3.result();
-    if (result.empty()) result = f_sd.result();
-    if (result.empty()) result = f_sa.result();
-    if (result.empty()) result = f_si.result();
-    if (result.empty()) result = f_sc.result();
+    for (size_t i = 0; i < futures.size(); i++) {
+        ExportResult r = futures[i].result();
+        _stats.add_cpu_time(Stats::stage_export_worker, r.usecs);
+        if (result.empty())
+            result = r.error;
+    }
     if (!result.empty())
         throw std::runtime_error(result);
 }
@@ -663,6 +876,8 @@ void MainWindow::export_animation(const std::string& dirname, bool show_progress
     progress.setWindowModality(Qt::WindowModal);
     progress.setMinimumDuration(0);
     _sim_timer->stop();
+    _sim_timer_waiting = false;
+    _sim_thread->wait_for_results();
     _anim_widget->stop();
     _anim_widget->start();
     try {
@@ -737,13 +952,17 @@ void MainWindow::simulator_load()
     if (filename.isEmpty())
         return;
     _settings->setValue("Session/directory", QFileInfo(filename).path());
+    Simulator simulator = _simulator;
     try {
-        _simulator.load(filename.toLocal8Bit().constData());
+        simulator.load(filename.toLocal8Bit().constData());
+        if (simulator.noise_model == 1 && !_sim_widget->have_noise_model())
+            throw std::runtime_error(noise_model_unsupported);
     }
     catch (std::exception& e) {
         QMessageBox::critical(this, "Error", e.what());
         return;
     }
+    _simulator = simulator;
     emit update_simulator(_simulator);
     _settings->setValue("Session/simulator", filename);
 }
@@ -822,8 +1041,15 @@ void MainWindow::simulator_edit()
     l0->addWidget(new QLabel("Rendering method:"), row, 0);
     QComboBox* rendering_box = new QComboBox;
     rendering_box->addItem("Default");
+    rendering_box->addItem("CPU ray casting");
     rendering_box->setCurrentIndex(_simulator.rendering_method);
     l0->addWidget(rendering_box, row++, 1);
+    l0->addWidget(new QLabel("Occlusion culling:"), row, 0);
+    QComboBox* occlusion_culling_box = new QComboBox;
+    occlusion_culling_box->addItem("Off");
+    occlusion_culling_box->addItem("On");
+    occlusion_culling_box->setCurrentIndex(_simulator.occlusion_culling);
+    l0->addWidget(occlusion_culling_box, row++, 1);
 
     l0->addWidget(new QLabel("<b>Material</b>"), row++, 0);
 
@@ -947,6 +1173,33 @@ void MainWindow::simulator_edit()
     contrast_spinbox->setRange(0.0, 1.0);
     contrast_spinbox->setValue(_simulator.contrast);
     l0->addWidget(contrast_spinbox, row++, 1);
+    l0->addWidget(new QLabel("Noise model:"), row, 0);
+    QComboBox* noise_model_box = new QComboBox;
+    noise_model_box->addItem("Off");
+    noise_model_box->addItem("Shot, dark, and read noise");
+    noise_model_box->setCurrentIndex(_simulator.noise_model);
+    l0->addWidget(noise_model_box, row++, 1);
+    l0->addWidget(new QLabel("Responsivity [A/W]:"), row, 0);
+    QDoubleSpinBox* responsivity_spinbox = new QDoubleSpinBox;
+    responsivity_spinbox->setDecimals(4);
+    responsivity_spinbox->setRange(0.0001, 10.0);
+    responsivity_spinbox->setValue(_simulator.responsivity);
+    l0->addWidget(responsivity_spinbox, row++, 1);
+    l0->addWidget(new QLabel("Dark current [electrons/s]:"), row, 0);
+    QDoubleSpinBox* dark_current_spinbox = new QDoubleSpinBox;
+    dark_current_spinbox->setRange(0.0, 1e9);
+    dark_current_spinbox->setValue(_simulator.dark_current);
+    l0->addWidget(dark_current_spinbox, row++, 1);
+    l0->addWidget(new QLabel("Read noise [electrons RMS]:"), row, 0);
+    QDoubleSpinBox* read_noise_spinbox = new QDoubleSpinBox;
+    read_noise_spinbox->setRange(0.0, 1e6);
+    read_noise_spinbox->setValue(_simulator.read_noise);
+    l0->addWidget(read_noise_spinbox, row++, 1);
+    l0->addWidget(new QLabel("Noise seed:"), row, 0);
+    QSpinBox* noise_seed_spinbox = new QSpinBox;
+    noise_seed_spinbox->setRange(0, 999999999);
+    noise_seed_spinbox->setValue(_simulator.noise_seed);
+    l0->addWidget(noise_seed_spinbox, row++, 1);
 
     l0->addWidget(new QLabel("<b>User-modifiable parameters</b>"), row++, 0);
 
@@ -955,6 +1208,15 @@ void MainWindow::simulator_edit()
     modulation_frequency_spinbox->setRange(1, 200);
     modulation_frequency_spinbox->setValue(_simulator.modulation_frequency / (1000 * 1000));
     l0->addWidget(modulation_frequency_spinbox, row++, 1);
+    QSpinBox* additional_modulation_frequency_spinbox[Simulator::max_modulation_frequencies - 1];
+    for (int i = 0; i < Simulator::max_modulation_frequencies - 1; i++) {
+        l0->addWidget(new QLabel(QString("Additional modulation frequency %1 (MHz):").arg(i + 1)), row, 0);
+        additional_modulation_frequency_spinbox[i] = new QSpinBox;
+        additional_modulation_frequency_spinbox[i]->setRange(0, 200);
+        additional_modulation_frequency_spinbox[i]->setSpecialValueText("Off");
+        additional_modulation_frequency_spinbox[i]->setValue(_simulator.additional_modulation_frequencies[i] / (1000 * 1000));
+        l0->addWidget(additional_modulation_frequency_spinbox[i], row++, 1);
+    }
     l0->addWidget(new QLabel("Exposure time (microseconds):"), row, 0);
     QSpinBox* exposure_time_spinbox = new QSpinBox;
     exposure_time_spinbox->setRange(1, 50000);
@@ -975,6 +1237,10 @@ void MainWindow::simulator_edit()
 
     dlg->exec();
     if (dlg->result() == QDialog::Accepted) {
+        if (noise_model_box->currentIndex() == 1 && !_sim_widget->have_noise_model()) {
+            QMessageBox::critical(this, "Error", noise_model_unsupported);
+            return;
+        }
         if (lightsource_model_box->currentIndex() == 1) {
             try {
                 _simulator.lightsource_measured_intensities.load(
@@ -990,6 +1256,7 @@ void MainWindow::simulator_edit()
         _simulator.far_plane = far_plane_spinbox->value();
         _simulator.exposure_time_samples = exposure_time_samples_spinbox->value();
         _simulator.rendering_method = rendering_box->currentIndex();
+        _simulator.occlusion_culling = occlusion_culling_box->currentIndex();
         _simulator.material_model = material_model_box->currentIndex();
         _simulator.material_lambertian_reflectivity = material_lambertian_reflectivity_spinbox->value();
         _simulator.lightsource_model = lightsource_model_box->currentIndex();
@@ -1008,7 +1275,15 @@ void MainWindow::simulator_edit()
         _simulator.pixel_pitch = pixel_pitch_spinbox->value();
         _simulator.readout_time = readout_time_spinbox->value();
         _simulator.contrast = contrast_spinbox->value();
+        _simulator.noise_model = noise_model_box->currentIndex();
+        _simulator.responsivity = responsivity_spinbox->value();
+        _simulator.dark_current = dark_current_spinbox->value();
+        _simulator.read_noise = read_noise_spinbox->value();
+        _simulator.noise_seed = noise_seed_spinbox->value();
         _simulator.modulation_frequency = modulation_frequency_spinbox->value() * 1000 * 1000;
+        for (int i = 0; i < Simulator::max_modulation_frequencies - 1; i++)
+            _simulator.additional_modulation_frequencies[i] = additional_modulation_frequency_spinbox[i]->value() * 1000 * 1000;
+        _simulator.compact_modulation_frequencies();
         _simulator.exposure_time = exposure_time_spinbox->value();
         emit update_simulator(_simulator);
     }
@@ -1039,6 +1314,30 @@ void MainWindow::simulator_reset()
     emit update_simulator(_simulator);
 }
 
+bool MainWindow::eventFilter(QObject* watched, QEvent* event)
+{
+    if (watched == _stats_label && event->type() == QEvent::Close)
+        _stats_act->setChecked(false);
+    return QMainWindow::eventFilter(watched, event);
+}
+
+void MainWindow::simulator_show_stats(bool show)
+{
+    if (show) {
+        simulator_update_stats();
+        _stats_label->show();
+        _stats_timer->start(1000);
+    } else {
+        _stats_timer->stop();
+        _stats_label->hide();
+    }
+}
+
+void MainWindow::simulator_update_stats()
+{
+    _stats_label->setText(QString::fromStdString(_stats.to_string()));
+}
+
 void MainWindow::background_load()
 {
     QString filename = QFileDialog::getOpenFileName(this, "Load background",
@@ -1449,7 +1748,7 @@ void MainWindow::animation_load()
 {
     QString filename = QFileDialog::getOpenFileName(this, "Load animation",
             _settings->value("Session/directory", QDir::currentPath()).toString(),
-            tr("Animation descriptions (*.txt)"));
+            tr("Animation descriptions (*.txt *.bin)"));
     if (filename.isEmpty())
         return;
     _settings->setValue("Session/directory", QFileInfo(filename).path());
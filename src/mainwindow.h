@@ -19,9 +19,13 @@
 #include "target.h"
 #include "animation.h"
 #include "trianglepatch.h"
+#include "stats.h"
+#include "simthread.h"
 
 class QSettings;
 class QTimer;
+class QLabel;
+class QAction;
 
 class SimWidget;
 class OSGWidget;
@@ -44,31 +48,56 @@ private:
     int _scene_id;
     std::vector<TrianglePatch> _scene;
     SimWidget* _sim_widget;
+    SimThread* _sim_thread;
     OSGWidget* _osg_widget;
     View2DWidget* _depthmap_widget;
-    View2DWidget* _phase_widgets[4];
+    View2DWidget* _phase_widgets[Simulator::phases];
     View2DWidget* _pmd_depth_widget;
     View2DWidget* _pmd_amp_widget;
     View2DWidget* _pmd_intensity_widget;
     AnimWidget* _anim_widget;
 
     QTimer* _sim_timer;
+    bool _sim_timer_waiting;    // stopped until the simulation thread takes the next job
+    QTimer* _view_timer;        // refreshes the views at display rate when new frames arrive
     long long _last_anim_time;
     bool _anim_time_requested;
     long long _anim_time_request;
+    // Frame number for the noise model: the animation frame, or a running counter
+    // in free interaction mode
+    unsigned int _frame_counter;
+
+    // Inputs of the last simulated frame, to skip frames that would not change
+    int _sim_revision;
+    int _last_frame_sim_revision;
+    int _last_frame_scene_id;
+    unsigned int _last_frame_number;
+    std::vector<float> _last_frame_transformations; // per time sample and patch, see SimJob
+    SimJob _sim_job;            // reused for each frame, so that its buffers are reused
+
+    // Performance statistics, shown in a status window and written in script mode
+    Stats _stats;
+    QString _stats_file;
+    QLabel* _stats_label;
+    QTimer* _stats_timer;
+    QAction* _stats_act;
 
     // For data export
-    std::vector<float> _export_phase0;
-    std::vector<float> _export_phase1;
-    std::vector<float> _export_phase2;
-    std::vector<float> _export_phase3;
+    std::vector<float> _export_phases[Simulator::phases];
     std::vector<float> _export_result;
+    unsigned int _export_frame_number;  // frame number of the exported data, for the noise model
+    // Additional modulation frequencies, and the unwrapped result
+    std::vector<float> _export_additional_phases[Simulator::max_modulation_frequencies - 1][Simulator::phases];
+    std::vector<float> _export_additional_results[Simulator::max_modulation_frequencies - 1];
+    std::vector<float> _export_unwrapped_result;
+    void show_frame();
     void get_sim_data(int w, int h);
     void export_frame(const std::string& dirname, int frameno = -1);
     void export_animation(const std::string& dirname, bool show_progress = true);
 
 protected:
     void closeEvent(QCloseEvent* event);
+    bool eventFilter(QObject* watched, QEvent* event);
 
 public:
     MainWindow(
@@ -81,17 +110,21 @@ public:
             QString script_export_dir = QString(),
             bool script_export_animation = false,
             double script_export_frame = 1.0 / 0.0,
-            bool script_minimize_window = false);
+            bool script_minimize_window = false,
+            QString script_stats_file = QString());
     ~MainWindow();
 
 private slots:
     // Scene handling
     void reset_scene();
+    void invalidate_simulation();
     // Animation handling
     void animation_state_changed();
     void animation_time_changed(long long);
     // Simulator loop
     void simulation_step();
+    void simulation_frame_ready();
+    void view_step();
     // Menu actions
     void file_export_frame();
     void file_export_anim();
@@ -100,6 +133,8 @@ private slots:
     void simulator_edit();
     void simulator_export_modelfile();
     void simulator_reset();
+    void simulator_show_stats(bool);
+    void simulator_update_stats();
     void background_load();
     void background_save();
     void background_generate_planar();
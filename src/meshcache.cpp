@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+
+#include "meshcache.h"
+#include "cachefile.h"
+#include "hash.h"
+
+
+/* File format, in native byte order, all fields 4-byte aligned:
+ * - magic "PMDMESH2", byte order mark 0x01020304, path length
+ * - model size, modification time, and content hash (64 bit each)
+ * - model path, padded with zeros to a multiple of 4 bytes
+ * - number of patches
+ * - for each patch: transformation (16 floats), number of vertices,
+ *   color flag, texcoord flag, number of indices, followed by the vertex,
+ *   normal, color (if flag set), texcoord (if flag set), and index arrays */
+
+static const char magic[8] = { 'P', 'M', 'D', 'M', 'E', 'S', 'H', '2' };
+static const unsigned int byte_order_mark = 0x01020304;
+
+static const std::string& mesh_cache_dir()
+{
+    static const std::string dir = cache_dir("meshes");
+    return dir;
+}
+
+MeshCache::MeshCache(const std::string& model_filename) :
+    _size(0), _mtime(0), _hash(hash_init)
+{
+    QFileInfo fi(model_filename.c_str());
+    _model_filename = qPrintable(fi.absoluteFilePath());
+    if (mesh_cache_dir().empty() || !fi.isFile())
+        return;
+    QFile file(fi.absoluteFilePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    _size = file.size();
+    _mtime = fi.lastModified().toMSecsSinceEpoch();
+    if (_size > 0) {
+        const uchar* data = file.map(0, _size);
+        if (!data)
+            return;
+        _hash = hash_data(data, _size);
+    }
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.mesh",
+            hash_data(_model_filename.c_str(), _model_filename.size()));
+    _cache_filename = mesh_cache_dir() + name;
+}
+
+// Sequential reading from the mapped cache file, with bounds checks
+class MappedReader
+{
+private:
+    const uchar* _p;
+    size_t _remaining;
+
+public:
+    MappedReader(const uchar* data, size_t size) : _p(data), _remaining(size) {}
+
+    template<typename T>
+    const T* get(size_t n)
+    {
+        size_t bytes = n * sizeof(T);
+        if (bytes / sizeof(T) != n || bytes > _remaining)
+            return NULL;
+        const T* r = reinterpret_cast<const T*>(_p);
+        _p += bytes;
+        _remaining -= bytes;
+        return r;
+    }
+};
+
+bool MeshCache::load(std::vector<TrianglePatch>* meshes) const
+{
+    if (_cache_filename.empty())
+        return false;
+    std::shared_ptr<QFile> file(new QFile(_cache_filename.c_str()));
+    if (!file->open(QIODevice::ReadOnly) || file->size() <= 0)
+        return false;
+    // The mapping is released when the last patch that references it is gone
+    const uchar* data = file->map(0, file->size());
+    if (!data)
+        return false;
+    MappedReader reader(data, file->size());
+
+    const char* m = reader.get<char>(sizeof(magic));
+    const unsigned int* h = reader.get<unsigned int>(2);
+    if (!m || std::memcmp(m, magic, sizeof(magic)) != 0 || !h || h[0] != byte_order_mark)
+        return false;
+    unsigned int path_length = h[1];
+    const unsigned long long* key = reader.get<unsigned long long>(3);
+    const char* path = reader.get<char>((path_length + 3) / 4 * 4);
+    if (!key || key[0] != _size || static_cast<long long>(key[1]) != _mtime || key[2] != _hash
+            || !path || _model_filename.compare(0, std::string::npos, path, path_length) != 0)
+        return false;
+    const unsigned int* patch_count = reader.get<unsigned int>(1);
+    if (!patch_count)
+        return false;
+
+    std::vector<TrianglePatch> patches(*patch_count);
+    for (size_t p = 0; p < patches.size(); p++) {
+        const float* transformation = reader.get<float>(16);
+        const unsigned int* counts = reader.get<unsigned int>(4);
+        if (!transformation || !counts)
+            return false;
+        size_t vertices = counts[0];
+        size_t indices = counts[3];
+        const float* v = reader.get<float>(3 * vertices);
+        const float* n = reader.get<float>(3 * vertices);
+        const float* c = (counts[1] ? reader.get<float>(4 * vertices) : NULL);
+        const float* t = (counts[2] ? reader.get<float>(2 * vertices) : NULL);
+        const unsigned int* i = reader.get<unsigned int>(indices);
+        if (!v || !n || (counts[1] && !c) || (counts[2] && !t) || !i)
+            return false;
+        for (size_t j = 0; j < indices; j++)
+            if (i[j] >= vertices)
+                return false;
+        TrianglePatch& tp = patches[p];
+        for (int j = 0; j < 16; j++)
+            tp.transformation[j] = transformation[j];
+        tp.vertex_array = SharedArray<float>(file, v, 3 * vertices);
+        tp.normal_array = SharedArray<float>(file, n, 3 * vertices);
+        if (c)
+            tp.color_array = SharedArray<float>(file, c, 4 * vertices);
+        if (t)
+            tp.texcoord_array = SharedArray<float>(file, t, 2 * vertices);
+        tp.index_array = SharedArray<unsigned int>(file, i, indices);
+        tp.compute_bounding_box();
+        tp.compute_hash();
+    }
+    meshes->swap(patches);
+    return true;
+}
+
+template<typename T>
+static bool write_array(FILE* f, const SharedArray<T>& array)
+{
+    return array.empty() || std::fwrite(array.data(), sizeof(T), array.size(), f) == array.size();
+}
+
+void MeshCache::save(const std::vector<TrianglePatch>& meshes) const
+{
+    if (_cache_filename.empty())
+        return;
+    CacheFileWriter writer(_cache_filename);
+    FILE* f = writer.file();
+    if (!f)
+        return;
+    unsigned int header[2] = { byte_order_mark, static_cast<unsigned int>(_model_filename.size()) };
+    unsigned long long key[3] = { _size, static_cast<unsigned long long>(_mtime), _hash };
+    char padding[3] = { 0, 0, 0 };
+    unsigned int patch_count = meshes.size();
+    bool ok = (std::fwrite(magic, sizeof(magic), 1, f) == 1
+            && std::fwrite(header, sizeof(header), 1, f) == 1
+            && std::fwrite(key, sizeof(key), 1, f) == 1
+            && std::fwrite(_model_filename.c_str(), 1, _model_filename.size(), f) == _model_filename.size()
+            && std::fwrite(padding, 1, (4 - _model_filename.size() % 4) % 4, f) == (4 - _model_filename.size() % 4) % 4
+            && std::fwrite(&patch_count, sizeof(patch_count), 1, f) == 1);
+    for (size_t p = 0; ok && p < meshes.size(); p++) {
+        const TrianglePatch& tp = meshes[p];
+        unsigned int vertices = tp.vertex_array.size() / 3;
+        unsigned int counts[4] = {
+            vertices,
+            tp.color_array.size() == 4 * vertices ? 1u : 0u,
+            tp.texcoord_array.size() == 2 * vertices ? 1u : 0u,
+            static_cast<unsigned int>(tp.index_array.size())
+        };
+        ok = (tp.normal_array.size() == tp.vertex_array.size()
+                && std::fwrite(tp.transformation, sizeof(float), 16, f) == 16
+                && std::fwrite(counts, sizeof(counts), 1, f) == 1
+                && write_array(f, tp.vertex_array)
+                && write_array(f, tp.normal_array)
+                && (!counts[1] || write_array(f, tp.color_array))
+                && (!counts[2] || write_array(f, tp.texcoord_array))
+                && write_array(f, tp.index_array));
+    }
+    writer.commit(ok);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <string>
+#include <vector>
+
+#include "trianglepatch.h"
+
+
+/* A cache for the triangle geometry of model files, so that large models are
+ * parsed only once.
+ *
+ * The geometry is stored in a compact binary file in the user's cache
+ * directory. A cache file is valid for a model file with the same path, size,
+ * modification time, and content hash. On loading, the cache file is memory
+ * mapped, and the arrays of the returned patches reference the mapping directly.
+ *
+ * The transformation of each patch is its transformation relative to the model
+ * root. All other per-patch data (bounding box, hash) is recomputed on loading.
+ * Errors are not reported: without a valid cache, the model is simply parsed. */
+
+class MeshCache
+{
+private:
+    std::string _model_filename;        // absolute path
+    std::string _cache_filename;        // empty if caching is not possible
+    unsigned long long _size;
+    long long _mtime;
+    unsigned long long _hash;
+
+public:
+    /* Identify the model file. This hashes its contents. */
+    MeshCache(const std::string& model_filename);
+
+    /* Load the patches of the model from the cache. Returns false if there is
+     * no valid cache file. */
+    bool load(std::vector<TrianglePatch>* meshes) const;
+
+    /* Save the patches of the model to the cache. */
+    void save(const std::vector<TrianglePatch>& meshes) const;
+};
+
+#endif
@@ -0,0 +1,758 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+
+#include <QFile>
+#include <QThread>
+#include <QtConcurrentRun>
+#include <QFuture>
+
+#include "modelloader.h"
+
+
+/* Common helpers */
+
+static int chunk_count()
+{
+    // More chunks than cores, so that uneven chunks balance out
+    return 4 * std::max(QThread::idealThreadCount(), 1);
+}
+
+template<typename T>
+static void wait_for(std::vector<QFuture<T> >& futures)
+{
+    for (size_t i = 0; i < futures.size(); i++)
+        futures[i].waitForFinished();
+}
+
+static bool has_suffix(const std::string& s, const char* suffix)
+{
+    size_t l = std::strlen(suffix);
+    if (s.size() < l)
+        return false;
+    for (size_t i = 0; i < l; i++)
+        if (std::tolower(static_cast<unsigned char>(s[s.size() - l + i])) != suffix[i])
+            return false;
+    return true;
+}
+
+// Add a triangle patch. If normals is empty, normals are computed.
+static void create_patch(std::vector<float>& vertices, std::vector<float>& normals,
+        std::vector<float>& texcoords, std::vector<unsigned int>& indices,
+        std::vector<TrianglePatch>* meshes)
+{
+    meshes->push_back(TrianglePatch());
+    TrianglePatch& tp = meshes->back();
+    bool compute_normals = normals.empty();
+    tp.vertex_array = SharedArray<float>(std::move(vertices));
+    tp.normal_array = SharedArray<float>(std::move(normals));
+    tp.texcoord_array = SharedArray<float>(std::move(texcoords));
+    tp.index_array = SharedArray<unsigned int>(std::move(indices));
+    if (compute_normals)
+        tp.compute_normals();
+    tp.compute_bounding_box();
+    tp.compute_hash();
+}
+
+/* OBJ */
+
+// Number parsing independent of the locale; the GUI may have set a locale
+// that uses a decimal comma.
+
+static inline const char* skip_space(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+static const char* parse_float(const char* p, const char* end, float* f)
+{
+    p = skip_space(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+    double v = 0.0;
+    bool digits = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits = true)
+        v = 10.0 * v + (*p - '0');
+    if (p < end && *p == '.') {
+        double scale = 0.1;
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits = true, scale *= 0.1)
+            v += scale * (*p - '0');
+    }
+    if (!digits)
+        return NULL;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool exp_negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            exp_negative = (*p++ == '-');
+        int e = 0;
+        bool exp_digits = false;
+        for (; p < end && *p >= '0' && *p <= '9'; p++, exp_digits = true)
+            e = std::min(10 * e + (*p - '0'), 1000);
+        if (!exp_digits)
+            return NULL;
+        v *= std::pow(10.0, exp_negative ? -e : e);
+    }
+    *f = (negative ? -v : v);
+    return p;
+}
+
+static const char* parse_int(const char* p, const char* end, long long* i)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+    long long v = 0;
+    bool digits = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits = true)
+        v = std::min(10 * v + (*p - '0'), 1LL << 40);
+    if (!digits)
+        return NULL;
+    *i = (negative ? -v : v);
+    return p;
+}
+
+typedef enum { obj_other, obj_v, obj_vt, obj_vn, obj_f, obj_group, obj_material } obj_line_t;
+
+// Does the line start with the keyword, followed by white space or the end of the line?
+static bool obj_keyword(const char* p, const char* eol, const char* keyword)
+{
+    size_t l = std::strlen(keyword);
+    return (static_cast<size_t>(eol - p) >= l && std::memcmp(p, keyword, l) == 0
+            && (p + l == eol || p[l] == ' ' || p[l] == '\t' || p[l] == '\r'));
+}
+
+static obj_line_t obj_line_type(const char* p, const char* eol, const char** args)
+{
+    p = skip_space(p, eol);
+    obj_line_t type = obj_other;
+    if (eol - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+        type = obj_v;
+        p += 1;
+    } else if (eol - p >= 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) {
+        type = obj_vt;
+        p += 2;
+    } else if (eol - p >= 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+        type = obj_vn;
+        p += 2;
+    } else if (eol - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+        type = obj_f;
+        p += 1;
+    } else if (obj_keyword(p, eol, "o") || obj_keyword(p, eol, "g")) {
+        type = obj_group;
+    } else if (obj_keyword(p, eol, "usemtl") || obj_keyword(p, eol, "mtllib")) {
+        type = obj_material;
+    }
+    *args = p;
+    return type;
+}
+
+class ObjChunk
+{
+public:
+    const char* begin;
+    const char* end;
+    // Pass 1: number of v, vt, vn lines in this chunk
+    size_t count[3];
+    // Pass 1: number of o and g lines, and whether materials are referenced
+    size_t groups;
+    bool materials;
+    // Pass 2: index of the first v, vt, vn of this chunk in the whole file
+    size_t base[3];
+    // Pass 2: index of the group at the start of this chunk
+    size_t base_group;
+    // Pass 2: triangles with 3 corners each; a corner is (v, vt, vn), 0-based, -1 if absent
+    std::vector<long long> corners;
+    // Pass 2: group index and index of the first corner for each run of triangles
+    std::vector<std::pair<size_t, size_t> > runs;
+    std::string error;
+};
+
+static void obj_count(ObjChunk* chunk)
+{
+    chunk->count[0] = chunk->count[1] = chunk->count[2] = 0;
+    chunk->groups = 0;
+    chunk->materials = false;
+    for (const char* p = chunk->begin; p < chunk->end; ) {
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', chunk->end - p));
+        if (!eol)
+            eol = chunk->end;
+        const char* args;
+        obj_line_t type = obj_line_type(p, eol, &args);
+        if (type == obj_v || type == obj_vt || type == obj_vn)
+            chunk->count[type - obj_v]++;
+        else if (type == obj_group)
+            chunk->groups++;
+        else if (type == obj_material)
+            chunk->materials = true;
+        p = eol + 1;
+    }
+}
+
+static void obj_parse(ObjChunk* chunk, float* v, float* vt, float* vn)
+{
+    const int components[3] = { 3, 2, 3 };
+    float* arrays[3] = { v, vt, vn };
+    size_t n[3] = { 0, 0, 0 };
+    size_t group = chunk->base_group;
+    std::vector<long long> face;
+    for (const char* p = chunk->begin; p < chunk->end; ) {
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', chunk->end - p));
+        if (!eol)
+            eol = chunk->end;
+        const char* q;
+        obj_line_t type = obj_line_type(p, eol, &q);
+        if (type == obj_v || type == obj_vt || type == obj_vn) {
+            int a = type - obj_v;
+            float* dst = arrays[a] + components[a] * (chunk->base[a] + n[a]);
+            for (int i = 0; i < components[a]; i++) {
+                // the second texture coordinate is optional
+                const char* r = parse_float(q, eol, dst + i);
+                if (!r && type == obj_vt && i == 1) {
+                    dst[i] = 0.0f;
+                } else if (!r) {
+                    chunk->error = "invalid vertex data";
+                    return;
+                } else {
+                    q = r;
+                }
+            }
+            n[a]++;
+        } else if (type == obj_group) {
+            group++;
+        } else if (type == obj_f) {
+            face.clear();
+            for (q = skip_space(q, eol); q < eol; q = skip_space(q, eol)) {
+                long long corner[3] = { 0, 0, 0 };
+                for (int i = 0; i < 3; i++) {
+                    if (i > 0) {
+                        if (q >= eol || *q != '/')
+                            break;
+                        q++;
+                        if (i == 1 && q < eol && *q == '/')
+                            continue;   // v//vn
+                    }
+                    q = parse_int(q, eol, &corner[i]);
+                    if (!q || corner[i] == 0) {
+                        chunk->error = "invalid face";
+                        return;
+                    }
+                }
+                // Convert to 0-based indices; negative indices are relative to the end
+                for (int i = 0; i < 3; i++) {
+                    if (corner[i] > 0)
+                        corner[i] -= 1;
+                    else if (corner[i] < 0)
+                        corner[i] += chunk->base[i] + n[i];
+                    else
+                        corner[i] = -1;
+                    if (i == 0 && corner[i] < 0) {
+                        chunk->error = "invalid face";
+                        return;
+                    }
+                }
+                face.insert(face.end(), corner, corner + 3);
+            }
+            if (face.size() >= 9 && (chunk->runs.empty() || chunk->runs.back().first != group))
+                chunk->runs.push_back(std::make_pair(group, chunk->corners.size()));
+            for (size_t k = 2; k < face.size() / 3; k++) {
+                chunk->corners.insert(chunk->corners.end(), &(face[0]), &(face[0]) + 3);
+                chunk->corners.insert(chunk->corners.end(), &(face[3 * (k - 1)]), &(face[3 * (k - 1)]) + 3);
+                chunk->corners.insert(chunk->corners.end(), &(face[3 * k]), &(face[3 * k]) + 3);
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+// Maps OBJ corners (v, vt, vn) to vertex indices, using open addressing
+class CornerMap
+{
+private:
+    std::vector<long long> _keys;       // 3 per slot; v == -1 marks an empty slot
+    std::vector<unsigned int> _values;
+    size_t _mask;
+    size_t _size;
+
+    size_t slot(const long long* key) const
+    {
+        uint64_t h = key[0] * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 29) ^ static_cast<uint64_t>(key[1])) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 32) ^ static_cast<uint64_t>(key[2])) * 0x94D049BB133111EBULL;
+        return (h ^ (h >> 31)) & _mask;
+    }
+
+    void resize(size_t capacity)
+    {
+        std::vector<long long> keys(3 * capacity, -1);
+        std::vector<unsigned int> values(capacity);
+        _keys.swap(keys);
+        _values.swap(values);
+        _mask = capacity - 1;
+        for (size_t s = 0; s < values.size(); s++) {
+            if (keys[3 * s] >= 0) {
+                size_t t = slot(&keys[3 * s]);
+                while (_keys[3 * t] >= 0)
+                    t = (t + 1) & _mask;
+                std::memcpy(&_keys[3 * t], &keys[3 * s], 3 * sizeof(long long));
+                _values[t] = values[s];
+            }
+        }
+    }
+
+public:
+    CornerMap(size_t expected) : _mask(0), _size(0)
+    {
+        size_t capacity = 1024;
+        while (capacity < 2 * expected)
+            capacity *= 2;
+        resize(capacity);
+    }
+
+    // Return the value of the key, or insert the key with the given value
+    unsigned int insert(const long long* key, unsigned int value)
+    {
+        size_t s = slot(key);
+        while (_keys[3 * s] >= 0) {
+            if (_keys[3 * s] == key[0] && _keys[3 * s + 1] == key[1] && _keys[3 * s + 2] == key[2])
+                return _values[s];
+            s = (s + 1) & _mask;
+        }
+        std::memcpy(&_keys[3 * s], key, 3 * sizeof(long long));
+        _values[s] = value;
+        if (++_size > _values.size() / 2)
+            resize(2 * _values.size());
+        return value;
+    }
+};
+
+// Consecutive triangles of one group within one chunk
+class ObjRun
+{
+public:
+    size_t group;
+    size_t chunk;
+    long long* begin;
+    long long* end;
+};
+
+// Build a triangle patch from the runs first to last-1, with deduplicated vertices
+static void obj_create_patch(const std::vector<ObjRun>& runs, size_t first, size_t last,
+        const std::vector<float>& v, const std::vector<float>& vt, const std::vector<float>& vn,
+        bool all_vt, bool all_vn, std::vector<TrianglePatch>* meshes)
+{
+    size_t corner_count = 0;
+    for (size_t r = first; r < last; r++)
+        corner_count += (runs[r].end - runs[r].begin) / 3;
+    std::vector<float> vertices, normals, texcoords;
+    std::vector<unsigned int> indices(corner_count);
+    CornerMap map(corner_count / 6);
+    size_t k = 0;
+    unsigned int vertex_count = 0;
+    for (size_t r = first; r < last; r++) {
+        for (long long* key = runs[r].begin; key < runs[r].end; key += 3) {
+            if (!all_vt)
+                key[1] = -1;
+            if (!all_vn)
+                key[2] = -1;
+            unsigned int index = map.insert(key, vertex_count);
+            if (index == vertex_count) {
+                vertices.insert(vertices.end(), &v[3 * key[0]], &v[3 * key[0]] + 3);
+                if (all_vt)
+                    texcoords.insert(texcoords.end(), &vt[2 * key[1]], &vt[2 * key[1]] + 2);
+                if (all_vn)
+                    normals.insert(normals.end(), &vn[3 * key[2]], &vn[3 * key[2]] + 3);
+                vertex_count++;
+            }
+            indices[k++] = index;
+        }
+    }
+    create_patch(vertices, normals, texcoords, indices, meshes);
+}
+
+static bool load_obj(const std::string& filename, const char* data, size_t size,
+        std::vector<TrianglePatch>* meshes)
+{
+    // Split the file into chunks at line boundaries
+    int chunks = chunk_count();
+    std::vector<ObjChunk> c(chunks);
+    const char* p = data;
+    for (int i = 0; i < chunks; i++) {
+        c[i].begin = p;
+        const char* e = data + size * (i + 1) / chunks;
+        if (e < p)
+            e = p;
+        const char* eol = (e < data + size ? static_cast<const char*>(std::memchr(e, '\n', data + size - e)) : NULL);
+        c[i].end = p = (i == chunks - 1 || !eol ? data + size : eol + 1);
+    }
+
+    // Pass 1: count the vertex data of each chunk
+    std::vector<QFuture<void> > futures;
+    for (int i = 0; i < chunks; i++)
+        futures.push_back(QtConcurrent::run(obj_count, &c[i]));
+    wait_for(futures);
+    size_t total[3] = { 0, 0, 0 };
+    size_t total_groups = 0;
+    for (int i = 0; i < chunks; i++) {
+        // Materials are only supported by OpenSceneGraph
+        if (c[i].materials)
+            return false;
+        for (int a = 0; a < 3; a++) {
+            c[i].base[a] = total[a];
+            total[a] += c[i].count[a];
+        }
+        c[i].base_group = total_groups;
+        total_groups += c[i].groups;
+    }
+
+    // Pass 2: parse the chunks; the vertex data goes directly into the shared arrays
+    std::vector<float> v(3 * total[0]), vt(2 * total[1]), vn(3 * total[2]);
+    futures.clear();
+    for (int i = 0; i < chunks; i++)
+        futures.push_back(QtConcurrent::run(obj_parse, &c[i],
+                    total[0] > 0 ? &v[0] : NULL, total[1] > 0 ? &vt[0] : NULL, total[2] > 0 ? &vn[0] : NULL));
+    wait_for(futures);
+    for (int i = 0; i < chunks; i++)
+        if (!c[i].error.empty())
+            throw std::runtime_error(std::string("Cannot read ").append(filename).append(": ").append(c[i].error));
+
+    // Check the indices and find out which attributes are available for all corners
+    size_t corner_count = 0;
+    bool all_vt = true, all_vn = true;
+    for (int i = 0; i < chunks; i++) {
+        const std::vector<long long>& corners = c[i].corners;
+        for (size_t j = 0; j < corners.size(); j += 3) {
+            for (int a = 0; a < 3; a++) {
+                if (corners[j + a] >= static_cast<long long>(total[a]))
+                    throw std::runtime_error(std::string("Cannot read ").append(filename).append(": invalid index"));
+            }
+            all_vt = all_vt && corners[j + 1] >= 0;
+            all_vn = all_vn && corners[j + 2] >= 0;
+        }
+        corner_count += corners.size() / 3;
+    }
+    if (corner_count / 3 * 3 > 0xffffffffULL)
+        throw std::runtime_error(std::string("Cannot read ").append(filename).append(": too many triangles"));
+
+    // Collect the runs of triangles of each group
+    std::vector<ObjRun> runs;
+    for (int i = 0; i < chunks; i++) {
+        for (size_t r = 0; r < c[i].runs.size(); r++) {
+            ObjRun run;
+            run.group = c[i].runs[r].first;
+            run.chunk = i;
+            run.begin = &(c[i].corners[0]) + c[i].runs[r].second;
+            run.end = &(c[i].corners[0]) + (r + 1 < c[i].runs.size() ? c[i].runs[r + 1].second : c[i].corners.size());
+            runs.push_back(run);
+        }
+    }
+
+    // Build the vertices and indices
+    if (!all_vt && !all_vn && (runs.empty() || runs.front().group == runs.back().group)) {
+        // A single patch in which each position is a vertex; no deduplication necessary
+        std::vector<float> normals, texcoords;
+        std::vector<unsigned int> indices(corner_count);
+        size_t k = 0;
+        for (int i = 0; i < chunks; i++)
+            for (size_t j = 0; j < c[i].corners.size(); j += 3)
+                indices[k++] = c[i].corners[j];
+        create_patch(v, normals, texcoords, indices, meshes);
+    } else {
+        // One patch per group. The groups are in file order, so the runs of
+        // each group are consecutive.
+        size_t freed_chunks = 0;
+        for (size_t first = 0; first < runs.size(); ) {
+            size_t last = first + 1;
+            while (last < runs.size() && runs[last].group == runs[first].group)
+                last++;
+            obj_create_patch(runs, first, last, v, vt, vn, all_vt, all_vn, meshes);
+            // Release the corners of the chunks that are done
+            size_t done_chunks = (last < runs.size() ? runs[last].chunk : chunks);
+            for (; freed_chunks < done_chunks; freed_chunks++)
+                std::vector<long long>().swap(c[freed_chunks].corners);
+            first = last;
+        }
+    }
+    return true;
+}
+
+/* PLY */
+
+class PlyProperty
+{
+public:
+    std::string name;
+    int type;           // scalar type, or list element type
+    int count_type;     // list count type, or -1 for scalars
+};
+
+class PlyElement
+{
+public:
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+};
+
+typedef enum { ply_int8, ply_uint8, ply_int16, ply_uint16, ply_int32, ply_uint32, ply_float32, ply_float64 } ply_type_t;
+
+static int ply_type(const std::string& name)
+{
+    const char* names[2][8] = {
+        { "char", "uchar", "short", "ushort", "int", "uint", "float", "double" },
+        { "int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64" }
+    };
+    for (int i = 0; i < 2; i++)
+        for (int t = 0; t < 8; t++)
+            if (name == names[i][t])
+                return t;
+    return -1;
+}
+
+static size_t ply_size(int type)
+{
+    const size_t sizes[8] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+    return sizes[type];
+}
+
+static double ply_value(const unsigned char* p, int type, bool swap)
+{
+    unsigned char b[8];
+    size_t s = ply_size(type);
+    for (size_t i = 0; i < s; i++)
+        b[i] = p[swap ? s - 1 - i : i];
+    switch (type) {
+    case ply_int8:    { int8_t v;   std::memcpy(&v, b, 1); return v; }
+    case ply_uint8:   { uint8_t v;  std::memcpy(&v, b, 1); return v; }
+    case ply_int16:   { int16_t v;  std::memcpy(&v, b, 2); return v; }
+    case ply_uint16:  { uint16_t v; std::memcpy(&v, b, 2); return v; }
+    case ply_int32:   { int32_t v;  std::memcpy(&v, b, 4); return v; }
+    case ply_uint32:  { uint32_t v; std::memcpy(&v, b, 4); return v; }
+    case ply_float32: { float v;    std::memcpy(&v, b, 4); return v; }
+    default:          { double v;   std::memcpy(&v, b, 8); return v; }
+    }
+}
+
+// Vertex data layout; QtConcurrent::run takes at most five arguments
+class PlyVertexLayout
+{
+public:
+    const unsigned char* data;
+    size_t stride;
+    int offsets[6];     // x, y, z, nx, ny, nz
+    int types[6];
+    int attributes;     // 3 or 6
+    bool swap;
+    float* v;
+    float* vn;
+};
+
+static void ply_parse_vertices(const PlyVertexLayout* layout, size_t first, size_t count)
+{
+    for (size_t i = first; i < first + count; i++) {
+        const unsigned char* p = layout->data + i * layout->stride;
+        for (int a = 0; a < layout->attributes; a++) {
+            float* dst = (a < 3 ? layout->v + 3 * i + a : layout->vn + 3 * i + a - 3);
+            *dst = ply_value(p + layout->offsets[a], layout->types[a], layout->swap);
+        }
+    }
+}
+
+static bool load_ply(const std::string& filename, const unsigned char* data, size_t size,
+        std::vector<TrianglePatch>* meshes)
+{
+    const std::runtime_error invalid(std::string("Cannot read ").append(filename).append(": invalid PLY file"));
+
+    // Parse the header
+    const char* header_end_str = "end_header";
+    const unsigned char* body = NULL;
+    for (size_t i = 0; i + 10 < size && !body; i++)
+        if (data[i] == '\n' && std::memcmp(data + i + 1, header_end_str, 10) == 0) {
+            const unsigned char* eol = static_cast<const unsigned char*>(std::memchr(data + i + 11, '\n', size - i - 11));
+            if (!eol)
+                throw invalid;
+            body = eol + 1;
+        }
+    if (size < 4 || std::memcmp(data, "ply", 3) != 0 || !body)
+        throw invalid;
+    std::istringstream header(std::string(reinterpret_cast<const char*>(data), body - data));
+    std::string line;
+    bool swap = false;
+    bool binary = false;
+    std::vector<PlyElement> elements;
+    while (std::getline(header, line)) {
+        std::istringstream ls(line);
+        std::string keyword;
+        ls >> keyword;
+        if (keyword == "format") {
+            std::string format;
+            ls >> format;
+            const uint16_t one = 1;
+            bool little_endian_host = (*reinterpret_cast<const unsigned char*>(&one) == 1);
+            if (format == "binary_little_endian") {
+                binary = true;
+                swap = !little_endian_host;
+            } else if (format == "binary_big_endian") {
+                binary = true;
+                swap = little_endian_host;
+            }
+        } else if (keyword == "element") {
+            PlyElement e;
+            ls >> e.name >> e.count;
+            if (!ls)
+                throw invalid;
+            elements.push_back(e);
+        } else if (keyword == "property") {
+            PlyProperty p;
+            std::string type;
+            ls >> type;
+            if (type == "list") {
+                std::string count_type;
+                ls >> count_type >> type;
+                p.count_type = ply_type(count_type);
+                if (p.count_type < 0 || p.count_type >= ply_float32)
+                    throw invalid;
+            } else {
+                p.count_type = -1;
+            }
+            p.type = ply_type(type);
+            ls >> p.name;
+            if (!ls || p.type < 0 || elements.empty())
+                throw invalid;
+            elements.back().properties.push_back(p);
+        }
+    }
+    if (!binary)
+        return false;   // ASCII PLY is left to OpenSceneGraph
+
+    // Parse the body
+    const unsigned char* end = data + size;
+    const unsigned char* p = body;
+    std::vector<float> vertices, normals, texcoords;
+    std::vector<unsigned int> indices;
+    size_t vertex_count = 0;
+    for (size_t e = 0; e < elements.size(); e++) {
+        const PlyElement& element = elements[e];
+        bool has_lists = false;
+        size_t stride = 0;
+        for (size_t i = 0; i < element.properties.size(); i++) {
+            has_lists = has_lists || element.properties[i].count_type >= 0;
+            stride += ply_size(element.properties[i].type);
+        }
+        if (element.name == "vertex") {
+            // x, y, z and optionally nx, ny, nz
+            const char* names[6] = { "x", "y", "z", "nx", "ny", "nz" };
+            PlyVertexLayout layout;
+            int found = 0;
+            for (int a = 0; a < 6; a++) {
+                size_t offset = 0;
+                for (size_t i = 0; i < element.properties.size(); i++) {
+                    if (element.properties[i].name == names[a]) {
+                        layout.offsets[a] = offset;
+                        layout.types[a] = element.properties[i].type;
+                        found |= (1 << a);
+                    }
+                    offset += ply_size(element.properties[i].type);
+                }
+            }
+            if (has_lists || (found & 7) != 7 || element.count > static_cast<size_t>(end - p) / stride)
+                throw invalid;
+            vertex_count = element.count;
+            layout.data = p;
+            layout.stride = stride;
+            layout.attributes = ((found & 0x38) == 0x38 ? 6 : 3);
+            layout.swap = swap;
+            vertices.resize(3 * vertex_count);
+            if (layout.attributes == 6)
+                normals.resize(3 * vertex_count);
+            layout.v = (vertex_count > 0 ? &vertices[0] : NULL);
+            layout.vn = (layout.attributes == 6 && vertex_count > 0 ? &normals[0] : NULL);
+            int chunks = chunk_count();
+            std::vector<QFuture<void> > futures;
+            for (int i = 0; i < chunks; i++) {
+                size_t first = vertex_count * i / chunks;
+                size_t count = vertex_count * (i + 1) / chunks - first;
+                futures.push_back(QtConcurrent::run(ply_parse_vertices,
+                            static_cast<const PlyVertexLayout*>(&layout), first, count));
+            }
+            wait_for(futures);
+            p += element.count * stride;
+        } else if (!has_lists) {
+            if (element.count > static_cast<size_t>(end - p) / std::max(stride, static_cast<size_t>(1)))
+                throw invalid;
+            p += element.count * stride;
+        } else {
+            // Elements with lists have variable size and are parsed sequentially.
+            // Faces are triangulated as fans.
+            bool is_face = (element.name == "face");
+            for (size_t j = 0; j < element.count; j++) {
+                for (size_t i = 0; i < element.properties.size(); i++) {
+                    const PlyProperty& prop = element.properties[i];
+                    if (prop.count_type < 0) {
+                        if (static_cast<size_t>(end - p) < ply_size(prop.type))
+                            throw invalid;
+                        p += ply_size(prop.type);
+                        continue;
+                    }
+                    if (static_cast<size_t>(end - p) < ply_size(prop.count_type))
+                        throw invalid;
+                    size_t n = ply_value(p, prop.count_type, swap);
+                    p += ply_size(prop.count_type);
+                    size_t s = ply_size(prop.type);
+                    if (n > static_cast<size_t>(end - p) / s)
+                        throw invalid;
+                    if (is_face && (prop.name == "vertex_indices" || prop.name == "vertex_index")) {
+                        for (size_t k = 2; k < n; k++) {
+                            size_t corners[3] = { 0, k - 1, k };
+                            for (int c = 0; c < 3; c++) {
+                                double index = ply_value(p + corners[c] * s, prop.type, swap);
+                                if (!(index >= 0.0 && index < vertex_count))
+                                    throw invalid;
+                                indices.push_back(index);
+                            }
+                        }
+                    }
+                    p += n * s;
+                }
+            }
+        }
+    }
+    create_patch(vertices, normals, texcoords, indices, meshes);
+    return true;
+}
+
+bool load_model_file(const std::string& filename, std::vector<TrianglePatch>* meshes)
+{
+    bool obj = has_suffix(filename, ".obj");
+    bool ply = has_suffix(filename, ".ply");
+    if (!obj && !ply)
+        return false;
+    QFile file(filename.c_str());
+    if (!file.open(QIODevice::ReadOnly))
+        throw std::runtime_error(std::string("Cannot open ").append(filename));
+    size_t size = file.size();
+    const unsigned char* data = (size > 0 ? file.map(0, size) : NULL);
+    if (size > 0 && !data)
+        throw std::runtime_error(std::string("Cannot read ").append(filename));
+    meshes->clear();
+    if (obj) {
+        return load_obj(filename, reinterpret_cast<const char*>(data), size, meshes);
+    } else {
+        return load_ply(filename, data, size, meshes);
+    }
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef MODELLOADER_H
+#define MODELLOADER_H
+
+#include <string>
+#include <vector>
+
+#include "trianglepatch.h"
+
+
+/* Native loaders for large model files, as a faster alternative to the
+ * OpenSceneGraph plugins.
+ *
+ * Supported are OBJ files without materials (v, vt, vn, f, o, and g) and binary
+ * PLY files (vertex positions and normals, and faces). The file is memory mapped
+ * and parsed in parallel chunks on all cores. Vertices of OBJ files are
+ * deduplicated so that each unique combination of position, texture coordinate
+ * and normal becomes one vertex. Polygons are triangulated as fans. If the file
+ * does not provide normals for all vertices, they are computed.
+ *
+ * The result is one triangle patch per OBJ object or group (o or g) that has
+ * faces, or a single patch for PLY files, all with an identity transformation.
+ *
+ * load_model_file() returns false if the file is not supported (e.g. ASCII PLY,
+ * or OBJ with mtllib or usemtl), so that the caller can fall back to
+ * OpenSceneGraph, and throws an exception if the file cannot be read or is
+ * invalid. */
+
+bool load_model_file(const std::string& filename, std::vector<TrianglePatch>* meshes);
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#version 130
+
+// Apply sensor noise to an accumulated phase image.
+// This is the same computation as in noise.h; see there for details.
+
+uniform sampler2D phase_tex;            // energy_a, energy_b, raw_depth, raw_energy
+uniform uint seed;
+uniform uint frame;
+uniform uint stream;                    // phase image and modulation frequency
+uniform float electrons_per_energy;     // electrons per zeptojoule
+uniform float dark_electrons;           // dark current electrons per exposure
+uniform float read_noise;               // electrons RMS
+
+// High 32 bits of the 64 bit product a*b, computed from 16 bit halves since
+// GLSL 1.30 has no wide multiplication
+uint mulhi(uint a, uint b)
+{
+    uint a_lo = a & 0xFFFFu;
+    uint a_hi = a >> 16;
+    uint b_lo = b & 0xFFFFu;
+    uint b_hi = b >> 16;
+    uint lo_lo = a_lo * b_lo;
+    uint hi_lo = a_hi * b_lo;
+    uint lo_hi = a_lo * b_hi;
+    uint hi_hi = a_hi * b_hi;
+    uint cross = (lo_lo >> 16) + (hi_lo & 0xFFFFu) + lo_hi;    // cannot overflow
+    return hi_hi + (hi_lo >> 16) + (cross >> 16);
+}
+
+uvec4 philox4x32_10(uvec4 ctr, uvec2 key)
+{
+    for (int i = 0; i < 10; i++) {
+        uint hi0 = mulhi(0xD2511F53u, ctr.x);
+        uint lo0 = 0xD2511F53u * ctr.x;
+        uint hi1 = mulhi(0xCD9E8D57u, ctr.z);
+        uint lo1 = 0xCD9E8D57u * ctr.z;
+        ctr = uvec4(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+        key += uvec2(0x9E3779B9u, 0xBB67AE85u);
+    }
+    return ctr;
+}
+
+float noisy_energy(float energy, float g)
+{
+    float electrons = max(energy * electrons_per_energy, 0.0) + dark_electrons;
+    float sigma = sqrt(electrons + read_noise * read_noise);
+    return max(electrons + sigma * g, 0.0) / electrons_per_energy;
+}
+
+void main(void)
+{
+    const float pi = 3.14159265358979323846;
+    uvec4 r = philox4x32_10(uvec4(uvec2(gl_FragCoord.xy), frame, stream), uvec2(seed, 0u));
+    float u1 = (float(r.x >> 8) + 0.5) / 16777216.0;
+    float u2 = float(r.y >> 8) / 16777216.0;
+    float radius = sqrt(-2.0 * log(u1));
+    float angle = 2.0 * pi * u2;
+
+    vec4 p = texture2D(phase_tex, gl_TexCoord[0].xy);
+    // The raw depth and raw energy are ideal values and stay unchanged.
+    gl_FragColor = vec4(
+            noisy_energy(p.x, radius * cos(angle)),
+            noisy_energy(p.y, radius * sin(angle)),
+            p.z, p.w);
+}
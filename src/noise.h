@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+
+#include "simulator.h"
+
+/**
+ * \file noise.h
+ * \brief Sensor noise model, CPU reference implementation.
+ *
+ * This is the same computation as in noise.fs.glsl. The random numbers come
+ * from the counter-based generator Philox4x32-10 (Salmon et al., "Parallel
+ * random numbers: as easy as 1, 2, 3", SC 2011), keyed by pixel, frame,
+ * phase image and seed. They do not depend on the order in which pixels are
+ * processed, so noise computed on the GPU and on the CPU is the same up to
+ * floating point differences in the Gaussian transform.
+ */
+
+/** \brief Philox4x32-10: transform the counter ctr with the given key */
+inline void philox4x32_10(uint32_t ctr[4], uint32_t key0, uint32_t key1)
+{
+    for (int i = 0; i < 10; i++) {
+        uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * ctr[0];
+        uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * ctr[2];
+        uint32_t hi0 = p0 >> 32, lo0 = p0;
+        uint32_t hi1 = p1 >> 32, lo1 = p1;
+        uint32_t c1 = ctr[1], c3 = ctr[3];
+        ctr[0] = hi1 ^ c1 ^ key0;
+        ctr[1] = lo1;
+        ctr[2] = hi0 ^ c3 ^ key1;
+        ctr[3] = lo0;
+        key0 += 0x9E3779B9u;
+        key1 += 0xBB67AE85u;
+    }
+}
+
+/** \brief Return the noise stream for a phase image of a modulation frequency */
+inline uint32_t noise_stream(int phase_index, int frequency)
+{
+    return frequency * Simulator::phases + phase_index;
+}
+
+/** \brief Compute two independent standard normal random numbers for a pixel.
+ *
+ * \param x         Pixel column
+ * \param y         Pixel row, counted from the bottom row as in OpenGL
+ * \param frame     Frame number
+ * \param stream    Noise stream, see noise_stream()
+ * \param seed      Simulator::noise_seed
+ * \param g         The two random numbers
+ */
+inline void noise_gaussians(uint32_t x, uint32_t y, uint32_t frame, uint32_t stream, uint32_t seed, float g[2])
+{
+    uint32_t r[4] = { x, y, frame, stream };
+    philox4x32_10(r, seed, 0u);
+    // Box-Muller transform; u1 is in (0,1) so that the logarithm is finite
+    float u1 = (static_cast<float>(r[0] >> 8) + 0.5f) / 16777216.0f;
+    float u2 = static_cast<float>(r[1] >> 8) / 16777216.0f;
+    float radius = std::sqrt(-2.0f * std::log(u1));
+    float angle = 2.0f * static_cast<float>(M_PI) * u2;
+    g[0] = radius * std::cos(angle);
+    g[1] = radius * std::sin(angle);
+}
+
+/** \brief Apply shot noise, dark noise and read noise to the energy of one tap.
+ *
+ * \param energy                Accumulated energy of the tap in zeptojoule
+ * \param electrons_per_energy  See Simulator::electrons_per_zeptojoule()
+ * \param dark_electrons        See Simulator::dark_electrons()
+ * \param read_noise            Simulator::read_noise
+ * \param g                     A standard normal random number
+ *
+ * Photon shot noise and dark current shot noise follow a Poisson distribution,
+ * which is approximated by a normal distribution. This is accurate for the
+ * electron counts that occur in practice (more than a few dozen per exposure).
+ * The dark current also adds its mean to the signal. The result is returned as
+ * energy again, so that all following computations are unchanged.
+ */
+inline float noisy_energy(float energy, float electrons_per_energy, float dark_electrons, float read_noise, float g)
+{
+    float electrons = std::max(energy * electrons_per_energy, 0.0f) + dark_electrons;
+    float sigma = std::sqrt(electrons + read_noise * read_noise);
+    return std::max(electrons + sigma * g, 0.0f) / electrons_per_energy;
+}
+
+#endif
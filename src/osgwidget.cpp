@@ -7,13 +7,16 @@
  */
 
 #include <cassert>
+#include <algorithm>
+#include <map>
 #include <cstdio>
-#include <cstring>
 #include <vector>
 #include <stdexcept>
 
 #include <QGridLayout>
 #include <QMessageBox>
+#include <QFileInfo>
+#include <QDateTime>
 
 #include <osg/Geode>
 #include <osg/MatrixTransform>
@@ -30,9 +33,10 @@
 #include <osgDB/WriteFile>
 #include <osgGA/TrackballManipulator>
 #include <osgGA/GUIEventHandler>
-#include <osgUtil/Optimizer>
 
 #include "osgwidget.h"
+#include "meshcache.h"
+#include "modelloader.h"
 
 /* Hide all OSG details in a private struct; see corresponding header file. */
 struct HideOSGProblems {
@@ -44,6 +48,12 @@ struct HideOSGProblems {
     osg::ref_ptr<osg::MatrixTransform> _target_animation;
     osg::ref_ptr<osg::MatrixTransform> _target_transformation;
     osg::ref_ptr<osg::Node> _target;
+    // Triangle patches captured from background and target; they share the
+    // vertex data with the scene graph.
+    std::vector<TrianglePatch> _background_patches;
+    bool _background_captured;
+    std::vector<TrianglePatch> _target_patches;
+    bool _target_captured;
     osg::ref_ptr<osg::GraphicsContext::Traits> _traits;
     osg::ref_ptr<osg::Camera> _camera;
     osg::ref_ptr<osg::Camera> _clear_camera;
@@ -90,11 +100,14 @@ public:
     };
 };
 
-OSGWidget::OSGWidget(QGLWidget* sharing_widget) : QWidget()
+OSGWidget::OSGWidget(QGLWidget* sharing_widget) : QWidget(),
+    _target_model_size(-1), _target_model_mtime(-1)
 {
     assert(sharing_widget);
     setMinimumSize(32, 32);
     _osg = new struct HideOSGProblems;
+    _osg->_background_captured = false;
+    _osg->_target_captured = false;
 
     _osg->_viewer = new osgViewer::CompositeViewer;
     // Set to single-thread mode to avoid spurious rendering errors:
@@ -190,113 +203,186 @@ void OSGWidget::update_simulator(const Simulator& sim)
     _simulator = sim;
 }
 
-static osg::Geometry* create_triangle(
-        const osg::Vec3f& v0, const osg::Vec3f& v1, const osg::Vec3f& v2,
-        const osg::Vec3f& color)
-{
-    osg::ref_ptr<osg::Vec3Array> vrt = new osg::Vec3Array();
-    osg::ref_ptr<osg::Vec3Array> nrm = new osg::Vec3Array();
-    osg::ref_ptr<osg::Vec4Array> clr = new osg::Vec4Array();
-    // front face
-    vrt->push_back(v0);
-    vrt->push_back(v1);
-    vrt->push_back(v2);
-    osg::Vec3f fn((v0 - v1) ^ (v2 - v1));
-    fn.normalize();
-    nrm->resize(nrm->size() + 3, -fn);
-    clr->resize(clr->size() + 3, osg::Vec4f(color.x(), color.y(), color.z(), 1.0f));
-    // back face
-    vrt->push_back(v0);
-    vrt->push_back(v2);
-    vrt->push_back(v1);
-    osg::Vec3f bn((v1 - v0) ^ (v2 - v0));
-    bn.normalize();
-    nrm->resize(nrm->size() + 3, -bn);
-    clr->resize(clr->size() + 3, osg::Vec4f(color.x(), color.y(), color.z(), 1.0f));
-    // put it together
-    osg::Geometry* geom  = new osg::Geometry();
-    geom->setVertexArray(vrt);
-    geom->setNormalArray(nrm);
-    geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
-    geom->setColorArray(clr);
-    geom->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
-    geom->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::TRIANGLES, 0, 2 * 3));
-    return geom;
-}
+static osg::ref_ptr<osg::Node> load_model(const std::string& filename);
 
-static osg::Geometry* create_quad(
-        const osg::Vec3f& v0, const osg::Vec3f& v1, const osg::Vec3f& v2, const osg::Vec3f& v3,
-        const osg::Vec3f& color)
+// Builds a procedural target as a single indexed triangle mesh. Each face is
+// added twice, as front and back face, since the two sides have different
+// normals. Vertices with identical position, normal, and color are shared.
+class MeshBuilder
 {
-    osg::ref_ptr<osg::Vec3Array> vrt = new osg::Vec3Array();
-    osg::ref_ptr<osg::Vec3Array> nrm = new osg::Vec3Array();
-    osg::ref_ptr<osg::Vec4Array> clr = new osg::Vec4Array();
-    // front face
-    vrt->push_back(v0);
-    vrt->push_back(v1);
-    vrt->push_back(v2);
-    vrt->push_back(v3);
-    osg::Vec3f fn((v0 - v1) ^ (v2 - v1));
-    fn.normalize();
-    nrm->resize(nrm->size() + 4, -fn);
-    clr->resize(clr->size() + 4, osg::Vec4f(color.x(), color.y(), color.z(), 1.0f));
-    // back face
-    vrt->push_back(v0);
-    vrt->push_back(v3);
-    vrt->push_back(v2);
-    vrt->push_back(v1);
-    osg::Vec3f bn((v1 - v0) ^ (v3 - v0));
-    bn.normalize();
-    nrm->resize(nrm->size() + 4, -bn);
-    clr->resize(clr->size() + 4, osg::Vec4f(color.x(), color.y(), color.z(), 1.0f));
-    // put it together
-    osg::Geometry* geom  = new osg::Geometry();
-    geom->setVertexArray(vrt);
-    geom->setNormalArray(nrm);
-    geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
-    geom->setColorArray(clr);
-    geom->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
-    geom->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::QUADS, 0, 2 * 4));
-    return geom;
-}
+private:
+    osg::ref_ptr<osg::Vec3Array> _vrt;
+    osg::ref_ptr<osg::Vec3Array> _nrm;
+    osg::ref_ptr<osg::Vec4Array> _clr;
+    osg::ref_ptr<osg::DrawElementsUInt> _idx;
+    std::map<std::vector<float>, unsigned int> _vertex_map;
+
+    unsigned int vertex(const osg::Vec3f& v, const osg::Vec3f& n, const osg::Vec3f& c)
+    {
+        std::vector<float> key(9);
+        for (int i = 0; i < 3; i++) {
+            key[i] = v[i];
+            key[3 + i] = n[i];
+            key[6 + i] = c[i];
+        }
+        std::pair<std::map<std::vector<float>, unsigned int>::iterator, bool> r
+            = _vertex_map.insert(std::make_pair(key, _vrt->size()));
+        if (r.second) {
+            _vrt->push_back(v);
+            _nrm->push_back(n);
+            _clr->push_back(osg::Vec4f(c.x(), c.y(), c.z(), 1.0f));
+        }
+        return r.first->second;
+    }
+
+    // Add a convex polygon as a triangle fan
+    void add_polygon(const osg::Vec3f* v, int n, const osg::Vec3f& normal, const osg::Vec3f& color)
+    {
+        unsigned int i0 = vertex(v[0], normal, color);
+        unsigned int i1 = vertex(v[1], normal, color);
+        for (int i = 2; i < n; i++) {
+            unsigned int i2 = vertex(v[i], normal, color);
+            _idx->push_back(i0);
+            _idx->push_back(i1);
+            _idx->push_back(i2);
+            i1 = i2;
+        }
+    }
+
+public:
+    MeshBuilder() :
+        _vrt(new osg::Vec3Array()),
+        _nrm(new osg::Vec3Array()),
+        _clr(new osg::Vec4Array()),
+        _idx(new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES))
+    {
+    }
+
+    void add_triangle(
+            const osg::Vec3f& v0, const osg::Vec3f& v1, const osg::Vec3f& v2,
+            const osg::Vec3f& color)
+    {
+        // front face
+        osg::Vec3f f[3] = { v0, v1, v2 };
+        osg::Vec3f fn((v0 - v1) ^ (v2 - v1));
+        fn.normalize();
+        add_polygon(f, 3, -fn, color);
+        // back face
+        osg::Vec3f b[3] = { v0, v2, v1 };
+        osg::Vec3f bn((v1 - v0) ^ (v2 - v0));
+        bn.normalize();
+        add_polygon(b, 3, -bn, color);
+    }
+
+    void add_quad(
+            const osg::Vec3f& v0, const osg::Vec3f& v1, const osg::Vec3f& v2, const osg::Vec3f& v3,
+            const osg::Vec3f& color)
+    {
+        // front face
+        osg::Vec3f f[4] = { v0, v1, v2, v3 };
+        osg::Vec3f fn((v0 - v1) ^ (v2 - v1));
+        fn.normalize();
+        add_polygon(f, 4, -fn, color);
+        // back face
+        osg::Vec3f b[4] = { v0, v3, v2, v1 };
+        osg::Vec3f bn((v1 - v0) ^ (v3 - v0));
+        bn.normalize();
+        add_polygon(b, 4, -bn, color);
+    }
+
+    // Return a Geode with a single drawable, or an empty Geode if nothing was added
+    osg::Geode* geode() const
+    {
+        osg::Geode* geode = new osg::Geode;
+        if (_idx->size() > 0) {
+            osg::Geometry* geom = new osg::Geometry();
+            geom->setVertexArray(_vrt);
+            geom->setNormalArray(_nrm);
+            geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+            geom->setColorArray(_clr);
+            geom->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+            geom->addPrimitiveSet(_idx);
+            geode->addDrawable(geom);
+        }
+        return geode;
+    }
+};
+
+static const osg::Vec3f blueish(128 / 255.0f, 128 / 255.0f, 192/ 255.0f);
+static const osg::Vec3f reddish(192 / 255.0f, 128 / 255.0f, 128 / 255.0f);
+static const osg::Vec3f greenish(128 / 255.0f, 192 / 255.0f, 128 / 255.0f);
+static const osg::Vec3f grayish(128 / 255.0f, 128 / 255.0f, 128 / 255.0f);
 
 void OSGWidget::update_scene(const Target& background, const Target& target)
 {
-    static const osg::Vec3f blueish(128 / 255.0f, 128 / 255.0f, 192/ 255.0f);
-    static const osg::Vec3f reddish(192 / 255.0f, 128 / 255.0f, 128 / 255.0f);
-    static const osg::Vec3f greenish(128 / 255.0f, 192 / 255.0f, 128 / 255.0f);
-    static const osg::Vec3f grayish(128 / 255.0f, 128 / 255.0f, 128 / 255.0f);
-
+    // Only recreate what changed, so that the other part keeps its scene graph
+    // and its captured triangle patches (and thus its GPU buffers).
+    bool background_changed = (!_osg->_background || !(background == _background));
+    bool target_changed = (!_osg->_target || !(target == _target));
+    if (!target_changed && target.variant == Target::variant_model) {
+        QFileInfo fi(target.model_filename.c_str());
+        target_changed = (fi.size() != _target_model_size
+                || fi.lastModified().toMSecsSinceEpoch() != _target_model_mtime);
+    }
     _background = background;
     _target = target;
-
-    // Recreate background
     _osg->_root->removeChild(_osg->_background_animation);
+    _osg->_root->removeChild(_osg->_target_animation);
+    if (background_changed)
+        recreate_background();
+    if (target_changed)
+        recreate_target();
+
+    // The background must come first in the scene graph, so that the patch
+    // order matches the patch caches in capture_scene().
+    _osg->_root->addChild(_osg->_background_animation);
+    _osg->_root->addChild(_osg->_target_animation);
+
+    _osg->_view->setSceneData(_osg->_root.get());
+#if 0
+    if (_mode == mode_free_interaction) {
+        _force_mode_update = true;
+        set_mode(_mode);
+    }
+#endif
+}
+
+void OSGWidget::recreate_background()
+{
+    _osg->_background_patches.clear();
+    _osg->_background_captured = false;
     _osg->_background_animation = new osg::MatrixTransform();
     _osg->_background_animation->setMatrix(osg::Matrixf::identity());
     _osg->_background_transformation = new osg::MatrixTransform();
     assert(_background.variant == Target::variant_background_planar);
     if (_background.variant == Target::variant_background_planar) {
-        _osg->_background = new osg::Geode;
+        MeshBuilder mesh;
         if (_background.background_planar_dist > 0.0f) {
             float bg_x0 = - _background.background_planar_width / 2.0f;
             float bg_x1 = - bg_x0;
             float bg_y0 = - _background.background_planar_height / 2.0f;
             float bg_y1 = - bg_y0;
             float bg_z = - _background.background_planar_dist;
-            _osg->_background->asGeode()->addDrawable(create_quad(
-                        osg::Vec3f(bg_x0, bg_y0, bg_z),
-                        osg::Vec3f(bg_x1, bg_y0, bg_z),
-                        osg::Vec3f(bg_x1, bg_y1, bg_z),
-                        osg::Vec3f(bg_x0, bg_y1, bg_z),
-                        grayish));
+            mesh.add_quad(
+                    osg::Vec3f(bg_x0, bg_y0, bg_z),
+                    osg::Vec3f(bg_x1, bg_y0, bg_z),
+                    osg::Vec3f(bg_x1, bg_y1, bg_z),
+                    osg::Vec3f(bg_x0, bg_y1, bg_z),
+                    grayish);
         }
+        _osg->_background = mesh.geode();
         _osg->_background->getOrCreateStateSet()->setMode(GL_CULL_FACE, osg::StateAttribute::ON);
         _osg->_background_transformation->setMatrix(osg::Matrixf::identity());
     }
 
-    // Recreate target
-    _osg->_root->removeChild(_osg->_target_animation);
+    _osg->_background_transformation->addChild(_osg->_background);
+    _osg->_background_animation->addChild(_osg->_background_transformation);
+}
+
+void OSGWidget::recreate_target()
+{
+    _osg->_target_patches.clear();
+    _osg->_target_captured = false;
     _osg->_target_animation = new osg::MatrixTransform();
     _osg->_target_animation->setMatrix(osg::Matrixf::identity());
     _osg->_target_transformation = new osg::MatrixTransform();
@@ -344,14 +430,14 @@ void OSGWidget::update_scene(const Target& background, const Target& target)
             bars[5 * i + 4] -= max_z;
         }
         // Add geometry for all bars
-        _osg->_target = new osg::Geode;
+        MeshBuilder mesh;
         for (int i = 0; i < _target.number_of_bars; i++)
-            _osg->_target->asGeode()->addDrawable(create_quad(
-                        osg::Vec3f(bars[5*i+0]              , bars[5*i+1]              , bars[5*i+4]),
-                        osg::Vec3f(bars[5*i+0] + bars[5*i+2], bars[5*i+1]              , bars[5*i+4]),
-                        osg::Vec3f(bars[5*i+0] + bars[5*i+2], bars[5*i+1] + bars[5*i+3], bars[5*i+4]),
-                        osg::Vec3f(bars[5*i+0]              , bars[5*i+1] + bars[5*i+3], bars[5*i+4]),
-                        i % 2 == 0 ? greenish : reddish));
+            mesh.add_quad(
+                    osg::Vec3f(bars[5*i+0]              , bars[5*i+1]              , bars[5*i+4]),
+                    osg::Vec3f(bars[5*i+0] + bars[5*i+2], bars[5*i+1]              , bars[5*i+4]),
+                    osg::Vec3f(bars[5*i+0] + bars[5*i+2], bars[5*i+1] + bars[5*i+3], bars[5*i+4]),
+                    osg::Vec3f(bars[5*i+0]              , bars[5*i+1] + bars[5*i+3], bars[5*i+4]),
+                    i % 2 == 0 ? greenish : reddish);
         // Add background plane
         if (_target.bar_background_near_side >= 0 && _target.bar_background_near_side <= 3) {
             float bg_x0 = -(max_x - min_x) / 2.0f;
@@ -383,18 +469,19 @@ void OSGWidget::update_scene(const Target& background, const Target& target)
                 bg_z_bl -= _target.bar_background_dist_near;
                 bg_z_br -= _target.bar_background_dist_near;
             }
-            _osg->_target->asGeode()->addDrawable(create_quad(
-                        osg::Vec3f(bg_x0, bg_y0, bg_z_bl),
-                        osg::Vec3f(bg_x1, bg_y0, bg_z_br),
-                        osg::Vec3f(bg_x1, bg_y1, bg_z_tr),
-                        osg::Vec3f(bg_x0, bg_y1, bg_z_tl),
-                        blueish));
+            mesh.add_quad(
+                    osg::Vec3f(bg_x0, bg_y0, bg_z_bl),
+                    osg::Vec3f(bg_x1, bg_y0, bg_z_br),
+                    osg::Vec3f(bg_x1, bg_y1, bg_z_tr),
+                    osg::Vec3f(bg_x0, bg_y1, bg_z_tl),
+                    blueish);
         }
+        _osg->_target = mesh.geode();
         _osg->_target->getOrCreateStateSet()->setMode(GL_CULL_FACE, osg::StateAttribute::ON);
         _osg->_target_transformation->setMatrix(osg::Matrixf::rotate(static_cast<float>(M_PI_2), 1.0f, 0.0f, 0.0f));
         _osg->_target_transformation->postMult(osg::Matrixf::rotate(static_cast<float>(_target.bar_rotation), 0.0f, 1.0f, 0.0f));
     } else if (_target.variant == Target::variant_star) {
-        _osg->_target = new osg::Geode;
+        MeshBuilder mesh;
         float spoke_width = static_cast<float>(M_PI) / _target.star_spokes;
         float spokes_start = - spoke_width / 2.0f;
         for (int i = 0; i < 2 * _target.star_spokes; i++) {
@@ -403,24 +490,28 @@ void OSGWidget::update_scene(const Target& background, const Target& target)
             osg::Vec2f v1(_target.star_radius * cosf(start_angle), _target.star_radius * sinf(start_angle));
             osg::Vec2f v2(_target.star_radius * cosf(end_angle), _target.star_radius * sinf(end_angle));
             // background spoke
-            _osg->_target->asGeode()->addDrawable(create_triangle(
-                        osg::Vec3f(0.0f, 0.0f, -_target.star_background_dist_center),
-                        osg::Vec3f(v1.x(), v1.y(), -_target.star_background_dist_rim),
-                        osg::Vec3f(v2.x(), v2.y(), -_target.star_background_dist_rim),
-                        blueish));
+            mesh.add_triangle(
+                    osg::Vec3f(0.0f, 0.0f, -_target.star_background_dist_center),
+                    osg::Vec3f(v1.x(), v1.y(), -_target.star_background_dist_rim),
+                    osg::Vec3f(v2.x(), v2.y(), -_target.star_background_dist_rim),
+                    blueish);
             if (i % 2 == 0) {
                 // flat spoke in front of the background
-                _osg->_target->asGeode()->addDrawable(create_triangle(
-                            osg::Vec3f(0.0f, 0.0f, 0.0f),
-                            osg::Vec3f(v1.x(), v1.y(), 0.0f),
-                            osg::Vec3f(v2.x(), v2.y(), 0.0f),
-                            greenish));
+                mesh.add_triangle(
+                        osg::Vec3f(0.0f, 0.0f, 0.0f),
+                        osg::Vec3f(v1.x(), v1.y(), 0.0f),
+                        osg::Vec3f(v2.x(), v2.y(), 0.0f),
+                        greenish);
             }
         }
+        _osg->_target = mesh.geode();
         _osg->_target->getOrCreateStateSet()->setMode(GL_CULL_FACE, osg::StateAttribute::ON);
         _osg->_target_transformation->setMatrix(osg::Matrixf::rotate(static_cast<float>(M_PI_2), 1.0f, 0.0f, 0.0f));
     } else {
-        _osg->_target = osgDB::readNodeFile(_target.model_filename);
+        QFileInfo fi(_target.model_filename.c_str());
+        _target_model_size = fi.size();
+        _target_model_mtime = fi.lastModified().toMSecsSinceEpoch();
+        _osg->_target = load_model(_target.model_filename);
         if (!_osg->_target) {
             // Fallback geometry
             _osg->_target = new osg::Geode;
@@ -430,28 +521,11 @@ void OSGWidget::update_scene(const Target& background, const Target& target)
         _osg->_target_transformation->setMatrix(osg::Matrixf::identity());
     }
 
-    // Convert the scene to optimized, index triangles. We need that for capturing
-    // the geometry into triangle patches (see capture() and update()).
-    osgUtil::Optimizer optimizer;
-    optimizer.optimize(_osg->_background.get(), osgUtil::Optimizer::DEFAULT_OPTIMIZATIONS
-            | osgUtil::Optimizer::INDEX_MESH);
-    optimizer.optimize(_osg->_target.get(), osgUtil::Optimizer::DEFAULT_OPTIMIZATIONS
-            | osgUtil::Optimizer::INDEX_MESH);
+    // No optimizer pass is necessary: capture_scene() triangulates all kinds of
+    // primitive sets directly.
 
-    _osg->_background_transformation->addChild(_osg->_background);
-    _osg->_background_animation->addChild(_osg->_background_transformation);
-    _osg->_root->addChild(_osg->_background_animation);
     _osg->_target_transformation->addChild(_osg->_target);
     _osg->_target_animation->addChild(_osg->_target_transformation);
-    _osg->_root->addChild(_osg->_target_animation);
-
-    _osg->_view->setSceneData(_osg->_root.get());
-#if 0
-    if (_mode == mode_free_interaction) {
-        _force_mode_update = true;
-        set_mode(_mode);
-    }
-#endif
 }
 
 void OSGWidget::draw_frame()
@@ -553,98 +627,193 @@ public:
     {
     }
 
+    // Reference the float data of an OSG array, keeping the array alive for as
+    // long as any triangle patch uses it
+    static SharedArray<float> share_array(const osg::Array* array, int components)
+    {
+        std::shared_ptr<osg::ref_ptr<const osg::Array> > owner(new osg::ref_ptr<const osg::Array>(array));
+        return SharedArray<float>(owner, static_cast<const float*>(array->getDataPointer()),
+                components * array->getNumElements());
+    }
+
+    // Use a vertex attribute array if it has one element per vertex, or repeat a
+    // single element (overall binding) for all vertices. Otherwise, the attribute
+    // is ignored.
+    static SharedArray<float> get_attribute(const osg::Array* array, osg::Array::Type type,
+            int components, unsigned int vertices)
+    {
+        if (!array || array->getType() != type)
+            return SharedArray<float>();
+        if (array->getNumElements() == vertices)
+            return share_array(array, components);
+        if (array->getNumElements() == 1) {
+            const float* element = static_cast<const float*>(array->getDataPointer());
+            std::vector<float> v(components * vertices);
+            for (unsigned int i = 0; i < vertices; i++)
+                for (int j = 0; j < components; j++)
+                    v[i * components + j] = element[j];
+            return SharedArray<float>(std::move(v));
+        }
+        return SharedArray<float>();
+    }
+
+    void extract(const osg::Geometry* geom, TrianglePatch* tp)
+    {
+        const osg::Array* vertex_array = geom->getVertexArray();
+        if (!vertex_array || vertex_array->getType() != osg::Array::Vec3ArrayType
+                || vertex_array->getNumElements() == 0)
+            return;
+        unsigned int vertices = vertex_array->getNumElements();
+        // Let our triangle patches share the vertex and attribute data
+        tp->vertex_array = share_array(vertex_array, 3);
+        tp->color_array = get_attribute(geom->getColorArray(), osg::Array::Vec4ArrayType, 4, vertices);
+        tp->texcoord_array = get_attribute(geom->getTexCoordArray(0), osg::Array::Vec2ArrayType, 2, vertices);
+        // Now get the correct sequence of indices. We need a visitor just for that...
+        std::vector<unsigned int> indices;
+        for (unsigned int i = 0; i < geom->getNumPrimitiveSets(); i++) {
+            const osg::PrimitiveSet* ps = geom->getPrimitiveSet(i);
+            IndexVisitor iv(&indices);
+            ps->accept(iv);
+        }
+        tp->index_array = SharedArray<unsigned int>(std::move(indices));
+        // Normals are required; compute them if the geometry does not provide them per vertex
+        if (geom->getNormalArray() && geom->getNormalArray()->getType() == osg::Array::Vec3ArrayType
+                && geom->getNormalArray()->getNumElements() == vertices)
+            tp->normal_array = share_array(geom->getNormalArray(), 3);
+        else
+            tp->compute_normals();
+        // Compute the bounds and the hash once; they are needed for culling and
+        // for GPU buffer reuse in each simulation step.
+        tp->compute_bounding_box();
+        tp->compute_hash();
+        // TODO: get texture: tp->texture = ...;
+    }
+
+    // Each geometry drawable becomes one triangle patch
     virtual void apply(osg::Geode& node)
     {
         osg::Matrix mat = osg::computeLocalToEye(_cam_matrix, getNodePath());
-        if (_update_only) {
-            for (int i = 0; i < 16; i++)
-                _scene->at(_index).transformation[i] = mat.ptr()[i];
-        } else {
-            _scene->push_back(TrianglePatch());
-            for (int i = 0; i < 16; i++)
-                _scene->back().transformation[i] = mat.ptr()[i];
-            if (node.getNumDrawables() > 0) {
-                assert(node.getNumDrawables() == 1);
-                // Get vertex data. We expect index triangles!
-                const osg::Drawable* drawable = node.getDrawable(0);
-                assert(drawable);
-                const osg::Geometry* geom = dynamic_cast<const osg::Geometry*>(drawable);
-                if (geom) {
-                    const osg::Array* vertex_array = geom->getVertexArray();
-                    const osg::Array* normal_array = geom->getNormalArray();
-                    const osg::Array* color_array = geom->getColorArray();
-                    const osg::Array* texcoord_array = geom->getTexCoordArray(0);
-                    // Sanity check.
-                    assert(vertex_array);
-                    assert(vertex_array->getType() == osg::Array::Vec3ArrayType);
-                    assert(normal_array);
-                    assert(normal_array->getType() == osg::Array::Vec3ArrayType);
-                    assert(normal_array->getNumElements() == vertex_array->getNumElements());
-                    assert(!color_array || color_array->getType() == osg::Array::Vec4ArrayType);
-                    assert(!color_array || color_array->getNumElements() == vertex_array->getNumElements());
-                    assert(!texcoord_array || texcoord_array->getType() == osg::Array::Vec2ArrayType);
-                    assert(!texcoord_array || texcoord_array->getNumElements() == vertex_array->getNumElements());
-                    // Copy the vertex and attribute data to our triangle patches
-                    _scene->back().vertex_array.resize(3 * vertex_array->getNumElements());
-                    std::memcpy(&(_scene->back().vertex_array[0]), vertex_array->getDataPointer(), sizeof(float) * 3 * vertex_array->getNumElements());
-                    _scene->back().normal_array.resize(3 * normal_array->getNumElements());
-                    std::memcpy(&(_scene->back().normal_array[0]), normal_array->getDataPointer(), sizeof(float) * 3 * normal_array->getNumElements());
-                    if (color_array) {
-                        _scene->back().color_array.resize(4 * color_array->getNumElements());
-                        std::memcpy(&(_scene->back().color_array[0]), color_array->getDataPointer(), sizeof(float) * 4 * color_array->getNumElements());
-                    }
-                    if (texcoord_array) {
-                        _scene->back().texcoord_array.resize(2 * texcoord_array->getNumElements());
-                        std::memcpy(&(_scene->back().texcoord_array[0]), texcoord_array->getDataPointer(), sizeof(float) * 2 * texcoord_array->getNumElements());
-                    }
-                    // Now get the correct sequence of indices. We need a visitor just for that...
-                    for (unsigned int i = 0; i < geom->getNumPrimitiveSets(); i++) {
-                        const osg::PrimitiveSet* ps = geom->getPrimitiveSet(i);
-                        IndexVisitor iv(&_scene->back());
-                        ps->accept(iv);
-                    }
-                    // TODO: get texture: _scene->back().texture = ...;
-                }
+        for (unsigned int d = 0; d < node.getNumDrawables(); d++) {
+            const osg::Geometry* geom = dynamic_cast<const osg::Geometry*>(node.getDrawable(d));
+            if (!geom)
+                continue;
+            if (_update_only) {
+                for (int i = 0; i < 16; i++)
+                    _scene->at(_index).transformation[i] = mat.ptr()[i];
+            } else {
+                _scene->push_back(TrianglePatch());
+                for (int i = 0; i < 16; i++)
+                    _scene->back().transformation[i] = mat.ptr()[i];
+                extract(geom, &_scene->back());
             }
+            _index++;
         }
         traverse(node);
-        _index++;
     }
 
+    // Convert all polygonal primitive sets to triangle indices. Point and line
+    // primitives are ignored.
     class IndexVisitor : public osg::PrimitiveIndexFunctor
     {
     private:
-        TrianglePatch* _tp;
+        std::vector<unsigned int>* _indices;
+
+        class ArrayIndices
+        {
+        public:
+            GLint first;
+            unsigned int operator[](GLsizei i) const { return first + i; }
+        };
 
         template<typename T>
-        void _drawElements(GLenum mode, GLsizei count, const T* indices)
+        class ElementIndices
+        {
+        public:
+            const T* indices;
+            unsigned int operator[](GLsizei i) const { return indices[i]; }
+        };
+
+        static GLsizei triangles(GLenum mode, GLsizei count)
+        {
+            switch (mode) {
+            case GL_TRIANGLES:
+                return count / 3;
+            case GL_TRIANGLE_STRIP:
+            case GL_TRIANGLE_FAN:
+            case GL_POLYGON:
+                return (count >= 3 ? count - 2 : 0);
+            case GL_QUADS:
+                return count / 4 * 2;
+            case GL_QUAD_STRIP:
+                return (count >= 4 ? (count - 2) / 2 * 2 : 0);
+            default:
+                return 0;
+            }
+        }
+
+        template<typename I>
+        void add(GLenum mode, GLsizei count, const I& v)
         {
-            assert(mode == GL_TRIANGLES || mode == GL_TRIANGLE_STRIP);
-            assert(count > 0);
-            assert(indices);
-            if (mode == GL_TRIANGLES) {
-                for (int i = 2; i < count; i += 3) {
-                    _tp->index_array.push_back(indices[i - 2]);
-                    _tp->index_array.push_back(indices[i - 1]);
-                    _tp->index_array.push_back(indices[i    ]);
+            GLsizei n = triangles(mode, count);
+            if (n == 0)
+                return;
+            size_t base = _indices->size();
+            _indices->resize(base + 3 * n);
+            unsigned int* t = &((*_indices)[base]);
+            switch (mode) {
+            case GL_TRIANGLES:
+                for (GLsizei i = 0; i < 3 * n; i++)
+                    t[i] = v[i];
+                break;
+            case GL_TRIANGLE_STRIP:
+                // every second triangle has reversed orientation
+                for (GLsizei i = 0; i < n; i++, t += 3) {
+                    t[0] = v[i];
+                    t[1] = v[(i % 2) == 0 ? i + 1 : i + 2];
+                    t[2] = v[(i % 2) == 0 ? i + 2 : i + 1];
+                }
+                break;
+            case GL_TRIANGLE_FAN:
+            case GL_POLYGON:
+                for (GLsizei i = 0; i < n; i++, t += 3) {
+                    t[0] = v[0];
+                    t[1] = v[i + 1];
+                    t[2] = v[i + 2];
+                }
+                break;
+            case GL_QUADS:
+                for (GLsizei i = 0; i < n / 2; i++, t += 6) {
+                    t[0] = v[4 * i + 0];
+                    t[1] = v[4 * i + 1];
+                    t[2] = v[4 * i + 2];
+                    t[3] = v[4 * i + 0];
+                    t[4] = v[4 * i + 2];
+                    t[5] = v[4 * i + 3];
                 }
-            } else if (mode == GL_TRIANGLE_STRIP) {
-                for (int i = 2; i < count; i++) {
-                    if ((i % 2) == 0) {
-                        _tp->index_array.push_back(indices[i - 2]);
-                        _tp->index_array.push_back(indices[i - 1]);
-                        _tp->index_array.push_back(indices[i    ]);
-                    } else {
-                        _tp->index_array.push_back(indices[i - 2]);
-                        _tp->index_array.push_back(indices[i    ]);
-                        _tp->index_array.push_back(indices[i - 1]);
-                    }
+                break;
+            case GL_QUAD_STRIP:
+                for (GLsizei i = 0; i < n / 2; i++, t += 6) {
+                    t[0] = v[2 * i + 0];
+                    t[1] = v[2 * i + 1];
+                    t[2] = v[2 * i + 3];
+                    t[3] = v[2 * i + 0];
+                    t[4] = v[2 * i + 3];
+                    t[5] = v[2 * i + 2];
                 }
+                break;
             }
         }
 
+        template<typename T>
+        void _drawElements(GLenum mode, GLsizei count, const T* indices)
+        {
+            ElementIndices<T> v;
+            v.indices = indices;
+            add(mode, count, v);
+        }
+
     public:
-        IndexVisitor(TrianglePatch* tp) : _tp(tp)
+        IndexVisitor(std::vector<unsigned int>* indices) : _indices(indices)
         {
         }
 
@@ -655,7 +824,12 @@ public:
         virtual void setVertexArray(unsigned int, const osg::Vec3d*) {}
         virtual void setVertexArray(unsigned int, const osg::Vec4d*) {}
 
-        virtual void drawArrays(GLenum, GLint, GLsizei) {}
+        virtual void drawArrays(GLenum mode, GLint first, GLsizei count)
+        {
+            ArrayIndices v;
+            v.first = first;
+            add(mode, count, v);
+        }
         virtual void drawElements(GLenum mode, GLsizei count, const GLuint* indices) { _drawElements<GLuint>(mode, count, indices); }
         virtual void drawElements(GLenum mode, GLsizei count, const GLubyte* indices) { _drawElements<GLubyte>(mode, count, indices); }
         virtual void drawElements(GLenum mode, GLsizei count, const GLushort* indices) { _drawElements<GLushort>(mode, count, indices); }
@@ -666,11 +840,97 @@ public:
     };
 };
 
+/* Model loading, using the mesh cache */
+
+static osg::Node* create_model_node(const std::vector<TrianglePatch>& meshes)
+{
+    osg::Group* group = new osg::Group;
+    for (size_t p = 0; p < meshes.size(); p++) {
+        const TrianglePatch& tp = meshes[p];
+        size_t vertices = tp.vertex_array.size() / 3;
+        osg::ref_ptr<osg::Vec3Array> vrt = new osg::Vec3Array(vertices);
+        osg::ref_ptr<osg::Vec3Array> nrm = new osg::Vec3Array(vertices);
+        if (vertices > 0) {
+            std::copy(tp.vertex_array.data(), tp.vertex_array.data() + 3 * vertices, &((*vrt)[0][0]));
+            std::copy(tp.normal_array.data(), tp.normal_array.data() + 3 * vertices, &((*nrm)[0][0]));
+        }
+        osg::Geometry* geom = new osg::Geometry;
+        geom->setVertexArray(vrt);
+        geom->setNormalArray(nrm);
+        geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+        if (!tp.color_array.empty() && vertices > 0) {
+            osg::ref_ptr<osg::Vec4Array> clr = new osg::Vec4Array(vertices);
+            std::copy(tp.color_array.data(), tp.color_array.data() + 4 * vertices, &((*clr)[0][0]));
+            geom->setColorArray(clr);
+            geom->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+        }
+        if (!tp.texcoord_array.empty() && vertices > 0) {
+            osg::ref_ptr<osg::Vec2Array> tex = new osg::Vec2Array(vertices);
+            std::copy(tp.texcoord_array.data(), tp.texcoord_array.data() + 2 * vertices, &((*tex)[0][0]));
+            geom->setTexCoordArray(0, tex);
+        }
+        geom->addPrimitiveSet(new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES,
+                    tp.index_array.size(), tp.index_array.data()));
+        osg::Geode* geode = new osg::Geode;
+        geode->addDrawable(geom);
+        osg::Matrixf mat(tp.transformation);
+        if (mat.isIdentity()) {
+            group->addChild(geode);
+        } else {
+            osg::MatrixTransform* transform = new osg::MatrixTransform(mat);
+            transform->addChild(geode);
+            group->addChild(transform);
+        }
+    }
+    return group;
+}
+
+static osg::ref_ptr<osg::Node> load_model(const std::string& filename)
+{
+    MeshCache cache(filename);
+    std::vector<TrianglePatch> meshes;
+    if (cache.load(&meshes))
+        return create_model_node(meshes);
+    try {
+        if (load_model_file(filename, &meshes)) {
+            cache.save(meshes);
+            return create_model_node(meshes);
+        }
+    }
+    catch (std::exception& e) {
+        // Let OpenSceneGraph try; it may understand more of the file
+        fprintf(stderr, "%s\n", e.what());
+    }
+    osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(filename);
+    if (node) {
+        // Capture the geometry relative to the model root for the cache
+        Extractor extractor(osg::Matrix::identity(), &meshes, false);
+        node->accept(extractor);
+        cache.save(meshes);
+    }
+    return node;
+}
+
 void OSGWidget::capture_scene(std::vector<TrianglePatch>* scene) const
 {
+    // Extract the patches of background and target only if they were
+    // recreated since the last capture; otherwise reuse them.
+    if (!_osg->_background_captured) {
+        Extractor extractor(_osg->_camera->getViewMatrix(), &_osg->_background_patches, false);
+        static_cast<osg::Node*>(_osg->_background_animation)->accept(extractor);
+        _osg->_background_captured = true;
+    }
+    if (!_osg->_target_captured) {
+        Extractor extractor(_osg->_camera->getViewMatrix(), &_osg->_target_patches, false);
+        static_cast<osg::Node*>(_osg->_target_animation)->accept(extractor);
+        _osg->_target_captured = true;
+    }
     scene->clear();
-    Extractor extractor(_osg->_camera->getViewMatrix(), scene, false);
-    static_cast<osg::Node*>(_osg->_root)->accept(extractor);
+    scene->reserve(_osg->_background_patches.size() + _osg->_target_patches.size());
+    scene->insert(scene->end(), _osg->_background_patches.begin(), _osg->_background_patches.end());
+    scene->insert(scene->end(), _osg->_target_patches.begin(), _osg->_target_patches.end());
+    // The cached transformations may be outdated
+    update_scene(scene);
 }
 
 void OSGWidget::update_scene(std::vector<TrianglePatch>* scene) const
@@ -38,6 +38,9 @@ private:
     Simulator _simulator;
     Target _background;
     Target _target;
+    // Size and modification time of the model file that the target was created
+    // from, so that an edited file with the same name is loaded again
+    long long _target_model_size, _target_model_mtime;
     struct HideOSGProblems* _osg;
     bool _force_mode_update;
     mode_t _mode;
@@ -65,6 +68,9 @@ public slots:
     void update_scene(const Target&, const Target&);
 
 private:
+    void recreate_background();
+    void recreate_target();
+
     #include "simviewhelper.inl"
 };
 
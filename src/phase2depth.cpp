@@ -0,0 +1,600 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+/* pmdsim-phase2depth: recompute sim-depth, sim-amplitude, sim-intensity and
+ * sim-coords from exported sim-phase-a-* and sim-phase-b-* files, without
+ * re-rendering. The computations are the same as in simresult.fs.glsl and
+ * export_worker() in mainwindow.cpp.
+ *
+ * With additional modulation frequencies, their results get the suffix -fN as
+ * in the export, and the depth is unwrapped as in unwrap.fs.glsl.
+ *
+ * Frames are processed in parallel, and the per-pixel computations work on
+ * whole arrays at a time so that they use SSE if available.
+ *
+ * Optionally, sensor noise is added to noise-free phase images first. This
+ * uses the same random numbers as noise.fs.glsl, so the result matches a
+ * simulation with noise model 1. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <cerrno>
+#include <clocale>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef __SSE__
+# include <xmmintrin.h>
+#endif
+
+#include <QDebug>
+#include <QCoreApplication>
+#include <QStringList>
+#include <QDir>
+#include <QFileInfo>
+#include <QtConcurrentMap>
+
+#ifdef HAVE_GTA
+# include <gta/gta.hpp>
+#endif
+
+#include "simulator.h"
+#include "noise.h"
+
+
+class Settings
+{
+public:
+    int frequencies;            // number of modulation frequencies
+    float frac_c_modfreq[Simulator::max_modulation_frequencies];    // c / modulation frequency, as passed to simresult.fs.glsl
+    float ambiguity_range[Simulator::max_modulation_frequencies];   // as passed to unwrap.fs.glsl
+    int max_wraps;              // as passed to unwrap.fs.glsl
+    float aperture_angle;       // in degrees, for sim-coords
+    float depth_offset;         // added to all nonzero depth values
+    bool positive_phase;        // map phase shifts to [0,2pi) instead of [-pi,pi]
+    bool compute_coords;        // write sim-coords
+    bool add_noise;             // apply noise model 1 to the phase images
+    uint32_t noise_seed;
+    float electrons_per_energy;
+    float dark_electrons;
+    float read_noise;
+};
+
+class Frame
+{
+public:
+    std::string input_base;     // e.g. "dir/00042-"
+    std::string output_base;
+    std::string ext;            // ".csv" or ".gta"
+    unsigned int number;        // frame number from the file name prefix, for the noise model
+    const Settings* settings;
+    std::string error;
+};
+
+static void read_image(const std::string& filename, int* w, int* h, std::vector<float>& data)
+{
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        throw std::system_error(errno, std::system_category(),
+                std::string("Cannot open ").append(filename));
+    }
+    if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".gta") == 0) {
+#ifdef HAVE_GTA
+        gta::header hdr;
+        try {
+            hdr.read_from(f);
+            if (hdr.dimensions() != 2 || hdr.components() != 1 || hdr.component_type(0) != gta::float32) {
+                throw std::runtime_error(
+                        std::string("Cannot read ").append(filename).append(": not a single-channel float32 image"));
+            }
+            *w = hdr.dimension_size(0);
+            *h = hdr.dimension_size(1);
+            data.resize(static_cast<size_t>(*w) * *h);
+            hdr.read_data(f, &data[0]);
+        }
+        catch (...) {
+            fclose(f);
+            throw;
+        }
+#else
+        fclose(f);
+        throw std::runtime_error(
+                std::string("Cannot read ").append(filename).append(": this program was built without libgta"));
+#endif
+    } else {
+        // CSV: one row per line, in the C locale, as written by export_worker()
+        std::vector<char> buf;
+        char chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+            buf.insert(buf.end(), chunk, chunk + n);
+        if (ferror(f)) {
+            fclose(f);
+            throw std::system_error(errno, std::system_category(),
+                    std::string("Cannot read ").append(filename));
+        }
+        buf.push_back('\0');
+        data.clear();
+        *w = 0;
+        *h = 0;
+        int columns = 0;
+        const char* p = &buf[0];
+        for (;;) {
+            while (*p == ' ' || *p == '\t')
+                p++;
+            if (*p == '\0')
+                break;
+            if (*p == '\r' || *p == '\n') {
+                if (columns > 0) {
+                    if (*h > 0 && columns != *w) {
+                        fclose(f);
+                        throw std::runtime_error(
+                                std::string("Cannot read ").append(filename).append(": inconsistent row lengths"));
+                    }
+                    *w = columns;
+                    (*h)++;
+                    columns = 0;
+                }
+                p++;
+                continue;
+            }
+            char* end;
+            float v = std::strtof(p, &end);
+            if (end == p) {
+                fclose(f);
+                throw std::runtime_error(
+                        std::string("Cannot read ").append(filename).append(": invalid value"));
+            }
+            data.push_back(v);
+            columns++;
+            p = end;
+            while (*p == ' ' || *p == '\t')
+                p++;
+            if (*p == ',')
+                p++;
+        }
+        if (columns > 0) {
+            if (*h > 0 && columns != *w) {
+                fclose(f);
+                throw std::runtime_error(
+                        std::string("Cannot read ").append(filename).append(": inconsistent row lengths"));
+            }
+            *w = columns;
+            (*h)++;
+        }
+    }
+    fclose(f);
+}
+
+static void write_image(const std::string& filename, int w, int h, int components, const float* data)
+{
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        throw std::system_error(errno, std::system_category(),
+                std::string("Cannot open ").append(filename));
+    }
+    if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".gta") == 0) {
+#ifdef HAVE_GTA
+        try {
+            gta::header hdr;
+            hdr.set_dimensions(w, h);
+            if (components == 3) {
+                hdr.set_components(gta::float32, gta::float32, gta::float32);
+                hdr.component_taglist(0).set("INTERPRETATION", "X");
+                hdr.component_taglist(1).set("INTERPRETATION", "Y");
+                hdr.component_taglist(2).set("INTERPRETATION", "Z");
+            } else {
+                hdr.set_components(gta::float32);
+            }
+            hdr.set_compression(gta::zlib);
+            hdr.write_to(f);
+            hdr.write_data(f, data);
+        }
+        catch (...) {
+            fclose(f);
+            throw;
+        }
+#else
+        fclose(f);
+        throw std::runtime_error(
+                std::string("Cannot write ").append(filename).append(": this program was built without libgta"));
+#endif
+    } else {
+        for (int i = 0; i < w * h; i++) {
+            if (components == 3)
+                std::fprintf(f, "%.9g,%.9g,%.9g", data[3 * i + 0], data[3 * i + 1], data[3 * i + 2]);
+            else
+                std::fprintf(f, "%.9g", data[i]);
+            std::fputs((i + 1) % w == 0 ? "\r\n" : ",", f);
+        }
+    }
+    if (fflush(f) != 0 || ferror(f)) {
+        fclose(f);
+        throw std::system_error(errno, std::system_category(),
+                std::string("Cannot write ").append(filename));
+    }
+    fclose(f);
+}
+
+/* Correlate the differences D[i] = A[i] - B[i] of the phase images with the
+ * phase offsets as in simresult.fs.glsl, giving I and Q, and compute amplitude
+ * and intensity. The number of phases is a template parameter so that the
+ * loops over the phase images are unrolled. */
+template<int phases>
+static void compute_iq(int n, const float* const A[], const float* const B[],
+        float* I, float* Q, float* amp, float* intensity)
+{
+    const float pi = static_cast<float>(M_PI);
+    const float scale = 4.0f / phases; // to match the four phase case
+    float cos_tau[phases], sin_tau[phases];
+    for (int k = 0; k < phases; k++)
+        Simulator::phase_offset_cos_sin(k, &cos_tau[k], &sin_tau[k]);
+    int i = 0;
+#ifdef __SSE__
+    // Same order of operations as in simresult.fs.glsl; multiplying by 0.5 is
+    // the same as dividing by 2
+    const __m128 vpi = _mm_set1_ps(pi);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_setzero_ps();
+        __m128 y = _mm_setzero_ps();
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < phases; k++) {
+            __m128 D = _mm_sub_ps(_mm_loadu_ps(A[k] + i), _mm_loadu_ps(B[k] + i));
+            x = _mm_add_ps(x, _mm_mul_ps(D, _mm_set1_ps(cos_tau[k])));
+            y = _mm_add_ps(y, _mm_mul_ps(D, _mm_set1_ps(sin_tau[k])));
+            sum = _mm_add_ps(sum, D);
+        }
+        _mm_storeu_ps(I + i, x);
+        _mm_storeu_ps(Q + i, y);
+        __m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+        _mm_storeu_ps(amp + i, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(r, vpi), half), vscale));
+        _mm_storeu_ps(intensity + i, _mm_mul_ps(_mm_mul_ps(sum, half), vscale));
+    }
+#endif
+    for (; i < n; i++) {
+        float x = 0.0f;
+        float y = 0.0f;
+        float sum = 0.0f;
+        for (int k = 0; k < phases; k++) {
+            float D = A[k][i] - B[k][i];
+            x += D * cos_tau[k];
+            y += D * sin_tau[k];
+            sum += D;
+        }
+        I[i] = x;
+        Q[i] = y;
+        amp[i] = std::sqrt(x * x + y * y) * pi / 2.0f * scale;
+        intensity[i] = sum / 2.0f * scale;
+    }
+}
+
+static void compute_depth(int n, const float* I, const float* Q, float frac_c_modfreq,
+        bool positive_phase, float depth_offset, float* depth)
+{
+    const float pi = static_cast<float>(M_PI);
+    for (int i = 0; i < n; i++) {
+        if (std::fabs(I[i]) <= 0.0f && std::fabs(Q[i]) <= 0.0f) {
+            depth[i] = 0.0f;
+        } else {
+            float phase_shift = std::atan2(-Q[i], I[i]);
+            if (positive_phase && phase_shift < 0.0f)
+                phase_shift += 2.0f * pi;
+            depth[i] = frac_c_modfreq * phase_shift / (4.0f * pi) + depth_offset;
+        }
+    }
+}
+
+/* Combine the depths of all modulation frequencies as in unwrap.fs.glsl. The
+ * depths must be in [-R/2,R/2] for the ambiguity range R of their frequency;
+ * amp is the amplitude of the main frequency. */
+static void unwrap_depth(int n, const float* const depth[], const float* amp, const Settings& settings,
+        float* unwrapped)
+{
+    const float* R = settings.ambiguity_range;
+    for (int i = 0; i < n; i++) {
+        float d[Simulator::max_modulation_frequencies];
+        for (int f = 0; f < settings.frequencies; f++)
+            d[f] = (depth[f][i] < 0.0f ? depth[f][i] + R[f] : depth[f][i]);
+        float best_err = 1e38f;
+        float best_depth = 0.0f;
+        for (int k = 0; k < settings.max_wraps; k++) {
+            float D0 = d[0] + k * R[0];
+            float err = 0.0f;
+            float sum = D0;
+            for (int f = 1; f < settings.frequencies; f++) {
+                float Df = d[f] + std::floor((D0 - d[f]) / R[f] + 0.5f) * R[f];
+                err += (Df - D0) * (Df - D0);
+                sum += Df;
+            }
+            if (err < best_err) {
+                best_err = err;
+                best_depth = sum / settings.frequencies;
+            }
+        }
+        // Pixels without signal keep the depth 0
+        unwrapped[i] = (amp[i] <= 0.0f ? 0.0f : best_depth + settings.depth_offset);
+    }
+}
+
+/* The data is in file order, i.e. the top row comes first. */
+static void compute_coords(int w, int h, const float* depth, float aperture_angle, float* coords)
+{
+    float aa = aperture_angle * static_cast<float>(M_PI) / 180.0f;
+    float ar = static_cast<float>(w) / h;
+    float top = std::tan(aa / 2.0f);    // top border of near plane at z==-1
+    float right = ar * top;             // right border of near plane at z==-1
+    for (int r = 0; r < h; r++) {
+        int y = h - 1 - r;
+        for (int x = 0; x < w; x++) {
+            float c[3] = {
+                (2.0f * (x + 0.5f) / w - 1.0f) * right,
+                (2.0f * (y + 0.5f) / h - 1.0f) * top,
+                -1.0f
+            };
+            float cl = std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+            float d = depth[r * w + x];
+            for (int i = 0; i < 3; i++)
+                coords[3 * (r * w + x) + i] = c[i] * d / cl;
+        }
+    }
+}
+
+static void apply_noise(int w, int h, unsigned int frame_number, uint32_t stream, const Settings& settings,
+        float* a, float* b)
+{
+    for (int r = 0; r < h; r++) {
+        // The files store the top row first; the noise is keyed by OpenGL pixel coordinates.
+        uint32_t y = h - 1 - r;
+        for (int x = 0; x < w; x++) {
+            float g[2];
+            noise_gaussians(x, y, frame_number, stream, settings.noise_seed, g);
+            int i = r * w + x;
+            a[i] = noisy_energy(a[i], settings.electrons_per_energy, settings.dark_electrons, settings.read_noise, g[0]);
+            b[i] = noisy_energy(b[i], settings.electrons_per_energy, settings.dark_electrons, settings.read_noise, g[1]);
+        }
+    }
+}
+
+static void process_frame(Frame& frame)
+{
+    try {
+        const Settings& settings = *frame.settings;
+        std::vector<float> a[Simulator::phases], b[Simulator::phases];
+        // Per frequency: depth in [-R/2,R/2], for unwrapping
+        std::vector<float> wrapped_depth[Simulator::max_modulation_frequencies];
+        std::vector<float> main_amp;
+        int w = 0, h = 0;
+        for (int f = 0; f < settings.frequencies; f++) {
+            // Additional modulation frequencies have the suffix -fN, as in the export
+            std::string suffix = (f == 0 ? std::string() : std::string("-f") + static_cast<char>('0' + f));
+            for (int i = 0; i < Simulator::phases; i++) {
+                for (int j = 0; j < 2; j++) {
+                    std::string filename = frame.input_base + (j == 0 ? "sim-phase-a-" : "sim-phase-b-")
+                        + static_cast<char>('0' + i) + suffix + frame.ext;
+                    int fw, fh;
+                    read_image(filename, &fw, &fh, j == 0 ? a[i] : b[i]);
+                    if (f == 0 && i == 0 && j == 0) {
+                        w = fw;
+                        h = fh;
+                    } else if (fw != w || fh != h) {
+                        throw std::runtime_error(filename + ": image size does not match sim-phase-a-0");
+                    }
+                }
+            }
+            int n = w * h;
+            if (n == 0)
+                throw std::runtime_error(frame.input_base + "sim-phase-a-0" + frame.ext + ": empty image");
+            if (settings.add_noise) {
+                for (int i = 0; i < Simulator::phases; i++)
+                    apply_noise(w, h, frame.number, noise_stream(i, f), settings, &a[i][0], &b[i][0]);
+            }
+
+            const float* A[Simulator::phases];
+            const float* B[Simulator::phases];
+            for (int i = 0; i < Simulator::phases; i++) {
+                A[i] = &a[i][0];
+                B[i] = &b[i][0];
+            }
+            std::vector<float> I(n), Q(n), amp(n), intensity(n), depth(n);
+            compute_iq<Simulator::phases>(n, A, B, &I[0], &Q[0], &amp[0], &intensity[0]);
+            compute_depth(n, &I[0], &Q[0], settings.frac_c_modfreq[f],
+                    settings.positive_phase, settings.depth_offset, &depth[0]);
+
+            write_image(frame.output_base + "sim-depth" + suffix + frame.ext, w, h, 1, &depth[0]);
+            write_image(frame.output_base + "sim-amplitude" + suffix + frame.ext, w, h, 1, &amp[0]);
+            write_image(frame.output_base + "sim-intensity" + suffix + frame.ext, w, h, 1, &intensity[0]);
+            if (f == 0 && settings.compute_coords) {
+                std::vector<float> coords(3 * n);
+                compute_coords(w, h, &depth[0], settings.aperture_angle, &coords[0]);
+                write_image(frame.output_base + "sim-coords" + frame.ext, w, h, 3, &coords[0]);
+            }
+            if (settings.frequencies > 1) {
+                wrapped_depth[f].resize(n);
+                compute_depth(n, &I[0], &Q[0], settings.frac_c_modfreq[f], false, 0.0f, &wrapped_depth[f][0]);
+                if (f == 0)
+                    main_amp.swap(amp);
+            }
+        }
+
+        if (settings.frequencies > 1) {
+            int n = w * h;
+            const float* D[Simulator::max_modulation_frequencies];
+            for (int f = 0; f < settings.frequencies; f++)
+                D[f] = &wrapped_depth[f][0];
+            std::vector<float> unwrapped(n);
+            unwrap_depth(n, D, &main_amp[0], settings, &unwrapped[0]);
+            write_image(frame.output_base + "sim-depth-unwrapped" + frame.ext, w, h, 1, &unwrapped[0]);
+            if (settings.compute_coords) {
+                std::vector<float> coords(3 * n);
+                compute_coords(w, h, &unwrapped[0], settings.aperture_angle, &coords[0]);
+                write_image(frame.output_base + "sim-coords-unwrapped" + frame.ext, w, h, 3, &coords[0]);
+            }
+        }
+    }
+    catch (std::exception& e) {
+        frame.error = e.what();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    // Force the C locale so that we read and write the decimal point '.'
+    setlocale(LC_NUMERIC, "C");
+
+    QStringList cmdline = app.arguments();
+    QString simulator_file;
+    int modulation_frequency = -1;
+    QString output_dir;
+    float depth_offset = 0.0f;
+    bool positive_phase = false;
+    bool no_coords = false;
+    bool add_noise = false;
+    QStringList inputs;
+    for (int i = 1; i < cmdline.size(); i++) {
+        bool conv_ok = true;
+        if (cmdline.at(i).startsWith("--simulator=")) {
+            simulator_file = cmdline.at(i).section('=', 1);
+        } else if (cmdline.at(i).startsWith("--modulation-frequency=")
+                && (modulation_frequency = cmdline.at(i).section('=', 1).toInt(&conv_ok)) > 0
+                && conv_ok) {
+        } else if (cmdline.at(i).startsWith("--output-dir=")) {
+            output_dir = cmdline.at(i).section('=', 1);
+        } else if (cmdline.at(i).startsWith("--depth-offset=")
+                && std::isfinite((depth_offset = cmdline.at(i).section('=', 1).toFloat(&conv_ok)))
+                && conv_ok) {
+        } else if (cmdline.at(i).compare("--positive-phase") == 0) {
+            positive_phase = true;
+        } else if (cmdline.at(i).compare("--no-coords") == 0) {
+            no_coords = true;
+        } else if (cmdline.at(i).compare("--add-noise") == 0) {
+            add_noise = true;
+        } else if (cmdline.at(i).compare("--help") == 0) {
+            qDebug("Usage: %s [OPTION...] [DIR|FRAME-PREFIX...]\n"
+                    "Recompute sim-depth, sim-amplitude, sim-intensity and sim-coords from\n"
+                    "the exported sim-phase-a-* and sim-phase-b-* files of all frames found\n"
+                    "in the given directories (default: current directory).\n"
+                    "If the simulator uses additional modulation frequencies, their files with\n"
+                    "the suffix -fN are read as well, and sim-depth-unwrapped and\n"
+                    "sim-coords-unwrapped are written.\n"
+                    "Options:\n"
+                    "  --simulator=FILE.TXT        Simulator specification used for the export\n"
+                    "  --modulation-frequency=HZ   Override the modulation frequency\n"
+                    "  --output-dir=DIR            Write results here instead of next to the input\n"
+                    "  --depth-offset=METERS       Add a calibration offset to all valid depths\n"
+                    "  --positive-phase            Map phase shifts to [0,2pi) instead of [-pi,pi]\n"
+                    "  --no-coords                 Do not write sim-coords\n"
+                    "  --add-noise                 Add shot, dark and read noise to noise-free\n"
+                    "                              phase images, using the noise parameters of\n"
+                    "                              the simulator and the frame number prefix\n"
+                    "                              (frame 0 for files without prefix)",
+                    qPrintable(cmdline.at(0)));
+            return 0;
+        } else if (!cmdline.at(i).startsWith("--")) {
+            inputs.append(cmdline.at(i));
+        } else {
+            qWarning() << "Invalid argument" << cmdline.at(i);
+            return 1;
+        }
+    }
+    if (inputs.empty())
+        inputs.append(".");
+
+    Simulator sim;
+    if (!simulator_file.isEmpty()) {
+        try {
+            sim.load(qPrintable(simulator_file));
+        }
+        catch (std::exception& e) {
+            qCritical("%s", e.what());
+            return 1;
+        }
+    }
+    if (modulation_frequency > 0)
+        sim.modulation_frequency = modulation_frequency;
+
+    Settings settings;
+    settings.frequencies = sim.modulation_frequencies();
+    for (int f = 0; f < settings.frequencies; f++) {
+        settings.frac_c_modfreq[f] = static_cast<double>(Simulator::c) / sim.get_modulation_frequency(f);
+        settings.ambiguity_range[f] = sim.ambiguity_range(f);
+    }
+    // Same search range as in SimWidget::unwrap_result()
+    float max_depth = std::min(sim.extended_ambiguity_range(), sim.far_plane);
+    settings.max_wraps = std::max(1, static_cast<int>(std::ceil(max_depth / settings.ambiguity_range[0])));
+    settings.aperture_angle = sim.aperture_angle;
+    settings.depth_offset = depth_offset;
+    settings.positive_phase = positive_phase;
+    settings.compute_coords = !no_coords;
+    settings.add_noise = add_noise;
+    settings.noise_seed = sim.noise_seed;
+    settings.electrons_per_energy = sim.electrons_per_zeptojoule();
+    settings.dark_electrons = sim.dark_electrons();
+    settings.read_noise = sim.read_noise;
+
+    // Find all frames: either a directory containing [NNNNN-]sim-phase-a-0.{gta,csv}
+    // files, or a frame prefix such as dir/00042-
+    std::vector<Frame> frames;
+    QStringList name_filters;
+    name_filters << "*sim-phase-a-0.gta" << "*sim-phase-a-0.csv";
+    for (int i = 0; i < inputs.size(); i++) {
+        QFileInfo fi(inputs[i]);
+        QStringList files;
+        if (fi.isDir()) {
+            QDir dir(inputs[i]);
+            QStringList names = dir.entryList(name_filters, QDir::Files, QDir::Name);
+            for (int j = 0; j < names.size(); j++)
+                files.append(dir.filePath(names[j]));
+        } else if (QFileInfo(inputs[i] + "sim-phase-a-0.gta").exists()) {
+            files.append(inputs[i] + "sim-phase-a-0.gta");
+        } else if (QFileInfo(inputs[i] + "sim-phase-a-0.csv").exists()) {
+            files.append(inputs[i] + "sim-phase-a-0.csv");
+        } else {
+            qCritical("%s: no exported phase images found", qPrintable(inputs[i]));
+            return 1;
+        }
+        for (int j = 0; j < files.size(); j++) {
+            Frame frame;
+            std::string file = files[j].toLocal8Bit().constData();
+            frame.ext = file.substr(file.size() - 4);
+            frame.input_base = file.substr(0, file.size() - std::string("sim-phase-a-0").size() - 4);
+            frame.number = std::strtoul(QFileInfo(files[j]).fileName().toLocal8Bit().constData(), NULL, 10);
+            if (output_dir.isEmpty()) {
+                frame.output_base = frame.input_base;
+            } else {
+                QFileInfo base_fi(files[j]);
+                std::string name = base_fi.fileName().toLocal8Bit().constData();
+                frame.output_base = std::string(output_dir.toLocal8Bit().constData()) + "/"
+                    + name.substr(0, name.size() - std::string("sim-phase-a-0").size() - 4);
+            }
+            frame.settings = &settings;
+            frames.push_back(frame);
+        }
+    }
+    if (!output_dir.isEmpty() && !QDir().mkpath(output_dir)) {
+        qCritical("Cannot create %s", qPrintable(output_dir));
+        return 1;
+    }
+
+    QtConcurrent::blockingMap(frames, process_frame);
+
+    int ret = 0;
+    for (size_t i = 0; i < frames.size(); i++) {
+        if (!frames[i].error.empty()) {
+            qCritical("%s", frames[i].error.c_str());
+            ret = 1;
+        }
+    }
+    return ret;
+}
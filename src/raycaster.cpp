@@ -0,0 +1,435 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#ifdef __SSE__
+# include <xmmintrin.h>
+#endif
+
+#include <QThread>
+#include <QtConcurrentRun>
+#include <QFuture>
+
+#include "raycaster.h"
+
+
+/* A minimal 4-wide float vector. Comparisons return masks that can only be
+ * combined with & and |, and used with select() and movemask(). */
+
+#ifdef __SSE__
+
+class float4
+{
+public:
+    __m128 v;
+    float4() {}
+    float4(__m128 x) : v(x) {}
+    float4(float x) : v(_mm_set1_ps(x)) {}
+    float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+    void store(float f[4]) const { _mm_storeu_ps(f, v); }
+};
+
+static inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+static inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+static inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+static inline float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+static inline float4 vmin(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+static inline float4 vmax(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+static inline float4 operator<(float4 a, float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+static inline float4 operator<=(float4 a, float4 b) { return _mm_cmple_ps(a.v, b.v); }
+static inline float4 operator>(float4 a, float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+static inline float4 operator>=(float4 a, float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+static inline float4 operator&(float4 a, float4 b) { return _mm_and_ps(a.v, b.v); }
+static inline float4 operator|(float4 a, float4 b) { return _mm_or_ps(a.v, b.v); }
+static inline float4 select(float4 mask, float4 a, float4 b)
+{ return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+static inline int movemask(float4 mask) { return _mm_movemask_ps(mask.v); }
+
+#else
+
+class float4
+{
+public:
+    float v[4];
+    float4() {}
+    float4(float x) { v[0] = v[1] = v[2] = v[3] = x; }
+    float4(float a, float b, float c, float d) { v[0] = a; v[1] = b; v[2] = c; v[3] = d; }
+    void store(float f[4]) const { for (int i = 0; i < 4; i++) f[i] = v[i]; }
+};
+
+#define FLOAT4_OP(expr) float4 r; for (int i = 0; i < 4; i++) r.v[i] = (expr); return r
+static inline float4 operator+(float4 a, float4 b) { FLOAT4_OP(a.v[i] + b.v[i]); }
+static inline float4 operator-(float4 a, float4 b) { FLOAT4_OP(a.v[i] - b.v[i]); }
+static inline float4 operator*(float4 a, float4 b) { FLOAT4_OP(a.v[i] * b.v[i]); }
+static inline float4 operator/(float4 a, float4 b) { FLOAT4_OP(a.v[i] / b.v[i]); }
+static inline float4 vmin(float4 a, float4 b) { FLOAT4_OP(std::min(a.v[i], b.v[i])); }
+static inline float4 vmax(float4 a, float4 b) { FLOAT4_OP(std::max(a.v[i], b.v[i])); }
+static inline float4 operator<(float4 a, float4 b) { FLOAT4_OP(a.v[i] < b.v[i] ? 1.0f : 0.0f); }
+static inline float4 operator<=(float4 a, float4 b) { FLOAT4_OP(a.v[i] <= b.v[i] ? 1.0f : 0.0f); }
+static inline float4 operator>(float4 a, float4 b) { FLOAT4_OP(a.v[i] > b.v[i] ? 1.0f : 0.0f); }
+static inline float4 operator>=(float4 a, float4 b) { FLOAT4_OP(a.v[i] >= b.v[i] ? 1.0f : 0.0f); }
+static inline float4 operator&(float4 a, float4 b) { FLOAT4_OP(a.v[i] != 0.0f && b.v[i] != 0.0f ? 1.0f : 0.0f); }
+static inline float4 operator|(float4 a, float4 b) { FLOAT4_OP(a.v[i] != 0.0f || b.v[i] != 0.0f ? 1.0f : 0.0f); }
+static inline float4 select(float4 mask, float4 a, float4 b) { FLOAT4_OP(mask.v[i] != 0.0f ? a.v[i] : b.v[i]); }
+#undef FLOAT4_OP
+static inline int movemask(float4 mask)
+{
+    int m = 0;
+    for (int i = 0; i < 4; i++)
+        if (mask.v[i] != 0.0f)
+            m |= (1 << i);
+    return m;
+}
+
+#endif
+
+
+static const int max_leaf_size = 4;
+static const int max_tree_depth = 64;
+
+RayCaster::RayCaster() : _scene_id(-1)
+{
+}
+
+void RayCaster::transform()
+{
+    for (size_t p = 0; p < _arena.patches(); p++) {
+        const float* m = &(_arena.transformations[16 * p]);
+        // Rows of the upper 3x3 matrix, and their cofactors for the normal matrix
+        float a[3][3] = {
+            { m[0], m[4], m[8] },
+            { m[1], m[5], m[9] },
+            { m[2], m[6], m[10] } };
+        float c[3][3];
+        for (int r = 0; r < 3; r++) {
+            const float* a1 = a[(r + 1) % 3];
+            const float* a2 = a[(r + 2) % 3];
+            c[r][0] = a1[1] * a2[2] - a1[2] * a2[1];
+            c[r][1] = a1[2] * a2[0] - a1[0] * a2[2];
+            c[r][2] = a1[0] * a2[1] - a1[1] * a2[0];
+        }
+        float det = a[0][0] * c[0][0] + a[0][1] * c[0][1] + a[0][2] * c[0][2];
+        float s = (det < 0.0f ? -1.0f : 1.0f);
+        // Stream over the vertices of this patch in the arena
+        for (size_t i = _arena.vertex_offset[p]; i < _arena.vertex_offset[p + 1]; i++) {
+            float x = _arena.vertices[3 * i + 0];
+            float y = _arena.vertices[3 * i + 1];
+            float z = _arena.vertices[3 * i + 2];
+            _vertices[3 * i + 0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+            _vertices[3 * i + 1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+            _vertices[3 * i + 2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+            float nx = _arena.normals[3 * i + 0];
+            float ny = _arena.normals[3 * i + 1];
+            float nz = _arena.normals[3 * i + 2];
+            for (int r = 0; r < 3; r++)
+                _normals[3 * i + r] = s * (c[r][0] * nx + c[r][1] * ny + c[r][2] * nz);
+        }
+    }
+}
+
+void RayCaster::get_triangle_bounds(int t, float bb_min[3], float bb_max[3]) const
+{
+    for (int j = 0; j < 3; j++) {
+        const float* v = &(_vertices[3 * _triangles[3 * t + j]]);
+        for (int i = 0; i < 3; i++) {
+            if (j == 0 || v[i] < bb_min[i])
+                bb_min[i] = v[i];
+            if (j == 0 || v[i] > bb_max[i])
+                bb_max[i] = v[i];
+        }
+    }
+}
+
+class CentroidLess
+{
+private:
+    const std::vector<float>& _centroids;
+    int _axis;
+public:
+    CentroidLess(const std::vector<float>& centroids, int axis) : _centroids(centroids), _axis(axis) {}
+    bool operator()(int a, int b) const { return _centroids[3 * a + _axis] < _centroids[3 * b + _axis]; }
+};
+
+int RayCaster::build(std::vector<int>& order, std::vector<float>& centroids, int first, int count)
+{
+    int n = _nodes.size();
+    _nodes.push_back(Node());
+    if (count <= max_leaf_size) {
+        _nodes[n].first = first;
+        _nodes[n].count = count;
+        _nodes[n].axis = 0;
+        return n;
+    }
+    // Split at the median along the axis with the largest centroid extent
+    float cmin[3], cmax[3];
+    for (int i = 0; i < count; i++) {
+        const float* c = &(centroids[3 * order[first + i]]);
+        for (int j = 0; j < 3; j++) {
+            if (i == 0 || c[j] < cmin[j])
+                cmin[j] = c[j];
+            if (i == 0 || c[j] > cmax[j])
+                cmax[j] = c[j];
+        }
+    }
+    int axis = 0;
+    for (int j = 1; j < 3; j++)
+        if (cmax[j] - cmin[j] > cmax[axis] - cmin[axis])
+            axis = j;
+    int mid = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + mid, order.begin() + first + count,
+            CentroidLess(centroids, axis));
+    build(order, centroids, first, mid);
+    int second = build(order, centroids, first + mid, count - mid);
+    _nodes[n].first = second;
+    _nodes[n].count = 0;
+    _nodes[n].axis = axis;
+    return n;
+}
+
+void RayCaster::refit()
+{
+    // Children always have larger indices than their parents
+    for (int n = static_cast<int>(_nodes.size()) - 1; n >= 0; n--) {
+        Node& node = _nodes[n];
+        if (node.count > 0) {
+            for (int t = 0; t < node.count; t++) {
+                float bb_min[3], bb_max[3];
+                get_triangle_bounds(node.first + t, bb_min, bb_max);
+                for (int i = 0; i < 3; i++) {
+                    node.bb_min[i] = (t == 0 ? bb_min[i] : std::min(node.bb_min[i], bb_min[i]));
+                    node.bb_max[i] = (t == 0 ? bb_max[i] : std::max(node.bb_max[i], bb_max[i]));
+                }
+            }
+        } else {
+            const Node& c0 = _nodes[n + 1];
+            const Node& c1 = _nodes[node.first];
+            for (int i = 0; i < 3; i++) {
+                node.bb_min[i] = std::min(c0.bb_min[i], c1.bb_min[i]);
+                node.bb_max[i] = std::max(c0.bb_max[i], c1.bb_max[i]);
+            }
+        }
+    }
+}
+
+void RayCaster::update(int scene_id, const std::vector<TrianglePatch>& scene)
+{
+    bool rebuild = (scene_id != _scene_id || _arena.patches() != scene.size());
+    if (rebuild) {
+        _arena.build(scene);
+        _vertices.resize(_arena.vertices.size());
+        _normals.resize(_arena.normals.size());
+        _triangles = _arena.indices;
+    } else {
+        _arena.update_transformations(scene);
+    }
+    transform();
+    if (rebuild) {
+        int triangle_count = _triangles.size() / 3;
+        std::vector<float> centroids(3 * triangle_count);
+        std::vector<int> order(triangle_count);
+        for (int t = 0; t < triangle_count; t++) {
+            float bb_min[3], bb_max[3];
+            get_triangle_bounds(t, bb_min, bb_max);
+            for (int i = 0; i < 3; i++)
+                centroids[3 * t + i] = 0.5f * (bb_min[i] + bb_max[i]);
+            order[t] = t;
+        }
+        _nodes.clear();
+        if (triangle_count > 0)
+            build(order, centroids, 0, triangle_count);
+        std::vector<unsigned int> triangles(_triangles.size());
+        for (int t = 0; t < triangle_count; t++)
+            for (int j = 0; j < 3; j++)
+                triangles[3 * t + j] = _triangles[3 * order[t] + j];
+        _triangles.swap(triangles);
+        _scene_id = scene_id;
+    }
+    refit();
+}
+
+void RayCaster::trace_rows(const TraceParams* params, int y0, int y1) const
+{
+    const Simulator& sim = *(params->sim);
+    const int w = sim.map_width();
+    const int h = sim.map_height();
+    const float ty = std::tan(static_cast<float>(M_PI) / 180.0f * sim.aperture_angle / 2.0f);
+    const float tx = ty * sim.map_aspect_ratio();
+    const float near_plane = sim.near_plane;
+    const float far_plane = sim.far_plane;
+    const float pi = static_cast<float>(M_PI);
+    const float subpixel_area = sim.pixel_pitch * sim.pixel_pitch / (sim.pixel_width * sim.pixel_height);
+    const float exposure_time = static_cast<float>(sim.exposure_time) / sim.exposure_time_samples;
+    const float tiny = std::numeric_limits<float>::min();
+
+    for (int y = y0; y < y1; y += 2) {
+        for (int x = 0; x < w; x += 2) {
+            // Set up a packet of 2x2 rays from the origin through the subpixel centers.
+            // The ray parameter t is the distance along -z, as for the clip planes.
+            float dx[4], dy[4];
+            for (int k = 0; k < 4; k++) {
+                dx[k] = (2.0f * (x + (k & 1) + 0.5f) / w - 1.0f) * tx;
+                dy[k] = (2.0f * (y + (k >> 1) + 0.5f) / h - 1.0f) * ty;
+                if (std::fabs(dx[k]) < tiny)
+                    dx[k] = tiny;
+                if (std::fabs(dy[k]) < tiny)
+                    dy[k] = tiny;
+            }
+            float4 d_x(dx[0], dx[1], dx[2], dx[3]);
+            float4 d_y(dy[0], dy[1], dy[2], dy[3]);
+            float4 d_z(-1.0f);
+            float4 inv_x = float4(1.0f) / d_x;
+            float4 inv_y = float4(1.0f) / d_y;
+            float4 inv_z(-1.0f);
+            float4 t_best(far_plane);
+            float4 u_best(0.0f), v_best(0.0f);
+            int tri[4] = { -1, -1, -1, -1 };
+
+            // Traverse the BVH
+            int stack[max_tree_depth];
+            int sp = 0;
+            if (!_nodes.empty())
+                stack[sp++] = 0;
+            while (sp > 0) {
+                const Node& node = _nodes[stack[--sp]];
+                float4 t1x = float4(node.bb_min[0]) * inv_x;
+                float4 t2x = float4(node.bb_max[0]) * inv_x;
+                float4 t1y = float4(node.bb_min[1]) * inv_y;
+                float4 t2y = float4(node.bb_max[1]) * inv_y;
+                float4 t1z = float4(node.bb_min[2]) * inv_z;
+                float4 t2z = float4(node.bb_max[2]) * inv_z;
+                float4 tmin = vmax(vmax(vmin(t1x, t2x), vmin(t1y, t2y)), vmax(vmin(t1z, t2z), float4(near_plane)));
+                float4 tmax = vmin(vmin(vmax(t1x, t2x), vmax(t1y, t2y)), vmin(vmax(t1z, t2z), t_best));
+                if (movemask(tmin <= tmax) == 0)
+                    continue;
+                if (node.count == 0) {
+                    // Visit the nearer child first
+                    int n = &node - &(_nodes[0]);
+                    float dir = (node.axis == 0 ? dx[0] : node.axis == 1 ? dy[0] : -1.0f);
+                    if (dir < 0.0f) {
+                        stack[sp++] = n + 1;
+                        stack[sp++] = node.first;
+                    } else {
+                        stack[sp++] = node.first;
+                        stack[sp++] = n + 1;
+                    }
+                    continue;
+                }
+                for (int t = node.first; t < node.first + node.count; t++) {
+                    // Möller-Trumbore with the ray origin in (0,0,0). Back faces are
+                    // culled, as with GL_CULL_FACE in the rasterizer.
+                    const float* v0 = &(_vertices[3 * _triangles[3 * t + 0]]);
+                    const float* v1 = &(_vertices[3 * _triangles[3 * t + 1]]);
+                    const float* v2 = &(_vertices[3 * _triangles[3 * t + 2]]);
+                    float e1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+                    float e2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+                    float o[3] = { -v0[0], -v0[1], -v0[2] };
+                    float q[3] = { o[1] * e1[2] - o[2] * e1[1], o[2] * e1[0] - o[0] * e1[2], o[0] * e1[1] - o[1] * e1[0] };
+                    float4 p_x = d_y * float4(e2[2]) - d_z * float4(e2[1]);
+                    float4 p_y = d_z * float4(e2[0]) - d_x * float4(e2[2]);
+                    float4 p_z = d_x * float4(e2[1]) - d_y * float4(e2[0]);
+                    float4 det = float4(e1[0]) * p_x + float4(e1[1]) * p_y + float4(e1[2]) * p_z;
+                    float4 inv_det = float4(1.0f) / det;
+                    float4 u = (float4(o[0]) * p_x + float4(o[1]) * p_y + float4(o[2]) * p_z) * inv_det;
+                    float4 v = (d_x * float4(q[0]) + d_y * float4(q[1]) + d_z * float4(q[2])) * inv_det;
+                    float4 tt = float4(e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+                    float4 hit = (det > float4(0.0f)) & (u >= float4(0.0f)) & (v >= float4(0.0f))
+                        & (u + v <= float4(1.0f)) & (tt >= float4(near_plane)) & (tt < t_best);
+                    int m = movemask(hit);
+                    if (m) {
+                        t_best = select(hit, tt, t_best);
+                        u_best = select(hit, u, u_best);
+                        v_best = select(hit, v, v_best);
+                        for (int k = 0; k < 4; k++)
+                            if (m & (1 << k))
+                                tri[k] = t;
+                    }
+                }
+            }
+
+            // Shade, as in render-simple.fs.glsl
+            float t_k[4], u_k[4], v_k[4];
+            t_best.store(t_k);
+            u_best.store(u_k);
+            v_best.store(v_k);
+            for (int k = 0; k < 4; k++) {
+                int px = x + (k & 1);
+                int py = y + (k >> 1);
+                if (px >= w || py >= h)
+                    continue;
+                if (tri[k] < 0) {
+                    for (int f = 0; f < params->frequencies; f++) {
+                        float* result = params->maps[f] + 4 * (py * w + px);
+                        result[0] = result[1] = result[2] = result[3] = 0.0f;
+                    }
+                    continue;
+                }
+                float p[3] = { t_k[k] * dx[k], t_k[k] * dy[k], -t_k[k] };
+                float n[3];
+                const float* n0 = &(_normals[3 * _triangles[3 * tri[k] + 0]]);
+                const float* n1 = &(_normals[3 * _triangles[3 * tri[k] + 1]]);
+                const float* n2 = &(_normals[3 * _triangles[3 * tri[k] + 2]]);
+                for (int i = 0; i < 3; i++)
+                    n[i] = (1.0f - u_k[k] - v_k[k]) * n0[i] + u_k[k] * n1[i] + v_k[k] * n2[i];
+                float depth = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+                float n_len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                float cos_theta_surface = (n_len > 0.0f
+                        ? -(p[0] * n[0] + p[1] * n[1] + p[2] * n[2]) / (depth * n_len) : 0.0f);
+                cos_theta_surface = std::min(std::max(cos_theta_surface, 0.0f), 1.0f);
+                float factor = params->subpixel_factor[py * w + px];
+                float irradiance_surface = cos_theta_surface / (depth * depth);
+                float radiosity_surface = sim.material_lambertian_reflectivity * irradiance_surface;
+                float radiance_to_sensor = radiosity_surface / pi;
+                float irradiance_sensor = factor * radiance_to_sensor;
+                float power_sensor = irradiance_sensor * subpixel_area;
+                float energy = power_sensor * exposure_time;
+                for (int f = 0; f < params->frequencies; f++) {
+                    float phase_shift = 2.0f * pi * (2.0f * depth) * params->frac_modfreq_c[f];
+                    float correlation = std::cos(params->tau + phase_shift);
+                    float* result = params->maps[f] + 4 * (py * w + px);
+                    result[0] = energy / 2.0f * (1.0f + sim.contrast * correlation);
+                    result[1] = energy / 2.0f * (1.0f - sim.contrast * correlation);
+                    result[2] = depth;
+                    result[3] = energy;
+                }
+            }
+        }
+    }
+}
+
+void RayCaster::render(const Simulator& sim, int phase_index,
+        const std::vector<float>& subpixel_factor, std::vector<float> maps[]) const
+{
+    int w = sim.map_width();
+    int h = sim.map_height();
+    assert(subpixel_factor.size() == static_cast<size_t>(w * h));
+
+    TraceParams params;
+    params.sim = &sim;
+    params.tau = Simulator::phase_offset(phase_index);
+    params.subpixel_factor = &(subpixel_factor[0]);
+    params.frequencies = sim.modulation_frequencies();
+    for (int f = 0; f < params.frequencies; f++) {
+        params.frac_modfreq_c[f] = static_cast<double>(sim.get_modulation_frequency(f)) / Simulator::c;
+        maps[f].resize(4 * w * h);
+        params.maps[f] = &(maps[f][0]);
+    }
+
+    // Distribute bands of rows (with an even number of rows, for the 2x2 packets)
+    // across all cores. Use more bands than cores to balance the load.
+    int bands = 4 * std::max(1, QThread::idealThreadCount());
+    int band_rows = 2 * ((h / 2 + 1 + bands - 1) / bands);
+    std::vector<QFuture<void> > futures;
+    for (int y = 0; y < h; y += band_rows)
+        futures.push_back(QtConcurrent::run(this, &RayCaster::trace_rows, &params, y, std::min(y + band_rows, h)));
+    for (size_t i = 0; i < futures.size(); i++)
+        futures[i].waitForFinished();
+}
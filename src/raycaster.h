@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef RAYCASTER_H
+#define RAYCASTER_H
+
+#include <vector>
+
+#include "simulator.h"
+#include "trianglepatch.h"
+#include "scenearena.h"
+
+
+/* A CPU ray caster that computes the oversampled energy map, as an alternative
+ * to GPU rasterization (Simulator::rendering_method 1).
+ *
+ * The scene is flattened into a SceneArena, and a bounding volume hierarchy
+ * (BVH) over all scene triangles is built when the scene changes. When only
+ * the patch transformations change, the existing hierarchy is refitted. Rays
+ * through 2x2 subpixels are traced as one packet (using SSE if available),
+ * and bands of rows are distributed across all cores.
+ *
+ * The result is identical in meaning to the output of render-simple.fs.glsl:
+ * for each subpixel, (energy_a, energy_b, depth, energy). */
+
+class RayCaster
+{
+private:
+    class Node
+    {
+    public:
+        float bb_min[3], bb_max[3];
+        int first;      // leaf: first triangle; inner node: index of second child (the first child follows this node)
+        int count;      // leaf: number of triangles; inner node: 0
+        int axis;       // inner node: split axis
+    };
+
+    class TraceParams
+    {
+    public:
+        const Simulator* sim;
+        float tau;
+        const float* subpixel_factor;
+        int frequencies;
+        float frac_modfreq_c[Simulator::max_modulation_frequencies];
+        float* maps[Simulator::max_modulation_frequencies];
+    };
+
+    int _scene_id;
+    SceneArena _arena;                                  // the scene geometry in object space
+    std::vector<float> _vertices;                       // eye space positions, same layout as the arena
+    std::vector<float> _normals;                        // eye space normals, not normalized
+    std::vector<unsigned int> _triangles;               // 3 vertex indices per triangle, in BVH leaf order
+    std::vector<Node> _nodes;
+
+    void transform();
+    void get_triangle_bounds(int t, float bb_min[3], float bb_max[3]) const;
+    int build(std::vector<int>& order, std::vector<float>& centroids, int first, int count);
+    void refit();
+    void trace_rows(const TraceParams* params, int y0, int y1) const;
+
+public:
+    RayCaster();
+
+    /* Prepare for rendering the given scene with its current transformations.
+     * The BVH is rebuilt if the scene changed and refitted otherwise. */
+    void update(int scene_id, const std::vector<TrianglePatch>& scene);
+
+    /* Render the oversampled maps (4 floats per subpixel, map_width() x map_height(),
+     * bottom row first), one for each modulation frequency. The rays are traced
+     * only once for all frequencies. The subpixel factor map contains the light
+     * source intensity, lens constant and cos^4 falloff per subpixel, as computed
+     * by subpixelfactor.fs.glsl. */
+    void render(const Simulator& sim, int phase_index,
+            const std::vector<float>& subpixel_factor, std::vector<float> maps[]) const;
+};
+
+#endif
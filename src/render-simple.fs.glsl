@@ -8,15 +8,11 @@
 
 #version 120
 
-uniform float lightsource_intensity;    // light source intensity in milliwatt/steradian
-uniform sampler2D lightsource_intensity_table;
-uniform float lightsource_intensity_table_start_x;
-uniform float lightsource_intensity_table_end_x;
-uniform float lightsource_intensity_table_start_y;
-uniform float lightsource_intensity_table_end_y;
+uniform sampler2D subpixel_factor_tex;  // light source intensity * lens constant * cos^4 per subpixel
+uniform vec2 subpixel_size;             // 1 / map size
 uniform float lambertian_reflectivity;  // material reflection coefficient in [0,1]
-uniform float frac_apdiam_foclen;       // lens: aperture diameter / focal length
-uniform float frac_modfreq_c;           // modulation_frequency / speed of light
+uniform int frequencies;                // number of modulation frequencies, in [1,3]
+uniform float frac_modfreq_c[3];        // modulation_frequency / speed of light, per frequency
 uniform float exposure_time;            // exposure time in microseconds
 uniform float pixel_area;               // area of a sensor pixel in micrometer²
 uniform int pixel_width;                // width of a sensor pixel, counted in subpixels
@@ -31,41 +27,33 @@ varying vec3 vp;    // Position in eye space
 varying vec3 vn;    // Normal in eye space, not normalized
 
 
+// Compute energy_a and energy_b for one modulation frequency
+vec2 energies(float depth, float energy, float frac_modfreq_c_i)
+{
+    float phase_shift = 2.0 * pi * (2.0 * depth) * frac_modfreq_c_i;
+    float correlation = cos(tau + phase_shift);
+    float energy_a = energy / 2.0 * (1.0 + contrast * correlation);
+    float energy_b = energy / 2.0 * (1.0 - contrast * correlation);
+    return vec2(energy_a, energy_b);
+}
+
 void main(void)
 {
     vec3 n = normalize(vn);
     vec3 l = normalize(-vp);
-    vec3 p = normalize(vp);
     float depth = length(vp);
     float cos_theta_surface = clamp(dot(l, n), 0.0, 1.0);
-    float cos_theta_sensor = clamp(dot(p, vec3(0.0, 0.0, -1.0)), 0.0, 1.0);
 
-    float li = lightsource_intensity;
-    if (li < 0.0f) { // this means we have to read a measured value
-        vec3 p_xz = normalize(vec3(p.x, 0.0, p.z));
-        float theta_sensor_x = acos(clamp(dot(p_xz, vec3(0.0, 0.0, -1.0)), 0.0, 1.0));
-        if (p.x < 0.0)
-            theta_sensor_x = -theta_sensor_x;
-        float theta_sensor_y = acos(clamp(dot(p, p_xz), 0.0, 1.0));
-        if (p.y < 0.0)
-            theta_sensor_y = -theta_sensor_y;
-        float table_ind_x = (theta_sensor_x - lightsource_intensity_table_start_x) /
-            (lightsource_intensity_table_end_x - lightsource_intensity_table_start_x);
-        float table_ind_y = (theta_sensor_y - lightsource_intensity_table_start_y) /
-            (lightsource_intensity_table_end_y - lightsource_intensity_table_start_y);
-        // swap directions, necessary for plausible orientation of the table
-        table_ind_x = 1.0 - table_ind_x;
-        table_ind_y = 1.0 - table_ind_y;
-        li = texture2D(lightsource_intensity_table, vec2(table_ind_x, table_ind_y)).r;
-    }
-    // li: [mW/sr]
+    // Light source intensity [mW/sr], lens constant, and cos^4 falloff;
+    // these only depend on the viewing ray and are precomputed per subpixel.
+    float factor = texture2D(subpixel_factor_tex, gl_FragCoord.xy * subpixel_size).r;
 
-    float irradiance_surface = li * cos_theta_surface / (depth * depth); // [mW/m²]
-    float radiosity_surface = lambertian_reflectivity * irradiance_surface; // [mW/m²]
-    float radiance_to_sensor = radiosity_surface / pi; // [mW/sr/m²]
-    float irradiance_sensor = (pi / 4.0) * (frac_apdiam_foclen * frac_apdiam_foclen)
-        * (cos_theta_sensor * cos_theta_sensor * cos_theta_sensor * cos_theta_sensor)
-        * radiance_to_sensor; // [mW/m²]
+    // The light source intensity is part of the factor, so the following
+    // surface terms are relative to 1 mW/sr.
+    float irradiance_surface = cos_theta_surface / (depth * depth); // [1/m²]
+    float radiosity_surface = lambertian_reflectivity * irradiance_surface; // [1/m²]
+    float radiance_to_sensor = radiosity_surface / pi; // [1/sr/m²]
+    float irradiance_sensor = factor * radiance_to_sensor; // [mW/m²]
 
     float power_sensor = irradiance_sensor * (pixel_area / float(pixel_width * pixel_height));
         // [(mW/m²) * (1e-6m)²] = [1e-3 * 1e-6 * 1e-6 W] = [1e-15 W] = [Femtowatt]
@@ -75,9 +63,11 @@ void main(void)
 
     // You can compute e.g. the total accumulated charge from this if you want.
 
-    float phase_shift = 2.0 * pi * (2.0 * depth) * frac_modfreq_c;
-    float energy_a = energy / 2.0 * (1.0 + contrast * cos(tau + phase_shift));
-    float energy_b = energy / 2.0 * (1.0 - contrast * cos(tau + phase_shift));
-
-    gl_FragColor = vec4(energy_a, energy_b, depth, energy);
+    // The geometry is shared by all modulation frequencies; each frequency
+    // has its own render target.
+    gl_FragData[0] = vec4(energies(depth, energy, frac_modfreq_c[0]), depth, energy);
+    if (frequencies > 1)
+        gl_FragData[1] = vec4(energies(depth, energy, frac_modfreq_c[1]), depth, energy);
+    if (frequencies > 2)
+        gl_FragData[2] = vec4(energies(depth, energy, frac_modfreq_c[2]), depth, energy);
 }
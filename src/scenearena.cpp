@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#include <cassert>
+#include <algorithm>
+
+#include "scenearena.h"
+
+
+SceneArena::SceneArena()
+{
+    vertex_offset.push_back(0);
+    index_offset.push_back(0);
+}
+
+void SceneArena::build(const std::vector<TrianglePatch>& scene)
+{
+    // Compute the offsets first so that each arena is allocated only once
+    vertex_offset.resize(scene.size() + 1);
+    index_offset.resize(scene.size() + 1);
+    vertex_offset[0] = 0;
+    index_offset[0] = 0;
+    for (size_t p = 0; p < scene.size(); p++) {
+        vertex_offset[p + 1] = vertex_offset[p] + scene[p].vertex_array.size() / 3;
+        index_offset[p + 1] = index_offset[p] + scene[p].index_array.size() / 3 * 3;
+    }
+    vertices.resize(3 * vertex_offset[scene.size()]);
+    normals.resize(3 * vertex_offset[scene.size()]);
+    indices.resize(index_offset[scene.size()]);
+
+    for (size_t p = 0; p < scene.size(); p++) {
+        const TrianglePatch& tp = scene[p];
+        assert(tp.normal_array.size() == tp.vertex_array.size());
+        if (!tp.vertex_array.empty()) {
+            std::copy(tp.vertex_array.data(), tp.vertex_array.data() + tp.vertex_array.size(),
+                    vertices.begin() + 3 * vertex_offset[p]);
+            std::copy(tp.normal_array.data(), tp.normal_array.data() + tp.normal_array.size(),
+                    normals.begin() + 3 * vertex_offset[p]);
+        }
+        unsigned int* patch_indices = (indices.empty() ? NULL : &(indices[index_offset[p]]));
+        for (unsigned int i = 0; i < index_offset[p + 1] - index_offset[p]; i++)
+            patch_indices[i] = vertex_offset[p] + tp.index_array[i];
+    }
+    update_transformations(scene);
+}
+
+void SceneArena::update_transformations(const std::vector<TrianglePatch>& scene)
+{
+    assert(scene.size() == patches());
+    transformations.resize(16 * scene.size());
+    for (size_t p = 0; p < scene.size(); p++)
+        std::copy(scene[p].transformation, scene[p].transformation + 16, transformations.begin() + 16 * p);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef SCENEARENA_H
+#define SCENEARENA_H
+
+#include <cstddef>
+#include <vector>
+
+#include "trianglepatch.h"
+
+/**
+ * \file scenearena.h
+ * \brief A flattened representation of the scene.
+ *
+ * This file documents the SceneArena class.
+ */
+
+/**
+ * \brief The SceneArena class.
+ *
+ * The geometry of all triangle patches of a scene is stored in one contiguous
+ * vertex arena, one normal arena, and one index arena. The per-patch records
+ * (offsets and transformations) are stored as a structure of
+ * arrays. Code that processes the whole scene can stream over these arrays
+ * instead of visiting each patch's separate arrays.
+ *
+ * Patch p owns the vertices vertex_offset[p] to vertex_offset[p+1]-1 and the
+ * triangle indices index_offset[p] to index_offset[p+1]-1. The indices refer
+ * to the whole vertex arena, i.e. the vertex offset of the patch is already
+ * included.
+ */
+class SceneArena
+{
+public:
+    std::vector<float> vertices;                /**< \brief Untransformed vertices of all patches (x, y, z) */
+    std::vector<float> normals;                 /**< \brief Untransformed normals of all patches (n.x, n.y, n.z) */
+    std::vector<unsigned int> indices;          /**< \brief Triangle indices of all patches, into the vertex arena */
+
+    std::vector<unsigned int> vertex_offset;    /**< \brief Per patch: first vertex; one additional entry for the end */
+    std::vector<unsigned int> index_offset;     /**< \brief Per patch: first index; one additional entry for the end */
+    std::vector<float> transformations;         /**< \brief Per patch: transformation matrix, 4x4 column-major */
+
+public:
+    /** \brief Constructor
+     *
+     * Constructs an empty arena.
+     */
+    SceneArena();
+
+    /** \brief Return the number of patches */
+    size_t patches() const
+    {
+        return vertex_offset.size() - 1;
+    }
+
+    /** \brief Return the number of triangles of all patches */
+    size_t triangles() const
+    {
+        return indices.size() / 3;
+    }
+
+    /** \brief Build the arena from a scene
+     *
+     * Copies the geometry and the transformations of all patches. */
+    void build(const std::vector<TrianglePatch>& scene);
+
+    /** \brief Update the transformations
+     *
+     * Copies only the transformations of all patches. The scene must have
+     * the same geometry as the one that the arena was built from. */
+    void update_transformations(const std::vector<TrianglePatch>& scene);
+};
+
+#endif
@@ -8,7 +8,11 @@
 
 #version 120
 
-uniform sampler2D phase_texs[4];
+// PHASES, the samplers phase_tex_0 to phase_tex_<PHASES-1>, and the function
+// correlate_phases(tc, I, Q, S) are inserted here by SimWidget. The function
+// adds D_i * cos(tau_i) to I, D_i * sin(tau_i) to Q, and D_i to S for the
+// differences D_i between energy_a and energy_b of phase image i, with the
+// phase offsets tau_i = i * 2pi / PHASES.
 
 // Simulator properties
 uniform float frac_c_modfreq;
@@ -18,33 +22,24 @@ const float pi = 3.14159265358979323846;
 
 void main(void)
 {
-    // Values energy_a and energy_b from the four phase images
-    float A[4], B[4];
-    // The difference between energy_a and energy_b;
-    float D[4];
-
-    vec2 tc = gl_TexCoord[0].xy;
-    for (int i = 0; i < 4; i++) {
-        vec2 P = texture2D(phase_texs[i], tc).rg;
-        A[i] = P[0];
-        B[i] = P[1];
-        D[i] = A[i] - B[i];
-    }
+    // Correlate the differences D between energy_a and energy_b of all phase images
+    // with the phase offsets. For four phases, this gives I = D[0] - D[2] and
+    // Q = D[1] - D[3] exactly, since the constants are only 0 and +-1.
+    float I = 0.0;
+    float Q = 0.0;
+    float S = 0.0;
+    correlate_phases(gl_TexCoord[0].xy, I, Q, S);
 
     float pmd_depth;
-    if (abs(D[0] - D[2]) <= 0.0 && abs(D[1] - D[3]) <= 0.0) {
+    if (abs(I) <= 0.0 && abs(Q) <= 0.0) {
         pmd_depth = 0.0;
     } else {
-        /*
-        float phase_shift = atan(D[0] - D[2], D[1] - D[3]) - pi / 2.0;
-        if (phase_shift < 0.0)
-            phase_shift += 2.0 * pi;
-        */
-        float phase_shift = atan(D[3] - D[1], D[0] - D[2]);
+        float phase_shift = atan(-Q, I);
         pmd_depth = frac_c_modfreq * phase_shift / (4.0 * pi);
     }
-    float pmd_amp = sqrt((D[0] - D[2]) * (D[0] - D[2]) + (D[1] - D[3]) * (D[1] - D[3])) * pi / 2.0;
-    float pmd_intensity = (D[0] + D[1] + D[2] + D[3]) / 2.0;
+    // Amplitude and intensity are scaled to match the four phase case
+    float pmd_amp = sqrt(I * I + Q * Q) * pi / 2.0 * (4.0 / float(PHASES));
+    float pmd_intensity = S / 2.0 * (4.0 / float(PHASES));
 
     gl_FragColor = vec4(pmd_depth, pmd_amp, pmd_intensity, 0.0);
 }
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+#include <GL/glew.h>
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+
+#include "simthread.h"
+#include "simwidget.h"
+
+
+SimThread::SimThread(SimWidget* sim_widget) : QThread(),
+    _sim_widget(sim_widget), _job_pending(false), _busy(false), _quit(false)
+{
+}
+
+SimThread::~SimThread()
+{
+    stop_simulation();
+}
+
+void SimThread::start_simulation()
+{
+    _quit = false;
+    _sim_widget->doneCurrent();
+#if QT_VERSION >= 0x040800
+    _sim_widget->context()->moveToThread(this);
+#endif
+    start();
+}
+
+void SimThread::stop_simulation()
+{
+    if (!isRunning())
+        return;
+    _mutex.lock();
+    _quit = true;
+    _job_cond.wakeAll();
+    _mutex.unlock();
+    wait();
+}
+
+void SimThread::submit(SimJob& job)
+{
+    QMutexLocker locker(&_mutex);
+    // Replace a job that was not started yet: only the newest inputs matter
+    std::swap(_job, job);
+    _job_pending = true;
+    _job_cond.wakeOne();
+}
+
+bool SimThread::job_pending()
+{
+    QMutexLocker locker(&_mutex);
+    return _job_pending;
+}
+
+void SimThread::wait_for_results()
+{
+    QMutexLocker locker(&_mutex);
+    while ((_job_pending || _busy) && isRunning())
+        _idle_cond.wait(&_mutex);
+}
+
+static void set_transformations(const float* transformations, std::vector<TrianglePatch>* scene)
+{
+    for (size_t i = 0; i < scene->size(); i++)
+        std::memcpy((*scene)[i].transformation, transformations + i * 16, 16 * sizeof(float));
+}
+
+static void read_texture(GLuint tex, bool rgba, int w, int h, std::vector<float>* data)
+{
+    data->resize((rgba ? 4 : 3) * w * h);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glGetTexImage(GL_TEXTURE_2D, 0, rgba ? GL_RGBA : GL_RGB, GL_FLOAT, &((*data)[0]));
+}
+
+void SimThread::simulate(SimJob& job, SimFrame& frame)
+{
+    _sim_widget->update_simulator(job.simulator);
+
+    // Simulate the phase images from all time samples, then the results
+    int samples = job.simulator.exposure_time_samples;
+    size_t sample_size = job.scene.size() * 16;
+    assert(job.transformations.size() == Simulator::phases * samples * sample_size);
+    for (int i = 0; i < Simulator::phases; i++) {
+        for (int j = 0; j < samples; j++) {
+            if (sample_size > 0)
+                set_transformations(&(job.transformations[(i * samples + j) * sample_size]), &job.scene);
+            _sim_widget->render_map(job.scene_id, job.scene, i);
+            _sim_widget->simulate_phase_img(i, j, job.frame);
+        }
+    }
+    _sim_widget->simulate_result();
+
+    // Read the images back so that the GUI thread can use them without
+    // touching our context
+    int w = job.simulator.sensor_width;
+    int h = job.simulator.sensor_height;
+    frame.simulator = job.simulator;
+    frame.frame = job.frame;
+    read_texture(_sim_widget->get_map(), true, w, h, &frame.map);
+    for (int f = 0; f < job.simulator.modulation_frequencies(); f++) {
+        for (int i = 0; i < Simulator::phases; i++)
+            read_texture(_sim_widget->get_phase(i, f), true, w, h, &frame.phases[f][i]);
+        read_texture(_sim_widget->get_result(f), false, w, h, &frame.results[f]);
+    }
+    if (job.simulator.modulation_frequencies() > 1)
+        read_texture(_sim_widget->get_unwrapped_result(), false, w, h, &frame.unwrapped_result);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    // The GPU is done with this frame now, so the statistics do not stall it
+    _sim_widget->collect_stats();
+}
+
+void SimThread::run()
+{
+    _sim_widget->makeCurrent();
+    SimJob job;
+    for (;;) {
+        _mutex.lock();
+        while (!_job_pending && !_quit)
+            _job_cond.wait(&_mutex);
+        if (_quit) {
+            _mutex.unlock();
+            break;
+        }
+        std::swap(job, _job);
+        _job_pending = false;
+        _busy = true;
+        _mutex.unlock();
+
+        simulate(job, _frames.back());
+        _frames.publish();
+
+        _mutex.lock();
+        _busy = false;
+        if (!_job_pending)
+            _idle_cond.wakeAll();
+        _mutex.unlock();
+        emit frame_ready();
+    }
+    _mutex.lock();
+    _job_pending = false;
+    _idle_cond.wakeAll();
+    _mutex.unlock();
+
+    // Hand the context back to the GUI thread
+    _sim_widget->doneCurrent();
+#if QT_VERSION >= 0x040800
+    _sim_widget->context()->moveToThread(QCoreApplication::instance()->thread());
+#endif
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef SIMTHREAD_H
+#define SIMTHREAD_H
+
+#include <vector>
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "simulator.h"
+#include "trianglepatch.h"
+#include "triplebuffer.h"
+
+class SimWidget;
+
+
+/* The inputs for simulating one frame: the scene as captured from the OSG
+ * widget, and the patch transformations for each time sample. */
+class SimJob
+{
+public:
+    Simulator simulator;
+    int scene_id;
+    std::vector<TrianglePatch> scene;
+    // Per phase, exposure time sample, and patch: transformation, 16 floats
+    std::vector<float> transformations;
+    unsigned int frame;
+};
+
+/* The results of one simulated frame, read back from the GPU. All images
+ * have the sensor size. */
+class SimFrame
+{
+public:
+    Simulator simulator;
+    unsigned int frame;
+    std::vector<float> map;                     // RGBA, first modulation frequency
+    std::vector<float> phases[Simulator::max_modulation_frequencies][Simulator::phases]; // RGBA
+    std::vector<float> results[Simulator::max_modulation_frequencies];                  // RGB
+    std::vector<float> unwrapped_result;        // RGB, only with multiple modulation frequencies
+};
+
+/* Runs the simulation pipeline of a SimWidget in its own thread, so that a
+ * slow frame does not block the GUI, and GUI events do not disturb the
+ * simulation.
+ *
+ * The GUI thread submits jobs. A job that was not started yet is replaced by
+ * a newer one. Finished frames are published through a triple buffer, and
+ * frame_ready() is emitted. The GL context of the SimWidget belongs to this
+ * thread while it runs; the GUI thread must not use it. */
+class SimThread : public QThread
+{
+    Q_OBJECT
+
+private:
+    SimWidget* _sim_widget;
+    QMutex _mutex;
+    QWaitCondition _job_cond;   // a job was submitted, or the thread should quit
+    QWaitCondition _idle_cond;  // all submitted jobs are done
+    SimJob _job;
+    bool _job_pending;
+    bool _busy;
+    bool _quit;
+    TripleBuffer<SimFrame> _frames;
+
+    void simulate(SimJob& job, SimFrame& frame);
+
+protected:
+    void run();
+
+public:
+    SimThread(SimWidget* sim_widget);
+    ~SimThread();
+
+    // Start the thread. This releases the current context of the calling thread.
+    void start_simulation();
+    // Finish the current job and stop the thread. The SimWidget context is
+    // handed back to the GUI thread.
+    void stop_simulation();
+
+    // Submit a job. Its contents are taken over.
+    void submit(SimJob& job);
+    // Whether a submitted job has not been started yet
+    bool job_pending();
+    // Wait until all submitted jobs are done and their frames are published
+    void wait_for_results();
+
+    // Consumer side, for the GUI thread only: get the most recent frame.
+    // update_frame() returns true if a new frame is available.
+    bool update_frame()
+    {
+        return _frames.update();
+    }
+
+    const SimFrame& frame() const
+    {
+        return _frames.front();
+    }
+
+signals:
+    void frame_ready();
+};
+
+#endif
@@ -93,6 +93,7 @@ Simulator::Simulator() :
     far_plane(2.0f),                            // 2m; sensible for 70cm app.
     exposure_time_samples(1),                   // temporal supersampling of phase image computation; default: off
     rendering_method(0),                        // Default is plain old rasterization
+    occlusion_culling(0),                       // Only frustum culling by default
     material_model(0),                          // Lambertian surfaces
     material_lambertian_reflectivity(0.7f),     // 70% surface reflectivity
     lightsource_model(0),                       // Default: simple model
@@ -112,9 +113,56 @@ Simulator::Simulator() :
     pixel_pitch(12.0f),                         // a 12 micrometer pitch is realistic
     readout_time(1 * 1000),                     // see mail from Stefan 2012-12-03
     contrast(0.75f),                            // Default is 0.75f; could also be 1.0f?
+    noise_model(0),                             // Ideal phase images by default
+    responsivity(0.4f),                         // typical for silicon at 850 nm
+    dark_current(1000.0f),                      // 1000 electrons per second
+    read_noise(20.0f),                          // 20 electrons RMS
+    noise_seed(0),                              // arbitrary
     modulation_frequency(10 * 1000 * 1000),     // see mail from Stefan 2012-12-03
     exposure_time(1 * 1000)                     // see mail from Stefan 2012-12-03
 {
+    for (int i = 0; i < max_modulation_frequencies - 1; i++)
+        additional_modulation_frequencies[i] = 0; // single-frequency acquisition by default
+}
+
+void Simulator::phase_offset_cos_sin(int i, float* cos_tau, float* sin_tau)
+{
+    double tau = 2.0 * M_PI * i / phases;
+    double v[2] = { std::cos(tau), std::sin(tau) };
+    for (int j = 0; j < 2; j++) {
+        if (std::fabs(v[j]) < 1e-9)
+            v[j] = 0.0;
+        else if (std::fabs(std::fabs(v[j]) - 1.0) < 1e-9)
+            v[j] = (v[j] < 0.0 ? -1.0 : 1.0);
+    }
+    *cos_tau = v[0];
+    *sin_tau = v[1];
+}
+
+void Simulator::compact_modulation_frequencies()
+{
+    int n = 0;
+    for (int i = 0; i < max_modulation_frequencies - 1; i++)
+        if (additional_modulation_frequencies[i] > 0)
+            additional_modulation_frequencies[n++] = additional_modulation_frequencies[i];
+    while (n < max_modulation_frequencies - 1)
+        additional_modulation_frequencies[n++] = 0;
+}
+
+float Simulator::extended_ambiguity_range() const
+{
+    int gcd = modulation_frequency;
+    for (int i = 1; i < modulation_frequencies(); i++) {
+        int a = gcd;
+        int b = get_modulation_frequency(i);
+        while (b != 0) {
+            int t = a % b;
+            a = b;
+            b = t;
+        }
+        gcd = a;
+    }
+    return static_cast<double>(c) / static_cast<double>(gcd) * 0.5;
 }
 
 void Simulator::save(const std::string& filename) const
@@ -130,6 +178,7 @@ void Simulator::save(const std::string& filename) const
     fprintf(f, "far_plane %.8g\n", far_plane);
     fprintf(f, "exposure_time_samples %d\n", exposure_time_samples);
     fprintf(f, "rendering_method %d\n", rendering_method);
+    fprintf(f, "occlusion_culling %d\n", occlusion_culling);
     fprintf(f, "material_model %d\n", material_model);
     fprintf(f, "material_lambertian_reflectivity %.8g\n", material_lambertian_reflectivity);
     fprintf(f, "lightsource_model %d\n", lightsource_model);
@@ -149,7 +198,14 @@ void Simulator::save(const std::string& filename) const
     fprintf(f, "pixel_pitch %.8g\n", pixel_pitch);
     fprintf(f, "readout_time %d\n", readout_time);
     fprintf(f, "contrast %.8g\n", contrast);
+    fprintf(f, "noise_model %d\n", noise_model);
+    fprintf(f, "responsivity %.8g\n", responsivity);
+    fprintf(f, "dark_current %.8g\n", dark_current);
+    fprintf(f, "read_noise %.8g\n", read_noise);
+    fprintf(f, "noise_seed %d\n", noise_seed);
     fprintf(f, "modulation_frequency %d\n", modulation_frequency);
+    fprintf(f, "additional_modulation_frequencies %d %d\n",
+            additional_modulation_frequencies[0], additional_modulation_frequencies[1]);
     fprintf(f, "exposure_time %d\n", exposure_time);
     fflush(f);
     if (ferror(f) || fclose(f) != 0) {
@@ -195,6 +251,8 @@ void Simulator::load(const std::string& filename)
             continue;
         else if (sscanf(linebuf, "rendering_method %d", &newsim.rendering_method) == 1)
             continue;
+        else if (sscanf(linebuf, "occlusion_culling %d", &newsim.occlusion_culling) == 1)
+            continue;
         else if (sscanf(linebuf, "material_model %d", &newsim.material_model) == 1)
             continue;
         else if (sscanf(linebuf, "material_lambertian_reflectivity %f", &newsim.material_lambertian_reflectivity) == 1)
@@ -242,8 +300,22 @@ void Simulator::load(const std::string& filename)
             continue;
         else if (sscanf(linebuf, "contrast %f", &newsim.contrast) == 1)
             continue;
+        else if (sscanf(linebuf, "noise_model %d", &newsim.noise_model) == 1)
+            continue;
+        else if (sscanf(linebuf, "responsivity %f", &newsim.responsivity) == 1)
+            continue;
+        else if (sscanf(linebuf, "dark_current %f", &newsim.dark_current) == 1)
+            continue;
+        else if (sscanf(linebuf, "read_noise %f", &newsim.read_noise) == 1)
+            continue;
+        else if (sscanf(linebuf, "noise_seed %d", &newsim.noise_seed) == 1)
+            continue;
         else if (sscanf(linebuf, "modulation_frequency %d", &newsim.modulation_frequency) == 1)
             continue;
+        else if (sscanf(linebuf, "additional_modulation_frequencies %d %d",
+                    &newsim.additional_modulation_frequencies[0],
+                    &newsim.additional_modulation_frequencies[1]) == 2)
+            continue;
         else if (sscanf(linebuf, "exposure_time %d", &newsim.exposure_time) == 1)
             continue;
         else // ignore unknown entries, for future compatibility
@@ -253,5 +325,6 @@ void Simulator::load(const std::string& filename)
         throw std::system_error(errno, std::system_category(),
                 std::string("Cannot read ").append(filename));
     }
+    newsim.compact_modulation_frequencies();
     *this = newsim;
 }
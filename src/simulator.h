@@ -9,9 +9,17 @@
 #ifndef SIMULATOR_H
 #define SIMULATOR_H
 
+#include <cmath>
 #include <string>
 #include <vector>
 
+/* The number of phase images per frame is a compile-time constant,
+ * set with the CMake variable PHASE_COUNT. */
+#ifndef PHASE_COUNT
+# define PHASE_COUNT 4
+#endif
+static_assert(PHASE_COUNT == 3 || PHASE_COUNT == 4 || PHASE_COUNT == 8, "PHASE_COUNT must be 3, 4, or 8");
+
 /**
  * \file simulator.h
  * \brief The simulator description.
@@ -67,6 +75,8 @@ class Simulator
 public:
     static const int c = 299792458; /**< \brief Speed of light in m/s */
     constexpr static const float e = 0.1602176565; /**< \brief Elementary charge in Attocoulomb (1e-18 C). */
+    static const int max_modulation_frequencies = 3; /**< \brief Maximum number of modulation frequencies */
+    static const int phases = PHASE_COUNT; /**< \brief Number of phase images per frame, with equally spaced phase offsets */
 
     /** \name Rasterization parameters */
 
@@ -79,8 +89,13 @@ public:
     float far_plane;
     /** \brief Number of phase image samples taken during exposure time */
     int exposure_time_samples;
-    /** \brief Rendering method; currently only 0=default */
+    /** \brief Rendering method: 0=default (rasterization on the GPU), 1=ray casting on the CPU
+     * (one ray per subpixel, traced through a bounding volume hierarchy on all cores) */
     int rendering_method;
+    /** \brief Occlusion culling: 0=off, 1=on. Triangle patches outside of the view frustum
+     * are always skipped. With occlusion culling, patches that were hidden in the previous
+     * time sample are only drawn if their bounding box passes an occlusion query. */
+    int occlusion_culling;
     /*@}*/
 
     /** \name Material parameters */
@@ -153,6 +168,19 @@ public:
     int readout_time;
     /** \brief Contrast achieved by one pixel, in [0,1] */
     float contrast;
+    /** \brief Noise model: 0=off (ideal phase images), 1=photon shot noise, dark current
+     * shot noise and read noise, added to the accumulated phase images */
+    int noise_model;
+    /** \brief Noise model 1: responsivity of the photo diodes in ampere per watt, used to
+     * convert the incoming energy to electrons */
+    float responsivity;
+    /** \brief Noise model 1: dark current in electrons per second per tap */
+    float dark_current;
+    /** \brief Noise model 1: read noise in electrons RMS per tap */
+    float read_noise;
+    /** \brief Noise model 1: seed of the random number generator. The noise of a pixel only
+     * depends on this seed, the frame number, and the pixel's position and phase image. */
+    int noise_seed;
     /*@}*/
 
     /** \name User-changeable sensor parameters */
@@ -160,6 +188,11 @@ public:
     /*@{*/
     /** \brief Modulation frequency in Hz */
     int modulation_frequency;
+    /** \brief Additional modulation frequencies in Hz for multi-frequency acquisition,
+     * or 0 if unused. Each frequency gets its own phase images, computed from the same
+     * rendered scene geometry, and the depths of all frequencies are combined into a
+     * depth with an extended ambiguity range. Unused entries must come last. */
+    int additional_modulation_frequencies[max_modulation_frequencies - 1];
     /** \brief Exposure time in microseconds */
     int exposure_time;
     /*@}*/
@@ -195,6 +228,62 @@ public:
         return aspect_ratio();
     }
 
+    /** \brief Return the number of electrons generated by one zeptojoule of incoming energy. */
+    float electrons_per_zeptojoule() const
+    {
+        // [A/W * 1e-21 J] / [1e-18 C]
+        return responsivity / e * 1e-3f;
+    }
+
+    /** \brief Return the number of dark current electrons per tap during one exposure. */
+    float dark_electrons() const
+    {
+        return dark_current * exposure_time * 1e-6f;
+    }
+
+    /** \brief Return the phase offset tau of phase image i in radians: i * 2pi / phases. */
+    static float phase_offset(int i)
+    {
+        return i * static_cast<float>(2.0 * M_PI / phases);
+    }
+
+    /** \brief Return cos(tau) and sin(tau) for the phase offset tau of phase image i.
+     * Values that are mathematically 0 or +-1 are exact, so that the demodulation
+     * of four phases reduces to plain differences of phase images. */
+    static void phase_offset_cos_sin(int i, float* cos_tau, float* sin_tau);
+
+    /** \brief Move the additional modulation frequencies that are in use to the front.
+     * Only the additional frequencies before the first unused one (0) count, so
+     * call this whenever they are set. */
+    void compact_modulation_frequencies();
+
+    /** \brief Return the number of modulation frequencies in use (at least 1). */
+    int modulation_frequencies() const
+    {
+        int n = 1;
+        while (n < max_modulation_frequencies && additional_modulation_frequencies[n - 1] > 0)
+            n++;
+        return n;
+    }
+
+    /** \brief Return modulation frequency i in Hz, for i < modulation_frequencies().
+     * Frequency 0 is the main modulation frequency. */
+    int get_modulation_frequency(int i) const
+    {
+        return (i == 0 ? modulation_frequency : additional_modulation_frequencies[i - 1]);
+    }
+
+    /** \brief Return the ambiguity range of modulation frequency i in meters. */
+    float ambiguity_range(int i = 0) const
+    {
+        return static_cast<double>(c) / static_cast<double>(get_modulation_frequency(i)) * 0.5;
+    }
+
+    /** \brief Return the ambiguity range of the combination of all modulation
+     * frequencies in meters. This is determined by the greatest common divisor
+     * of the frequencies. */
+    float extended_ambiguity_range() const;
+
     /** \brief Save simulator description to a file
      *
      * This throws a std::exception on failure. */
@@ -7,6 +7,7 @@
  */
 
 #include <cassert>
+#include <cstdio>
 #include <cmath>
 #include <stdexcept>
 #include <system_error>
@@ -14,66 +15,190 @@
 #include <GL/glew.h>
 
 #include "simwidget.h"
+#include "noise.h"
 
 #include "render-simple.vs.glsl.h"
 #include "render-simple.fs.glsl.h"
+#include "subpixelfactor.fs.glsl.h"
 #include "reduction.fs.glsl.h"
 #include "simphaseadd.fs.glsl.h"
 #include "simresult.fs.glsl.h"
+#include "unwrap.fs.glsl.h"
+#include "noise.fs.glsl.h"
 
 
+static std::string replace(const std::string &str, const std::string &s, const std::string &r)
+{
+    // replace all occurences of 's' in str with r, and return result
+    std::string ts(str);
+    size_t s_len = s.length();
+    size_t r_len = r.length();
+    size_t p = 0;
+
+    while ((p = ts.find(s, p)) != std::string::npos) {
+        ts.replace(p, s_len, r);
+        p += r_len;
+    }
+    return ts;
+}
+
+static std::string phase_definitions()
+{
+    // GLSL definitions for the compile-time number of phases: PHASES, one sampler
+    // phase_tex_i per phase image, and the function correlate_phases() with one
+    // statement per phase and the cos(tau_i) and sin(tau_i) of the phase offsets
+    // tau_i as literals. GLSL 1.20 does not allow to index sampler arrays with
+    // loop variables, so the loop is unrolled here.
+    char buf[256];
+    std::snprintf(buf, sizeof(buf), "#define PHASES %d\n", Simulator::phases);
+    std::string defs = buf;
+    for (int i = 0; i < Simulator::phases; i++) {
+        std::snprintf(buf, sizeof(buf), "uniform sampler2D phase_tex_%d;\n", i);
+        defs += buf;
+    }
+    defs += "void correlate_phases(vec2 tc, inout float I, inout float Q, inout float S)\n{\n"
+        "    vec2 P;\n    float D;\n";
+    for (int i = 0; i < Simulator::phases; i++) {
+        float c, s;
+        Simulator::phase_offset_cos_sin(i, &c, &s);
+        std::snprintf(buf, sizeof(buf),
+                "    P = texture2D(phase_tex_%d, tc).rg;\n"
+                "    D = P.r - P.g;\n"
+                "    I += D * %.9e;\n"
+                "    Q += D * %.9e;\n"
+                "    S += D;\n", i, c, s);
+        defs += buf;
+    }
+    defs += "}\n";
+    return defs;
+}
+
 SimWidget::SimWidget() : GLWidget(NULL),
     _fbo(0), _depthbuffer(0),
     _pixel_map_w(0), _pixel_map_h(0),
     _pixel_map_tex(0),
-    _oversampled_map_tex(0), _oversampled_map_width(-1), _oversampled_map_height(-1),
+    _oversampled_map_width(-1), _oversampled_map_height(-1), _oversampled_map_frequencies(0),
     _simple_prg(0),
     _simple_prg_current_table(), _simple_prg_table(0),
+    _subpixel_factor_prg(0), _subpixel_factor_tex(0), _subpixel_factor_revision(0),
+    _scene_cache(2),
+    _patch_visibility_scene_id(-1),
+    _subpixel_factor_readback_revision(-1),
     _reduction_prg(0),
-    _map_width(-1), _map_height(-1), _map_tex(0),
-    _phase_add_prg(0),
-    _phase_w(0), _phase_h(0),
+    _map_width(-1), _map_height(-1), _map_frequencies(0),
+    _phase_add_prg(0), _noise_prg(0),
+    _phase_w(0), _phase_h(0), _phase_frequencies(0),
     _result_prg(0),
-    _result_w(0), _result_h(0),
-    _result_tex(0)
+    _result_w(0), _result_h(0), _result_frequencies(0),
+    _unwrap_prg(0),
+    _unwrapped_w(0), _unwrapped_h(0), _unwrapped_tex(0)
 {
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 2; j++)
-            _phase_texs[i][j] = 0;
-        _phase_texs_index[i] = -1;
+    for (int f = 0; f < Simulator::max_modulation_frequencies; f++) {
+        _oversampled_map_texs[f] = 0;
+        _map_texs[f] = 0;
+        for (int i = 0; i < Simulator::phases; i++) {
+            for (int j = 0; j < 2; j++)
+                _phase_texs[f][i][j] = 0;
+            _phase_texs_index[f][i] = -1;
+        }
+        _result_texs[f] = 0;
     }
+
+    // Build all programs up front so that the first simulation step does not stall.
+    // The result program is specialized for the compile-time number of phases.
+    std::string result_src = replace(SIMRESULT_FS_GLSL_STR, "#version 120\n",
+            std::string("#version 120\n") + phase_definitions());
+    std::vector<ProgramSource> programs(6);
+    programs[0].prg = &_simple_prg;
+    programs[0].vs_src = RENDER_SIMPLE_VS_GLSL_STR;
+    programs[0].fs_src = RENDER_SIMPLE_FS_GLSL_STR;
+    programs[0].where = XGL_HERE;
+    programs[1].prg = &_reduction_prg;
+    programs[1].vs_src = NULL;
+    programs[1].fs_src = REDUCTION_FS_GLSL_STR;
+    programs[1].where = XGL_HERE;
+    programs[2].prg = &_phase_add_prg;
+    programs[2].vs_src = NULL;
+    programs[2].fs_src = SIMPHASEADD_FS_GLSL_STR;
+    programs[2].where = XGL_HERE;
+    programs[3].prg = &_result_prg;
+    programs[3].vs_src = NULL;
+    programs[3].fs_src = result_src.c_str();
+    programs[3].where = XGL_HERE;
+    programs[4].prg = &_subpixel_factor_prg;
+    programs[4].vs_src = NULL;
+    programs[4].fs_src = SUBPIXELFACTOR_FS_GLSL_STR;
+    programs[4].where = XGL_HERE;
+    programs[5].prg = &_unwrap_prg;
+    programs[5].vs_src = NULL;
+    programs[5].fs_src = UNWRAP_FS_GLSL_STR;
+    programs[5].where = XGL_HERE;
+    build_programs(programs);
+    glUseProgram(_phase_add_prg);
+    glUniform1i(glGetUniformLocation(_phase_add_prg, "phase_tex_0"), 0);
+    glUniform1i(glGetUniformLocation(_phase_add_prg, "phase_tex_1"), 1);
+    glUseProgram(_result_prg);
+    for (int i = 0; i < Simulator::phases; i++) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "phase_tex_%d", i);
+        glUniform1i(glGetUniformLocation(_result_prg, name), i);
+    }
+    glUseProgram(_unwrap_prg);
+    glUniform1i(glGetUniformLocation(_unwrap_prg, "result_tex_0"), 0);
+    glUniform1i(glGetUniformLocation(_unwrap_prg, "result_tex_1"), 1);
+    glUniform1i(glGetUniformLocation(_unwrap_prg, "result_tex_2"), 2);
+    glUseProgram(0);
+    assert(xglCheckError(XGL_HERE));
 }
 
-GLuint SimWidget::get_map() const
+SimWidget::~SimWidget()
 {
-    return _map_tex;
+    // Release the GPU buffers while our context still exists
+    makeCurrent();
+    _scene_cache.clear();
+    _stage_timer.clear();
 }
 
-GLuint SimWidget::get_phase(int index) const
+void SimWidget::set_stats(Stats* stats)
 {
-    assert(index >= 0 && index <= 4);
-    assert(_phase_texs_index[index] >= 0 && _phase_texs_index[index] <= 1);
-    return _phase_texs[index][_phase_texs_index[index]];
+    _stage_timer.set_stats(stats);
 }
 
-GLuint SimWidget::get_result() const
+void SimWidget::collect_stats()
 {
-    return _result_tex;
+    makeCurrent();
+    _stage_timer.collect();
 }
 
-static std::string replace(const std::string &str, const std::string &s, const std::string &r)
+bool SimWidget::have_noise_model() const
 {
-    // replace all occurences of 's' in str with r, and return result
-    std::string ts(str);
-    size_t s_len = s.length();
-    size_t r_len = r.length();
-    size_t p = 0;
+    // GLSL 1.30 is part of OpenGL 3.0
+    return GLEW_VERSION_3_0;
+}
 
-    while ((p = ts.find(s, p)) != std::string::npos) {
-        ts.replace(p, s_len, r);
-        p += r_len;
-    }
-    return ts;
+GLuint SimWidget::get_map(int frequency) const
+{
+    assert(frequency >= 0 && frequency < _map_frequencies);
+    return _map_texs[frequency];
+}
+
+GLuint SimWidget::get_phase(int index, int frequency) const
+{
+    assert(index >= 0 && index < Simulator::phases);
+    assert(frequency >= 0 && frequency < _phase_frequencies);
+    assert(_phase_texs_index[frequency][index] >= 0 && _phase_texs_index[frequency][index] <= 1);
+    return _phase_texs[frequency][index][_phase_texs_index[frequency][index]];
+}
+
+GLuint SimWidget::get_result(int frequency) const
+{
+    assert(frequency >= 0 && frequency < _result_frequencies);
+    return _result_texs[frequency];
+}
+
+GLuint SimWidget::get_unwrapped_result() const
+{
+    return _unwrapped_tex;
 }
 
 static GLuint create_tex2d(GLint internal_format, int w, int h)
@@ -109,165 +234,328 @@ void render_one_to_one(float tl = 0.0f, float tr = 1.0f)
     glEnd();
 }
 
-void SimWidget::render_oversampled_map(int scene_id, const std::vector<TrianglePatch>& scene, int phase_index)
+static void get_bounding_box_corners(const float bb[6], const float m[16], float corners[8][3])
 {
-    if (_simple_prg == 0) {
-        GLuint vshader = xglCompileShader(GL_VERTEX_SHADER, RENDER_SIMPLE_VS_GLSL_STR, XGL_HERE);
-        GLuint fshader = xglCompileShader(GL_FRAGMENT_SHADER, RENDER_SIMPLE_FS_GLSL_STR, XGL_HERE);
-        _simple_prg = xglCreateProgram(vshader, 0, fshader);
-        xglLinkProgram(_simple_prg);
-        assert(xglCheckError(XGL_HERE));
+    // Transform the corners of the bounding box to eye space
+    for (int i = 0; i < 8; i++) {
+        float x = bb[(i & 1) ? 3 : 0];
+        float y = bb[(i & 2) ? 4 : 1];
+        float z = bb[(i & 4) ? 5 : 2];
+        corners[i][0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+        corners[i][1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+        corners[i][2] = m[2] * x + m[6] * y + m[10] * z + m[14];
     }
+}
 
-    // Set shader parameters from simulation parameters
-    glUseProgram(_simple_prg);
+static bool bounding_box_in_frustum(const float corners[][3], int n, const Simulator& sim)
+{
+    // The frustum is the one set up with gluPerspective() in render_map(). The camera
+    // is in the origin and looks along -z. A box is culled only if all its n corners are
+    // outside of the same frustum plane, so this test is conservative. For moving
+    // patches, the corners at the start and end of the time sample can be combined.
+    float ty = std::tan(static_cast<float>(M_PI) / 180.0f * sim.aperture_angle / 2.0f);
+    float tx = ty * sim.map_aspect_ratio();
+    int outside[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < n; i++) {
+        float x = corners[i][0];
+        float y = corners[i][1];
+        float d = -corners[i][2];
+        outside[0] += (d < sim.near_plane);
+        outside[1] += (d > sim.far_plane);
+        outside[2] += (x < -d * tx);
+        outside[3] += (x > +d * tx);
+        outside[4] += (y < -d * ty);
+        outside[5] += (y > +d * ty);
+    }
+    for (int j = 0; j < 6; j++)
+        if (outside[j] == n)
+            return false;
+    return true;
+}
+
+static bool bounding_box_crosses_near_plane(const float corners[8][3], const Simulator& sim)
+{
+    // Occlusion queries of a box that is clipped by the near plane are unreliable.
+    for (int i = 0; i < 8; i++)
+        if (-corners[i][2] <= sim.near_plane)
+            return true;
+    return false;
+}
+
+static void draw_bounding_box(const float bb[6])
+{
+    static const int faces[6][4] = {
+        { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 },
+        { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 }
+    };
+    glBegin(GL_QUADS);
+    for (int f = 0; f < 6; f++) {
+        for (int j = 0; j < 4; j++) {
+            int i = faces[f][j];
+            glVertex3f(bb[(i & 1) ? 3 : 0], bb[(i & 2) ? 4 : 1], bb[(i & 4) ? 5 : 2]);
+        }
+    }
+    glEnd();
+}
+
+static void draw_patch(const TrianglePatch& tp, const GPUSceneCache::Buffers& bufs)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, bufs.vertex);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, bufs.normal);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glNormalPointer(GL_FLOAT, 0, 0);
+    if (tp.color_array.empty()) {
+        glDisableClientState(GL_COLOR_ARRAY);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, bufs.color);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(4, GL_FLOAT, 0, 0);
+    }
+    if (tp.texcoord_array.empty()) {
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, bufs.texcoord);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, 0, 0);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufs.index);
+    glDrawElements(GL_TRIANGLES, tp.index_array.size(), GL_UNSIGNED_INT, 0);
+}
+
+void SimWidget::update_subpixel_factor_map()
+{
+    // Collect the simulator parameters that the map depends on
+    const LightSourceIntensityTable& table = _simulator.lightsource_measured_intensities;
+    float lightsource_intensity = -1.0f; // this means the shader has to read a measured value
     if (_simulator.lightsource_model == 0) {
         // simple light source model
         float lightsource_simple_aperture_angle = static_cast<float>(M_PI) / 180.0f
             * _simulator.lightsource_simple_aperture_angle;
         float lightsource_simple_solid_angle = 2.0f * static_cast<float>(M_PI)
             * (1.0f - std::cos(lightsource_simple_aperture_angle / 2.0f));
-        glUniform1f(glGetUniformLocation(_simple_prg, "lightsource_intensity"),
-                _simulator.lightsource_simple_power / lightsource_simple_solid_angle);
-    } else {
+        lightsource_intensity = _simulator.lightsource_simple_power / lightsource_simple_solid_angle;
+    } else if (_simple_prg_current_table != table.filename) {
         // measured light source
-        glUniform1f(glGetUniformLocation(_simple_prg, "lightsource_intensity"), -1.0f);
-        glUniform1i(glGetUniformLocation(_simple_prg, "lightsource_intensity_table"), 0);
-        if (_simple_prg_current_table != _simulator.lightsource_measured_intensities.filename) {
-            glDeleteTextures(1, &_simple_prg_table);
-            _simple_prg_table = create_tex2d(GL_R32F,
-                    _simulator.lightsource_measured_intensities.width,
-                    _simulator.lightsource_measured_intensities.height);
-            glBindTexture(GL_TEXTURE_2D, _simple_prg_table);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F,
-                    _simulator.lightsource_measured_intensities.width,
-                    _simulator.lightsource_measured_intensities.height, 0,
-                    GL_RED, GL_FLOAT, &_simulator.lightsource_measured_intensities.table[0]);
-            _simple_prg_current_table = _simulator.lightsource_measured_intensities.filename;
-        }
-        glActiveTexture(GL_TEXTURE0);
+        glDeleteTextures(1, &_simple_prg_table);
+        _simple_prg_table = create_tex2d(GL_R32F, table.width, table.height);
         glBindTexture(GL_TEXTURE_2D, _simple_prg_table);
-        glUniform1f(glGetUniformLocation(_simple_prg, "lightsource_intensity_table_start_x"),
-                _simulator.lightsource_measured_intensities.start_x);
-        glUniform1f(glGetUniformLocation(_simple_prg, "lightsource_intensity_table_end_x"),
-                _simulator.lightsource_measured_intensities.end_x);
-        glUniform1f(glGetUniformLocation(_simple_prg, "lightsource_intensity_table_start_y"),
-                _simulator.lightsource_measured_intensities.start_y);
-        glUniform1f(glGetUniformLocation(_simple_prg, "lightsource_intensity_table_end_y"),
-                _simulator.lightsource_measured_intensities.end_y);
-    }
-    glUniform1f(glGetUniformLocation(_simple_prg, "frac_modfreq_c"),
-            static_cast<double>(_simulator.modulation_frequency) / Simulator::c);
-    glUniform1f(glGetUniformLocation(_simple_prg, "frac_apdiam_foclen"),
-            _simulator.lens_aperture_diameter / _simulator.lens_focal_length);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, table.width, table.height, 0,
+                GL_RED, GL_FLOAT, &table.table[0]);
+        _simple_prg_current_table = table.filename;
+        _subpixel_factor_params.clear();
+    }
+    float frustum_extent_y = std::tan(_simulator.aperture_angle / 2.0f * static_cast<float>(M_PI) / 180.0f);
+    float frustum_extent_x = frustum_extent_y * _simulator.map_aspect_ratio();
+    float frac_apdiam_foclen = _simulator.lens_aperture_diameter / _simulator.lens_focal_length;
+    std::vector<float> params;
+    params.push_back(_simulator.map_width());
+    params.push_back(_simulator.map_height());
+    params.push_back(frustum_extent_x);
+    params.push_back(frustum_extent_y);
+    params.push_back(frac_apdiam_foclen);
+    params.push_back(lightsource_intensity);
+    if (_simulator.lightsource_model != 0) {
+        params.push_back(table.start_x);
+        params.push_back(table.end_x);
+        params.push_back(table.start_y);
+        params.push_back(table.end_y);
+    }
+    if (params == _subpixel_factor_params)
+        return;
 
+    // Recompute the map
+    glDeleteTextures(1, &_subpixel_factor_tex);
+    _subpixel_factor_tex = create_tex2d(GL_R32F, _simulator.map_width(), _simulator.map_height());
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _subpixel_factor_tex, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
+    assert(xglCheckFBO(XGL_HERE));
+    glViewport(0, 0, _simulator.map_width(), _simulator.map_height());
+    glUseProgram(_subpixel_factor_prg);
+    glUniform1f(glGetUniformLocation(_subpixel_factor_prg, "lightsource_intensity"), lightsource_intensity);
+    glUniform1i(glGetUniformLocation(_subpixel_factor_prg, "lightsource_intensity_table"), 0);
+    glUniform1f(glGetUniformLocation(_subpixel_factor_prg, "lightsource_intensity_table_start_x"), table.start_x);
+    glUniform1f(glGetUniformLocation(_subpixel_factor_prg, "lightsource_intensity_table_end_x"), table.end_x);
+    glUniform1f(glGetUniformLocation(_subpixel_factor_prg, "lightsource_intensity_table_start_y"), table.start_y);
+    glUniform1f(glGetUniformLocation(_subpixel_factor_prg, "lightsource_intensity_table_end_y"), table.end_y);
+    glUniform1f(glGetUniformLocation(_subpixel_factor_prg, "frac_apdiam_foclen"), frac_apdiam_foclen);
+    glUniform2f(glGetUniformLocation(_subpixel_factor_prg, "frustum_extent"), frustum_extent_x, frustum_extent_y);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _simulator.lightsource_model == 0 ? 0 : _simple_prg_table);
+    render_one_to_one();
+    assert(xglCheckError(XGL_HERE));
+    _subpixel_factor_params = params;
+    _subpixel_factor_revision++;
+}
+
+void SimWidget::render_oversampled_map(int scene_id, const std::vector<TrianglePatch>& scene, int phase_index)
+{
+    // Set shader parameters from simulation parameters
+    glUseProgram(_simple_prg);
+    glUniform1i(glGetUniformLocation(_simple_prg, "subpixel_factor_tex"), 0);
+    glUniform2f(glGetUniformLocation(_simple_prg, "subpixel_size"),
+            1.0f / _simulator.map_width(), 1.0f / _simulator.map_height());
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _subpixel_factor_tex);
+    float frac_modfreq_c[Simulator::max_modulation_frequencies];
+    for (int f = 0; f < _simulator.modulation_frequencies(); f++)
+        frac_modfreq_c[f] = static_cast<double>(_simulator.get_modulation_frequency(f)) / Simulator::c;
+    glUniform1i(glGetUniformLocation(_simple_prg, "frequencies"), _simulator.modulation_frequencies());
+    glUniform1fv(glGetUniformLocation(_simple_prg, "frac_modfreq_c"),
+            _simulator.modulation_frequencies(), frac_modfreq_c);
     glUniform1f(glGetUniformLocation(_simple_prg, "exposure_time"), _simulator.exposure_time
             / _simulator.exposure_time_samples);
     glUniform1f(glGetUniformLocation(_simple_prg, "pixel_area"), _simulator.pixel_pitch * _simulator.pixel_pitch);
     glUniform1i(glGetUniformLocation(_simple_prg, "pixel_width"), _simulator.pixel_width);
     glUniform1i(glGetUniformLocation(_simple_prg, "pixel_height"), _simulator.pixel_height);
     glUniform1f(glGetUniformLocation(_simple_prg, "contrast"), _simulator.contrast);
-    glUniform1f(glGetUniformLocation(_simple_prg, "tau"), phase_index * static_cast<float>(M_PI_2));
+    glUniform1f(glGetUniformLocation(_simple_prg, "tau"), Simulator::phase_offset(phase_index));
     assert(_simulator.material_model == 0);
     glUniform1f(glGetUniformLocation(_simple_prg, "lambertian_reflectivity"),
             _simulator.material_lambertian_reflectivity);
 
     assert(xglCheckError(XGL_HERE));
 
-    // Cache the scene data on the GPU
-    static int scene_on_gpu_id = -1;
-    static std::vector<unsigned int> tp_buf_vertex;
-    static std::vector<unsigned int> tp_buf_normal;
-    static std::vector<unsigned int> tp_buf_color;
-    static std::vector<unsigned int> tp_buf_texcoord;
-    static std::vector<unsigned int> tp_buf_index;
-    if (scene_on_gpu_id != scene_id) {
-        // Remove old GPU-cached scene, if any.
-        if (!tp_buf_vertex.empty()) {
-            glDeleteBuffers(tp_buf_vertex.size(), &(tp_buf_vertex[0]));
-            glDeleteBuffers(tp_buf_normal.size(), &(tp_buf_normal[0]));
-            if (!tp_buf_color.empty())
-                glDeleteBuffers(tp_buf_color.size(), &(tp_buf_color[0]));
-            if (!tp_buf_texcoord.empty())
-                glDeleteBuffers(tp_buf_texcoord.size(), &(tp_buf_texcoord[0]));
-            tp_buf_vertex.clear();
-            tp_buf_normal.clear();
-            tp_buf_color.clear();
-            tp_buf_texcoord.clear();
-        }
-        // Upload the new scene to the GPU.
-        tp_buf_vertex.resize(scene.size());
-        tp_buf_normal.resize(scene.size());
-        tp_buf_color.resize(scene.size());
-        tp_buf_texcoord.resize(scene.size());
-        tp_buf_index.resize(scene.size());
+    // Get the scene data on the GPU. Geometry that was uploaded for a previous
+    // scene is reused.
+    const std::vector<GPUSceneCache::Buffers*>& bufs = _scene_cache.get(scene_id, scene);
+    // Now render.
+    // This uses simple vertex buffer rendering.
+    // Patches outside of the view frustum are skipped. With occlusion culling, patches that
+    // were hidden in the previous time sample are first tested via their bounding box.
+    if (_patch_visibility_scene_id != scene_id || _patch_visible.size() != scene.size()) {
+        if (!_patch_queries.empty())
+            glDeleteQueries(_patch_queries.size(), &(_patch_queries[0]));
+        _patch_queries.resize(scene.size());
+        if (!_patch_queries.empty())
+            glGenQueries(_patch_queries.size(), &(_patch_queries[0]));
+        _patch_visible.assign(scene.size(), 1);
+        _patch_queried.assign(scene.size(), 0);
+        _patch_visibility_scene_id = scene_id;
+    }
+    bool occlusion_culling = (_simulator.occlusion_culling != 0);
+    if (occlusion_culling) {
+        // Get the visibility from the queries of the previous sample without waiting
+        // for them: a patch whose result is not available yet counts as visible.
         for (unsigned int i = 0; i < scene.size(); i++) {
-            const TrianglePatch& tp = scene[i];
-            if (tp.vertex_array.empty())
+            if (!_patch_queried[i])
                 continue;
-            GLuint vertex_buf, normal_buf, color_buf, texcoord_buf, index_buf;
-            glGenBuffers(1, &vertex_buf);
-            glBindBuffer(GL_ARRAY_BUFFER, vertex_buf);
-            glBufferData(GL_ARRAY_BUFFER, tp.vertex_array.size() * sizeof(float), &(tp.vertex_array[0]), GL_STATIC_DRAW);
-            tp_buf_vertex[i] = vertex_buf;
-            assert(!tp.normal_array.empty());
-            glGenBuffers(1, &normal_buf);
-            glBindBuffer(GL_ARRAY_BUFFER, normal_buf);
-            glBufferData(GL_ARRAY_BUFFER, tp.normal_array.size() * sizeof(float), &(tp.normal_array[0]), GL_STATIC_DRAW);
-            tp_buf_normal[i] = normal_buf;
-            if (!tp.color_array.empty()) {
-                glGenBuffers(1, &color_buf);
-                glBindBuffer(GL_ARRAY_BUFFER, color_buf);
-                glBufferData(GL_ARRAY_BUFFER, tp.color_array.size() * sizeof(float), &(tp.color_array[0]), GL_STATIC_DRAW);
-                tp_buf_color[i] = color_buf;
+            GLuint available = 0;
+            glGetQueryObjectuiv(_patch_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint samples_passed;
+                glGetQueryObjectuiv(_patch_queries[i], GL_QUERY_RESULT, &samples_passed);
+                _patch_visible[i] = (samples_passed > 0 ? 1 : 0);
+            } else {
+                _patch_visible[i] = 1;
             }
-            if (!tp.texcoord_array.empty()) {
-                glGenBuffers(1, &texcoord_buf);
-                glBindBuffer(GL_ARRAY_BUFFER, texcoord_buf);
-                glBufferData(GL_ARRAY_BUFFER, tp.texcoord_array.size() * sizeof(float), &(tp.texcoord_array[0]), GL_STATIC_DRAW);
-                tp_buf_texcoord[i] = texcoord_buf;
-            }
-            glGenBuffers(1, &index_buf);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buf);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, tp.index_array.size() * sizeof(unsigned int), &(tp.index_array[0]), GL_STATIC_DRAW);
-            tp_buf_index[i] = index_buf;
         }
-        scene_on_gpu_id = scene_id;
     }
-    // Now render.
-    // This uses simple vertex buffer rendering.
-    // TODO: Performance optimization: cache the data on the GPU; do not transfer it every frame.
+    std::vector<unsigned char> patch_state(scene.size()); // 0=culled, 1=drawn, 2=box tested
     glMatrixMode(GL_MODELVIEW);
     for (unsigned int i = 0; i < scene.size(); i++) {
         const TrianglePatch& tp = scene[i];
+        patch_state[i] = 0;
         if (tp.vertex_array.empty())
             continue;
+        float corners[8][3];
+        get_bounding_box_corners(tp.bounding_box, tp.transformation, corners);
+        if (!bounding_box_in_frustum(corners, 8, _simulator))
+            continue;
         glLoadMatrixf(tp.transformation);
-        glBindBuffer(GL_ARRAY_BUFFER, tp_buf_vertex[i]);
-        glEnableClientState(GL_VERTEX_ARRAY);
-        glVertexPointer(3, GL_FLOAT, 0, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, tp_buf_normal[i]);
-        glEnableClientState(GL_NORMAL_ARRAY);
-        glNormalPointer(GL_FLOAT, 0, 0);
-        if (tp.color_array.empty()) {
-            glDisableClientState(GL_COLOR_ARRAY);
-        } else {
-            glBindBuffer(GL_ARRAY_BUFFER, tp_buf_color[i]);
-            glEnableClientState(GL_COLOR_ARRAY);
-            glColorPointer(4, GL_FLOAT, 0, 0);
+        if (!occlusion_culling) {
+            draw_patch(tp, *bufs[i]);
+            patch_state[i] = 1;
+        } else if (_patch_visible[i] || bounding_box_crosses_near_plane(corners, _simulator)) {
+            glBeginQuery(GL_SAMPLES_PASSED, _patch_queries[i]);
+            draw_patch(tp, *bufs[i]);
+            glEndQuery(GL_SAMPLES_PASSED);
+            patch_state[i] = 1;
+        }
+    }
+    if (occlusion_culling) {
+        // Test the bounding boxes of the remaining patches against the depth buffer
+        // that was filled by the patches drawn so far.
+        glUseProgram(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDisable(GL_CULL_FACE);
+        for (unsigned int i = 0; i < scene.size(); i++) {
+            const TrianglePatch& tp = scene[i];
+            if (tp.vertex_array.empty() || patch_state[i] == 1 || _patch_visible[i])
+                continue;
+            float corners[8][3];
+            get_bounding_box_corners(tp.bounding_box, tp.transformation, corners);
+            if (!bounding_box_in_frustum(corners, 8, _simulator))
+                continue;
+            glLoadMatrixf(tp.transformation);
+            glBeginQuery(GL_SAMPLES_PASSED, _patch_queries[i]);
+            draw_bounding_box(tp.bounding_box);
+            glEndQuery(GL_SAMPLES_PASSED);
+            patch_state[i] = 2;
         }
-        if (tp.texcoord_array.empty()) {
-            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-        } else {
-            glBindBuffer(GL_ARRAY_BUFFER, tp_buf_texcoord[i]);
-            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-            glTexCoordPointer(2, GL_FLOAT, 0, 0);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_CULL_FACE);
+        glUseProgram(_simple_prg);
+        // Draw the patches whose bounding box turned out to be visible. The GPU
+        // decides this via conditional rendering, so that we do not wait for the
+        // query results here; without conditional rendering, all tested patches
+        // are drawn. The query results are read in the next sample.
+        bool conditional_render = GLEW_VERSION_3_0;
+        for (unsigned int i = 0; i < scene.size(); i++) {
+            const TrianglePatch& tp = scene[i];
+            if (patch_state[i] == 2) {
+                glLoadMatrixf(tp.transformation);
+                if (conditional_render)
+                    glBeginConditionalRender(_patch_queries[i], GL_QUERY_WAIT);
+                draw_patch(tp, *bufs[i]);
+                if (conditional_render)
+                    glEndConditionalRender();
+            }
         }
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tp_buf_index[i]);
-        glDrawElements(GL_TRIANGLES, tp.index_array.size(), GL_UNSIGNED_INT, 0);
     }
+    // Remember which patches have query results for the next sample. Culled
+    // patches were not visible.
+    for (unsigned int i = 0; i < scene.size(); i++) {
+        _patch_queried[i] = (occlusion_culling && patch_state[i] != 0 ? 1 : 0);
+        if (patch_state[i] == 0)
+            _patch_visible[i] = 0;
+        else if (!occlusion_culling)
+            _patch_visible[i] = 1;
+    }
+    assert(xglCheckError(XGL_HERE));
+}
+
+void SimWidget::raycast_oversampled_map(int scene_id, const std::vector<TrianglePatch>& scene, int phase_index)
+{
+    int w = _simulator.map_width();
+    int h = _simulator.map_height();
+    // The subpixel factors are computed on the GPU; read them back when they changed
+    if (_subpixel_factor_readback_revision != _subpixel_factor_revision) {
+        _subpixel_factor.resize(w * h);
+        glBindTexture(GL_TEXTURE_2D, _subpixel_factor_tex);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, &(_subpixel_factor[0]));
+        _subpixel_factor_readback_revision = _subpixel_factor_revision;
+    }
+    // Trace the rays on the CPU and upload the result
+    _raycaster.update(scene_id, scene);
+    _raycaster.render(_simulator, phase_index, _subpixel_factor, _raycast_maps);
+    for (int f = 0; f < _simulator.modulation_frequencies(); f++) {
+        glBindTexture(GL_TEXTURE_2D, _oversampled_map_texs[f]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_FLOAT, &(_raycast_maps[f][0]));
+    }
+    assert(xglCheckError(XGL_HERE));
 }
 
 void SimWidget::render_map(int scene_id, const std::vector<TrianglePatch>& scene, int phase_index)
@@ -275,23 +563,35 @@ void SimWidget::render_map(int scene_id, const std::vector<TrianglePatch>& scene
     makeCurrent();
     glClearColor(0.0, 0.0, 0.0, 0.0);
 
-    // First, make sure that the oversampled map is correct
+    // First, make sure that the oversampled maps are correct
+    int frequencies = _simulator.modulation_frequencies();
     if (_oversampled_map_width != _simulator.map_width()
-            || _oversampled_map_height != _simulator.map_height()) {
-        glDeleteTextures(1, &_oversampled_map_tex);
-        _oversampled_map_tex = create_tex2d(GL_RGBA32F, _simulator.map_width(), _simulator.map_height());
+            || _oversampled_map_height != _simulator.map_height()
+            || _oversampled_map_frequencies != frequencies) {
+        glDeleteTextures(Simulator::max_modulation_frequencies, _oversampled_map_texs);
+        for (int f = 0; f < Simulator::max_modulation_frequencies; f++)
+            _oversampled_map_texs[f] = (f < frequencies
+                    ? create_tex2d(GL_RGBA32F, _simulator.map_width(), _simulator.map_height()) : 0);
         if (_depthbuffer == 0)
             glGenRenderbuffers(1, &_depthbuffer);
         glBindRenderbuffer(GL_RENDERBUFFER, _depthbuffer);
         glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, _simulator.map_width(), _simulator.map_height());
         _oversampled_map_width = _simulator.map_width();
         _oversampled_map_height = _simulator.map_height();
+        _oversampled_map_frequencies = frequencies;
     }
     // Set up framebuffer, viewport, and projection matrix
     if (_fbo == 0)
         glGenFramebuffers(1, &_fbo);
+    update_subpixel_factor_map();
     glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _oversampled_map_tex, 0);
+    // The scene is rendered once into one render target per modulation frequency
+    GLenum draw_buffers[Simulator::max_modulation_frequencies];
+    for (int f = 0; f < frequencies; f++) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + f, GL_TEXTURE_2D, _oversampled_map_texs[f], 0);
+        draw_buffers[f] = GL_COLOR_ATTACHMENT0 + f;
+    }
+    glDrawBuffers(frequencies, draw_buffers);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _depthbuffer);
     assert(xglCheckFBO(XGL_HERE));
     glViewport(0, 0, _simulator.map_width(), _simulator.map_height());
@@ -307,9 +607,22 @@ void SimWidget::render_map(int scene_id, const std::vector<TrianglePatch>& scene
     glEnable(GL_CULL_FACE);
 
     // Now render the scene into the oversampled map
-    render_oversampled_map(scene_id, scene, phase_index);
+    _stage_timer.begin(Stats::stage_render_oversampled_map);
+    if (_simulator.rendering_method == 1) {
+        raycast_oversampled_map(scene_id, scene, phase_index);
+    } else {
+        _stage_timer.begin_counting();
+        render_oversampled_map(scene_id, scene, phase_index);
+        _stage_timer.end_counting();
+    }
+    _stage_timer.end();
+    // All following passes use a single render target
+    for (int f = 1; f < frequencies; f++)
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + f, GL_TEXTURE_2D, 0, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
 
     // Reduce spatially oversampled map to sensor resolution
+    _stage_timer.begin(Stats::stage_reduction);
     if (_pixel_map_w != _simulator.pixel_width || _pixel_map_h != _simulator.pixel_height
             || _pixel_mask_x < _simulator.pixel_mask_x || _pixel_mask_x > _simulator.pixel_mask_x
             || _pixel_mask_y < _simulator.pixel_mask_y || _pixel_mask_y > _simulator.pixel_mask_y
@@ -346,17 +659,15 @@ void SimWidget::render_map(int scene_id, const std::vector<TrianglePatch>& scene
                 GL_RED, GL_FLOAT, pixel_map);
         delete[] pixel_map;
     }
-    if (_map_width != _simulator.sensor_width || _map_height != _simulator.sensor_height) {
-        glDeleteTextures(1, &_map_tex);
-        _map_tex = create_tex2d(GL_RGBA32F, _simulator.sensor_width, _simulator.sensor_height);
+    if (_map_width != _simulator.sensor_width || _map_height != _simulator.sensor_height
+            || _map_frequencies != frequencies) {
+        glDeleteTextures(Simulator::max_modulation_frequencies, _map_texs);
+        for (int f = 0; f < Simulator::max_modulation_frequencies; f++)
+            _map_texs[f] = (f < frequencies
+                    ? create_tex2d(GL_RGBA32F, _simulator.sensor_width, _simulator.sensor_height) : 0);
         _map_width = _simulator.sensor_width;
         _map_height = _simulator.sensor_height;
-    }
-    if (_reduction_prg == 0) {
-        GLuint fshader = xglCompileShader(GL_FRAGMENT_SHADER, REDUCTION_FS_GLSL_STR, XGL_HERE);
-        _reduction_prg = xglCreateProgram(0, 0, fshader);
-        xglLinkProgram(_reduction_prg);
-        assert(xglCheckError(XGL_HERE));
+        _map_frequencies = frequencies;
     }
     glUseProgram(_reduction_prg);
     glUniform1i(glGetUniformLocation(_reduction_prg, "oversampled_map_tex"), 0);
@@ -365,104 +676,178 @@ void SimWidget::render_map(int scene_id, const std::vector<TrianglePatch>& scene
     glUniform1i(glGetUniformLocation(_reduction_prg, "pixel_height"), _simulator.pixel_height);
     glUniform2f(glGetUniformLocation(_reduction_prg, "subpixel_size"),
             1.0f / _simulator.map_width(), 1.0f / _simulator.map_height());
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _map_tex, 0);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
     glViewport(0, 0, _simulator.map_width() / _simulator.pixel_width, _simulator.map_height() / _simulator.pixel_height);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    assert(xglCheckFBO(XGL_HERE));
-    assert(xglCheckError(XGL_HERE));
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, _oversampled_map_tex);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, _pixel_map_tex);
-    render_one_to_one();
+    for (int f = 0; f < frequencies; f++) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _map_texs[f], 0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        assert(xglCheckFBO(XGL_HERE));
+        assert(xglCheckError(XGL_HERE));
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, _oversampled_map_texs[f]);
+        render_one_to_one();
+    }
+    _stage_timer.end();
     assert(xglCheckError(XGL_HERE));
 }
 
-void SimWidget::simulate_phase_img(int phase_index, int exposure_time_sample_index)
+void SimWidget::simulate_phase_img(int phase_index, int exposure_time_sample_index, unsigned int frame)
 {
-    assert(phase_index >= 0 && phase_index < 4);
+    assert(phase_index >= 0 && phase_index < Simulator::phases);
     assert(exposure_time_sample_index >= 0);
 
     makeCurrent();
     assert(_fbo != 0); // must have been created in render_map()
+    _stage_timer.begin(Stats::stage_simulate_phase_img);
 
-    if (_phase_w != _simulator.sensor_width || _phase_h != _simulator.sensor_height) {
+    int frequencies = _simulator.modulation_frequencies();
+    if (_phase_w != _simulator.sensor_width || _phase_h != _simulator.sensor_height
+            || _phase_frequencies != frequencies) {
         _phase_w = _simulator.sensor_width;
         _phase_h = _simulator.sensor_height;
-        for (int i = 0; i < 4; i++) {
-            glDeleteTextures(3, _phase_texs[i]);
-            for (int j = 0; j < 2; j++)
-                _phase_texs[i][j] = create_tex2d(GL_RGBA32F, _phase_w, _phase_h);
+        _phase_frequencies = frequencies;
+        for (int f = 0; f < Simulator::max_modulation_frequencies; f++) {
+            for (int i = 0; i < Simulator::phases; i++) {
+                glDeleteTextures(2, _phase_texs[f][i]);
+                for (int j = 0; j < 2; j++)
+                    _phase_texs[f][i][j] = (f < frequencies ? create_tex2d(GL_RGBA32F, _phase_w, _phase_h) : 0);
+                _phase_texs_index[f][i] = -1;
+            }
         }
     }
-    if (_phase_add_prg == 0) {
-        GLuint fshader = xglCompileShader(GL_FRAGMENT_SHADER, SIMPHASEADD_FS_GLSL_STR, XGL_HERE);
-        _phase_add_prg = xglCreateProgram(0, 0, fshader);
-        xglLinkProgram(_phase_add_prg);
-        glUseProgram(_phase_add_prg);
-        glUniform1i(glGetUniformLocation(_phase_add_prg, "phase_tex_0"), 0);
-        glUniform1i(glGetUniformLocation(_phase_add_prg, "phase_tex_1"), 1);
-    }
 
     /* Add the most recent map to the accumulated phase image using the ping-pong buffer */
-    int pp_prv = (exposure_time_sample_index == 0 ? 1 : _phase_texs_index[phase_index]); // previously written ping-pong buffer
-    int pp_cur = (pp_prv == 1 ? 0 : 1);          // currently written ping-pong buffer
     glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _phase_texs[phase_index][pp_cur], 0);
     glViewport(0, 0, _simulator.sensor_width, _simulator.sensor_height);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, _phase_texs[phase_index][pp_prv]);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, _map_tex);
     glUseProgram(_phase_add_prg);
     glUniform1i(glGetUniformLocation(_phase_add_prg, "have_phase_tex_0"),
             (exposure_time_sample_index == 0 ? 0 : 1));
-    assert(xglCheckFBO(XGL_HERE));
-    assert(xglCheckError(XGL_HERE));
-    render_one_to_one();
-    assert(xglCheckError(XGL_HERE));
-    _phase_texs_index[phase_index] = pp_cur;
+    for (int f = 0; f < frequencies; f++) {
+        int pp_prv = (exposure_time_sample_index == 0 ? 1 : _phase_texs_index[f][phase_index]); // previously written ping-pong buffer
+        int pp_cur = (pp_prv == 1 ? 0 : 1);          // currently written ping-pong buffer
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _phase_texs[f][phase_index][pp_cur], 0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, _phase_texs[f][phase_index][pp_prv]);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, _map_texs[f]);
+        assert(xglCheckFBO(XGL_HERE));
+        assert(xglCheckError(XGL_HERE));
+        render_one_to_one();
+        assert(xglCheckError(XGL_HERE));
+        _phase_texs_index[f][phase_index] = pp_cur;
+    }
+
+    /* Add sensor noise to the complete phase image, again using the ping-pong buffer */
+    if (_simulator.noise_model == 1 && exposure_time_sample_index == _simulator.exposure_time_samples - 1) {
+        assert(have_noise_model());
+        if (_noise_prg == 0) {
+            std::vector<ProgramSource> programs(1);
+            programs[0].prg = &_noise_prg;
+            programs[0].vs_src = NULL;
+            programs[0].fs_src = NOISE_FS_GLSL_STR;
+            programs[0].where = XGL_HERE;
+            build_programs(programs);
+            glUseProgram(_noise_prg);
+            glUniform1i(glGetUniformLocation(_noise_prg, "phase_tex"), 0);
+        }
+        glUseProgram(_noise_prg);
+        glUniform1ui(glGetUniformLocation(_noise_prg, "seed"), _simulator.noise_seed);
+        glUniform1ui(glGetUniformLocation(_noise_prg, "frame"), frame);
+        glUniform1f(glGetUniformLocation(_noise_prg, "electrons_per_energy"), _simulator.electrons_per_zeptojoule());
+        glUniform1f(glGetUniformLocation(_noise_prg, "dark_electrons"), _simulator.dark_electrons());
+        glUniform1f(glGetUniformLocation(_noise_prg, "read_noise"), _simulator.read_noise);
+        glActiveTexture(GL_TEXTURE0);
+        for (int f = 0; f < frequencies; f++) {
+            int pp_prv = _phase_texs_index[f][phase_index];
+            int pp_cur = (pp_prv == 1 ? 0 : 1);
+            glUniform1ui(glGetUniformLocation(_noise_prg, "stream"), noise_stream(phase_index, f));
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _phase_texs[f][phase_index][pp_cur], 0);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glBindTexture(GL_TEXTURE_2D, _phase_texs[f][phase_index][pp_prv]);
+            assert(xglCheckFBO(XGL_HERE));
+            assert(xglCheckError(XGL_HERE));
+            render_one_to_one();
+            assert(xglCheckError(XGL_HERE));
+            _phase_texs_index[f][phase_index] = pp_cur;
+        }
+    }
+    _stage_timer.end();
 }
 
 void SimWidget::simulate_result()
 {
     makeCurrent();
     assert(_fbo != 0);  // must have been initialized by simulate_phase()
-    if (_result_prg == 0) {
-        GLuint fshader = xglCompileShader(GL_FRAGMENT_SHADER, SIMRESULT_FS_GLSL_STR, XGL_HERE);
-        _result_prg = xglCreateProgram(0, 0, fshader);
-        xglLinkProgram(_result_prg);
-        glUseProgram(_result_prg);
-        GLint phase_tex_vals[4] = { 0, 1, 2, 3 };
-        glUniform1iv(glGetUniformLocation(_result_prg, "phase_texs"), 4, phase_tex_vals);
-        assert(xglCheckError(XGL_HERE));
-    }
-    if (_result_w != _simulator.sensor_width || _result_h != _simulator.sensor_height) {
-        glDeleteTextures(1, &_result_tex);
-        _result_tex = create_tex2d(GL_RGB32F, _simulator.sensor_width, _simulator.sensor_height);
+    _stage_timer.begin(Stats::stage_simulate_result);
+    int frequencies = _simulator.modulation_frequencies();
+    if (_result_w != _simulator.sensor_width || _result_h != _simulator.sensor_height
+            || _result_frequencies != frequencies) {
+        glDeleteTextures(Simulator::max_modulation_frequencies, _result_texs);
+        for (int f = 0; f < Simulator::max_modulation_frequencies; f++)
+            _result_texs[f] = (f < frequencies
+                    ? create_tex2d(GL_RGB32F, _simulator.sensor_width, _simulator.sensor_height) : 0);
         _result_w = _simulator.sensor_width;
         _result_h = _simulator.sensor_height;
+        _result_frequencies = frequencies;
         assert(xglCheckError(XGL_HERE));
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _result_tex, 0);
     glViewport(0, 0, _simulator.sensor_width, _simulator.sensor_height);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, get_phase(0));
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, get_phase(1));
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, get_phase(2));
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, get_phase(3));
     glUseProgram(_result_prg);
-    glUniform1f(glGetUniformLocation(_result_prg, "frac_c_modfreq"),
-            static_cast<double>(Simulator::c) / _simulator.modulation_frequency);
+    for (int f = 0; f < frequencies; f++) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _result_texs[f], 0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        for (int i = 0; i < Simulator::phases; i++) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, get_phase(i, f));
+        }
+        glUniform1f(glGetUniformLocation(_result_prg, "frac_c_modfreq"),
+                static_cast<double>(Simulator::c) / _simulator.get_modulation_frequency(f));
+        assert(xglCheckFBO(XGL_HERE));
+        assert(xglCheckError(XGL_HERE));
+        render_one_to_one();
+        assert(xglCheckError(XGL_HERE));
+    }
 
+    if (frequencies > 1)
+        unwrap_result();
+    _stage_timer.end();
+}
+
+void SimWidget::unwrap_result()
+{
+    int frequencies = _simulator.modulation_frequencies();
+    if (_unwrapped_w != _simulator.sensor_width || _unwrapped_h != _simulator.sensor_height) {
+        glDeleteTextures(1, &_unwrapped_tex);
+        _unwrapped_tex = create_tex2d(GL_RGB32F, _simulator.sensor_width, _simulator.sensor_height);
+        _unwrapped_w = _simulator.sensor_width;
+        _unwrapped_h = _simulator.sensor_height;
+        assert(xglCheckError(XGL_HERE));
+    }
+
+    // Only search the wraps that can occur between the clip planes
+    float ambiguity_range[Simulator::max_modulation_frequencies];
+    for (int f = 0; f < frequencies; f++)
+        ambiguity_range[f] = _simulator.ambiguity_range(f);
+    float max_depth = std::min(_simulator.extended_ambiguity_range(), _simulator.far_plane);
+    int max_wraps = std::max(1, static_cast<int>(std::ceil(max_depth / ambiguity_range[0])));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _unwrapped_tex, 0);
+    glViewport(0, 0, _simulator.sensor_width, _simulator.sensor_height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    for (int f = 0; f < frequencies; f++) {
+        glActiveTexture(GL_TEXTURE0 + f);
+        glBindTexture(GL_TEXTURE_2D, _result_texs[f]);
+    }
+    glUseProgram(_unwrap_prg);
+    glUniform1i(glGetUniformLocation(_unwrap_prg, "frequencies"), frequencies);
+    glUniform1fv(glGetUniformLocation(_unwrap_prg, "ambiguity_range"), frequencies, ambiguity_range);
+    glUniform1i(glGetUniformLocation(_unwrap_prg, "max_wraps"), max_wraps);
     assert(xglCheckFBO(XGL_HERE));
     assert(xglCheckError(XGL_HERE));
     render_one_to_one();
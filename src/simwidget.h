@@ -13,6 +13,9 @@
 
 #include "glwidget.h"
 #include "trianglepatch.h"
+#include "gpuscenecache.h"
+#include "raycaster.h"
+#include "stagetimer.h"
 
 
 class SimWidget : public GLWidget
@@ -26,37 +29,80 @@ private:
     int _pixel_map_w, _pixel_map_h;
     GLuint _pixel_map_tex;
 
-    GLuint _oversampled_map_tex;
-    int _oversampled_map_width, _oversampled_map_height;
+    // Per modulation frequency, all computed from the same rendered geometry
+    GLuint _oversampled_map_texs[Simulator::max_modulation_frequencies];
+    int _oversampled_map_width, _oversampled_map_height, _oversampled_map_frequencies;
 
     GLuint _simple_prg;
     std::string _simple_prg_current_table;
     GLuint _simple_prg_table;
+    GLuint _subpixel_factor_prg;
+    GLuint _subpixel_factor_tex;                // per subpixel: light source intensity * lens constant * cos^4
+    std::vector<float> _subpixel_factor_params; // simulator parameters that _subpixel_factor_tex was computed for
+    int _subpixel_factor_revision;              // incremented whenever _subpixel_factor_tex is recomputed
+    void update_subpixel_factor_map();
+    GPUSceneCache _scene_cache;
+    int _patch_visibility_scene_id;
+    std::vector<unsigned char> _patch_visible;  // for occlusion culling: was the patch visible in the last sample?
+    std::vector<GLuint> _patch_queries;         // for occlusion culling: one occlusion query per patch
+    std::vector<unsigned char> _patch_queried;  // for occlusion culling: was the query issued in the last sample?
     void render_oversampled_map(int scene_id, const std::vector<TrianglePatch>& scene, int phase_index);
 
+    RayCaster _raycaster;
+    std::vector<float> _subpixel_factor;                // CPU copy of _subpixel_factor_tex for ray casting
+    int _subpixel_factor_readback_revision;             // revision of _subpixel_factor_tex that _subpixel_factor was read from
+    std::vector<float> _raycast_maps[Simulator::max_modulation_frequencies];
+    void raycast_oversampled_map(int scene_id, const std::vector<TrianglePatch>& scene, int phase_index);
+
     GLuint _reduction_prg;
-    int _map_width, _map_height;
-    GLuint _map_tex;
+    int _map_width, _map_height, _map_frequencies;
+    GLuint _map_texs[Simulator::max_modulation_frequencies];
 
     GLuint _phase_add_prg;
-    int _phase_w, _phase_h;
-    GLuint _phase_texs[4][2]; // four phase images, with ping-pong buffers
-    int _phase_texs_index[4]; // index of most recently written ping-pong buffer (0 or 1)
+    GLuint _noise_prg;                          // built on first use; needs GLSL 1.30
+    int _phase_w, _phase_h, _phase_frequencies;
+    // per frequency: phase images, with ping-pong buffers
+    GLuint _phase_texs[Simulator::max_modulation_frequencies][Simulator::phases][2];
+    // per frequency: index of most recently written ping-pong buffer (0 or 1)
+    int _phase_texs_index[Simulator::max_modulation_frequencies][Simulator::phases];
 
     GLuint _result_prg;
-    int _result_w, _result_h;
-    GLuint _result_tex;
+    int _result_w, _result_h, _result_frequencies;
+    GLuint _result_texs[Simulator::max_modulation_frequencies];
+
+    GLuint _unwrap_prg;
+    int _unwrapped_w, _unwrapped_h;
+    GLuint _unwrapped_tex;
+    void unwrap_result();
+
+    StageTimer _stage_timer;
 
 public:
     SimWidget();
+    ~SimWidget();
 
-    GLuint get_map() const;
-    GLuint get_phase(int index) const;
-    GLuint get_result() const;
+    // Whether the OpenGL implementation supports noise model 1 (needs GLSL 1.30).
+    // Simulators using it must be rejected otherwise.
+    bool have_noise_model() const;
+
+    GLuint get_map(int frequency = 0) const;
+    GLuint get_phase(int index, int frequency = 0) const;
+    GLuint get_result(int frequency = 0) const;
+    // The result with the depth unwrapped using all modulation frequencies.
+    // Only valid if more than one modulation frequency is used.
+    GLuint get_unwrapped_result() const;
 
     void render_map(int scene_id, const std::vector<TrianglePatch>& scene, int phase_index);
-    void simulate_phase_img(int phase_index, int exposure_time_sample_index);
+    // The frame number selects the random numbers of the noise model. After the last
+    // exposure time sample, noise is added to the phase image if enabled.
+    void simulate_phase_img(int phase_index, int exposure_time_sample_index, unsigned int frame);
     void simulate_result();
+
+    // Measure the stages of the simulation in the given statistics (or not at all,
+    // if NULL). collect_stats() adds the GPU results of all work done since the last
+    // call; call it after reading back the results of a frame.
+    void set_stats(Stats* stats);
+    void collect_stats();
 };
 
 #endif
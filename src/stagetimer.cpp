@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#include <cassert>
+
+#include <GL/glew.h>
+
+#include "stagetimer.h"
+
+
+StageTimer::StageTimer() :
+    _stats(NULL), _initialized(false),
+    _have_timer_queries(false), _have_primitive_queries(false), _have_fragment_queries(false),
+    _stage(Stats::stages), _stage_start(0), _queries_used(0)
+{
+}
+
+StageTimer::~StageTimer()
+{
+    // The GL context may be gone already, so we cannot release queries here.
+    // Call clear() while the context is still current.
+}
+
+void StageTimer::set_stats(Stats* stats)
+{
+    _stats = stats;
+}
+
+void StageTimer::initialize()
+{
+    _have_timer_queries = (GLEW_ARB_timer_query || GLEW_VERSION_3_3);
+    _have_primitive_queries = (GLEW_EXT_transform_feedback || GLEW_VERSION_3_0);
+#ifdef GL_ARB_pipeline_statistics_query
+    _have_fragment_queries = GLEW_ARB_pipeline_statistics_query;
+#endif
+    _timer.start();
+    _initialized = true;
+}
+
+size_t StageTimer::get_query()
+{
+    if (_queries_used == _queries.size()) {
+        GLuint q;
+        glGenQueries(1, &q);
+        _queries.push_back(q);
+    }
+    return _queries_used++;
+}
+
+GLuint64 StageTimer::get_query_result(size_t index)
+{
+    // 64 bit results need GL 3.3 or ARB_timer_query
+    if (_have_timer_queries) {
+        GLuint64 result;
+        glGetQueryObjectui64v(_queries[index], GL_QUERY_RESULT, &result);
+        return result;
+    } else {
+        GLuint result;
+        glGetQueryObjectuiv(_queries[index], GL_QUERY_RESULT, &result);
+        return result;
+    }
+}
+
+void StageTimer::begin(Stats::stage_t stage)
+{
+    if (!_stats)
+        return;
+    if (!_initialized)
+        initialize();
+    assert(_stage == Stats::stages);
+    _stage = stage;
+    if (_have_timer_queries) {
+        size_t q = get_query();
+        get_query();
+        glQueryCounter(_queries[q], GL_TIMESTAMP);
+        _timestamp_queries.push_back(std::make_pair(stage, q));
+    }
+    _stage_start = _timer.nsecsElapsed();
+}
+
+void StageTimer::end()
+{
+    if (!_stats)
+        return;
+    assert(_stage != Stats::stages);
+    _stats->add_cpu_time(_stage, (_timer.nsecsElapsed() - _stage_start) / 1e3);
+    if (_have_timer_queries)
+        glQueryCounter(_queries[_timestamp_queries.back().second + 1], GL_TIMESTAMP);
+    _stage = Stats::stages;
+}
+
+void StageTimer::begin_counting()
+{
+    if (!_stats)
+        return;
+    if (!_initialized)
+        initialize();
+    if (_have_primitive_queries) {
+        size_t q = get_query();
+        glBeginQuery(GL_PRIMITIVES_GENERATED, _queries[q]);
+        _triangle_queries.push_back(q);
+    }
+#ifdef GL_ARB_pipeline_statistics_query
+    if (_have_fragment_queries) {
+        size_t q = get_query();
+        glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, _queries[q]);
+        _fragment_queries.push_back(q);
+    }
+#endif
+}
+
+void StageTimer::end_counting()
+{
+    if (!_stats)
+        return;
+    if (_have_primitive_queries)
+        glEndQuery(GL_PRIMITIVES_GENERATED);
+#ifdef GL_ARB_pipeline_statistics_query
+    if (_have_fragment_queries)
+        glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+#endif
+}
+
+void StageTimer::collect()
+{
+    if (!_stats)
+        return;
+    for (size_t i = 0; i < _timestamp_queries.size(); i++) {
+        GLuint64 t0 = get_query_result(_timestamp_queries[i].second);
+        GLuint64 t1 = get_query_result(_timestamp_queries[i].second + 1);
+        _stats->add_gpu_time(_timestamp_queries[i].first, (t1 - t0) / 1e3);
+    }
+    if (!_triangle_queries.empty()) {
+        GLuint64 sum = 0;
+        for (size_t i = 0; i < _triangle_queries.size(); i++)
+            sum += get_query_result(_triangle_queries[i]);
+        _stats->add_counter(Stats::counter_triangles, sum);
+    }
+    if (!_fragment_queries.empty()) {
+        GLuint64 sum = 0;
+        for (size_t i = 0; i < _fragment_queries.size(); i++)
+            sum += get_query_result(_fragment_queries[i]);
+        _stats->add_counter(Stats::counter_fragments, sum);
+    }
+    _timestamp_queries.clear();
+    _triangle_queries.clear();
+    _fragment_queries.clear();
+    _queries_used = 0;
+}
+
+void StageTimer::clear()
+{
+    if (!_queries.empty())
+        glDeleteQueries(_queries.size(), &(_queries[0]));
+    _queries.clear();
+    _timestamp_queries.clear();
+    _triangle_queries.clear();
+    _fragment_queries.clear();
+    _queries_used = 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef STAGETIMER_H
+#define STAGETIMER_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include <QElapsedTimer>
+
+#include "stats.h"
+
+
+/* Measures the pipeline stages that run in one OpenGL context, and adds the
+ * results to a Stats object. Without a Stats object, nothing is measured.
+ *
+ * Between begin() and end(), the CPU time is measured, and the GPU time is
+ * measured with timestamp queries if they are supported. Stages must not
+ * overlap. Between begin_counting() and end_counting(), the primitives (with
+ * GL 3.0 or EXT_transform_feedback) and the fragment shader invocations (with
+ * ARB_pipeline_statistics_query) are counted; without support, nothing is
+ * counted.
+ *
+ * Query results are only read in collect(), which counts everything since the
+ * last call as one frame. Call it when the GPU has finished the work anyway,
+ * e.g. after reading back the results, so that it does not stall the pipeline.
+ * All functions must be called with the context current. */
+
+class StageTimer
+{
+private:
+    Stats* _stats;
+    bool _initialized;
+    bool _have_timer_queries;
+    bool _have_primitive_queries;
+    bool _have_fragment_queries;
+    QElapsedTimer _timer;
+    Stats::stage_t _stage;
+    qint64 _stage_start;
+    std::vector<GLuint> _queries;       // pool of query objects
+    size_t _queries_used;
+    std::vector<std::pair<Stats::stage_t, size_t> > _timestamp_queries; // stage, index of first of two queries
+    std::vector<size_t> _triangle_queries;
+    std::vector<size_t> _fragment_queries;
+
+    void initialize();
+    size_t get_query();
+    GLuint64 get_query_result(size_t index);
+
+public:
+    StageTimer();
+    ~StageTimer();
+
+    void set_stats(Stats* stats);
+
+    void begin(Stats::stage_t stage);
+    void end();
+    void begin_counting();
+    void end_counting();
+    void collect();
+
+    // Release the query objects
+    void clear();
+};
+
+#endif
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#include <cstdio>
+#include <cmath>
+#include <cerrno>
+#include <algorithm>
+#include <system_error>
+
+#include <QMutexLocker>
+
+#include "stats.h"
+
+
+Stats::Stats(size_t max_recent) : _max_recent(max_recent), _keep_totals(false)
+{
+}
+
+const char* Stats::stage_name(stage_t stage)
+{
+    static const char* names[stages] = {
+        "draw_frame",
+        "capture_scene",
+        "render_oversampled_map",
+        "reduction",
+        "simulate_phase_img",
+        "simulate_result",
+        "get_sim_data",
+        "export_worker"
+    };
+    return names[stage];
+}
+
+const char* Stats::counter_name(counter_t counter)
+{
+    static const char* names[counters] = {
+        "triangles",
+        "fragments"
+    };
+    return names[counter];
+}
+
+void Stats::set_keep_totals(bool keep_totals)
+{
+    QMutexLocker locker(&_mutex);
+    _keep_totals = keep_totals;
+}
+
+void Stats::add_cpu_time(stage_t stage, double usecs)
+{
+    QMutexLocker locker(&_mutex);
+    _cpu_times[stage].add(usecs, _max_recent, _keep_totals);
+}
+
+void Stats::add_gpu_time(stage_t stage, double usecs)
+{
+    QMutexLocker locker(&_mutex);
+    _gpu_times[stage].add(usecs, _max_recent, _keep_totals);
+}
+
+void Stats::add_counter(counter_t counter, double value)
+{
+    QMutexLocker locker(&_mutex);
+    _counters[counter].add(value, _max_recent, _keep_totals);
+}
+
+void Stats::clear()
+{
+    QMutexLocker locker(&_mutex);
+    for (int i = 0; i < stages; i++) {
+        _cpu_times[i] = Series();
+        _gpu_times[i] = Series();
+    }
+    for (int i = 0; i < counters; i++)
+        _counters[i] = Series();
+}
+
+// Histogram bins grow by 2% each, so that the center of a bin is within 1% of
+// all values in it. Values below 1 share the first bin.
+static const double histogram_base = 1.02;
+
+static size_t histogram_bin(double value)
+{
+    return (value < 1.0 ? 0 : static_cast<size_t>(std::log(value) / std::log(histogram_base)) + 1);
+}
+
+static double histogram_bin_center(size_t bin)
+{
+    return (bin == 0 ? 0.5 : std::pow(histogram_base, bin - 0.5));
+}
+
+void Stats::Series::add(double value, size_t max_recent, bool keep_totals)
+{
+    if (recent.size() < max_recent) {
+        recent.push_back(value);
+    } else if (max_recent > 0) {
+        recent[recent_next] = value;
+        recent_next = (recent_next + 1) % max_recent;
+    }
+    if (keep_totals) {
+        count++;
+        sum += value;
+        size_t bin = histogram_bin(value);
+        if (bin >= histogram.size())
+            histogram.resize(bin + 1, 0);
+        histogram[bin]++;
+    }
+}
+
+// Nearest-rank percentile; reorders the samples
+static double percentile(std::vector<double>& samples, double p)
+{
+    size_t k = static_cast<size_t>(std::ceil(p * samples.size()));
+    if (k > 0)
+        k--;
+    std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
+
+Stats::Summary Stats::Series::recent_summary() const
+{
+    Summary summary;
+    summary.samples = recent.size();
+    summary.mean = 0.0;
+    summary.p50 = 0.0;
+    summary.p99 = 0.0;
+    if (!recent.empty()) {
+        std::vector<double> s(recent);
+        double sum = 0.0;
+        for (size_t i = 0; i < s.size(); i++)
+            sum += s[i];
+        summary.mean = sum / s.size();
+        summary.p50 = percentile(s, 0.50);
+        summary.p99 = percentile(s, 0.99);
+    }
+    return summary;
+}
+
+// Nearest-rank percentile from the histogram
+static double histogram_percentile(const std::vector<unsigned long long>& histogram,
+        unsigned long long count, double p)
+{
+    unsigned long long rank = static_cast<unsigned long long>(std::ceil(p * count));
+    if (rank == 0)
+        rank = 1;
+    unsigned long long n = 0;
+    for (size_t bin = 0; bin < histogram.size(); bin++) {
+        n += histogram[bin];
+        if (n >= rank)
+            return histogram_bin_center(bin);
+    }
+    return 0.0;
+}
+
+Stats::Summary Stats::Series::total_summary() const
+{
+    Summary summary;
+    summary.samples = count;
+    summary.mean = 0.0;
+    summary.p50 = 0.0;
+    summary.p99 = 0.0;
+    if (count > 0) {
+        summary.mean = sum / count;
+        summary.p50 = histogram_percentile(histogram, count, 0.50);
+        summary.p99 = histogram_percentile(histogram, count, 0.99);
+    }
+    return summary;
+}
+
+Stats::Summary Stats::cpu_summary(stage_t stage, bool total) const
+{
+    QMutexLocker locker(&_mutex);
+    return total ? _cpu_times[stage].total_summary() : _cpu_times[stage].recent_summary();
+}
+
+Stats::Summary Stats::gpu_summary(stage_t stage, bool total) const
+{
+    QMutexLocker locker(&_mutex);
+    return total ? _gpu_times[stage].total_summary() : _gpu_times[stage].recent_summary();
+}
+
+Stats::Summary Stats::counter_summary(counter_t counter, bool total) const
+{
+    QMutexLocker locker(&_mutex);
+    return total ? _counters[counter].total_summary() : _counters[counter].recent_summary();
+}
+
+std::string Stats::to_string() const
+{
+    std::string s;
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-23s %28s %28s\n", "stage",
+            "CPU mean / p50 / p99 [us]", "GPU mean / p50 / p99 [us]");
+    s += line;
+    for (int i = 0; i < stages; i++) {
+        Summary cpu = cpu_summary(static_cast<stage_t>(i));
+        Summary gpu = gpu_summary(static_cast<stage_t>(i));
+        char cpu_str[64] = "-";
+        char gpu_str[64] = "-";
+        if (cpu.samples > 0)
+            std::snprintf(cpu_str, sizeof(cpu_str), "%.0f / %.0f / %.0f", cpu.mean, cpu.p50, cpu.p99);
+        if (gpu.samples > 0)
+            std::snprintf(gpu_str, sizeof(gpu_str), "%.0f / %.0f / %.0f", gpu.mean, gpu.p50, gpu.p99);
+        std::snprintf(line, sizeof(line), "%-23s %28s %28s\n",
+                stage_name(static_cast<stage_t>(i)), cpu_str, gpu_str);
+        s += line;
+    }
+    for (int i = 0; i < counters; i++) {
+        Summary c = counter_summary(static_cast<counter_t>(i));
+        if (c.samples > 0)
+            std::snprintf(line, sizeof(line), "%-23s %.0f / %.0f / %.0f per frame\n",
+                    counter_name(static_cast<counter_t>(i)), c.mean, c.p50, c.p99);
+        else
+            std::snprintf(line, sizeof(line), "%-23s -\n", counter_name(static_cast<counter_t>(i)));
+        s += line;
+    }
+    return s;
+}
+
+static void write_json_summary(FILE* f, const char* name, const Stats::Summary& s, bool last)
+{
+    std::fprintf(f, "      \"%s\": { \"samples\": %lu, \"mean\": %.9g, \"p50\": %.9g, \"p99\": %.9g }%s\n",
+            name, static_cast<unsigned long>(s.samples), s.mean, s.p50, s.p99, last ? "" : ",");
+}
+
+static void write_csv_summary(FILE* f, const char* name, const char* kind, const Stats::Summary& s)
+{
+    std::fprintf(f, "%s,%s,%lu,%.9g,%.9g,%.9g\r\n",
+            name, kind, static_cast<unsigned long>(s.samples), s.mean, s.p50, s.p99);
+}
+
+void Stats::save(const std::string& filename) const
+{
+    bool json = (filename.size() >= 5 && filename.compare(filename.size() - 5, 5, ".json") == 0);
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        throw std::system_error(errno, std::system_category(),
+                std::string("Cannot open ").append(filename));
+    }
+    if (json) {
+        std::fprintf(f, "{\n  \"stages\": {\n");
+        for (int i = 0; i < stages; i++) {
+            std::fprintf(f, "    \"%s\": {\n", stage_name(static_cast<stage_t>(i)));
+            write_json_summary(f, "cpu_us", cpu_summary(static_cast<stage_t>(i), true), false);
+            write_json_summary(f, "gpu_us", gpu_summary(static_cast<stage_t>(i), true), true);
+            std::fprintf(f, "    }%s\n", i < stages - 1 ? "," : "");
+        }
+        std::fprintf(f, "  },\n  \"counters\": {\n");
+        for (int i = 0; i < counters; i++) {
+            std::fprintf(f, "    \"%s\": {\n", counter_name(static_cast<counter_t>(i)));
+            write_json_summary(f, "per_frame", counter_summary(static_cast<counter_t>(i), true), true);
+            std::fprintf(f, "    }%s\n", i < counters - 1 ? "," : "");
+        }
+        std::fprintf(f, "  }\n}\n");
+    } else {
+        std::fprintf(f, "name,kind,samples,mean,p50,p99\r\n");
+        for (int i = 0; i < stages; i++) {
+            write_csv_summary(f, stage_name(static_cast<stage_t>(i)), "cpu_us", cpu_summary(static_cast<stage_t>(i), true));
+            write_csv_summary(f, stage_name(static_cast<stage_t>(i)), "gpu_us", gpu_summary(static_cast<stage_t>(i), true));
+        }
+        for (int i = 0; i < counters; i++)
+            write_csv_summary(f, counter_name(static_cast<counter_t>(i)), "per_frame", counter_summary(static_cast<counter_t>(i), true));
+    }
+    fflush(f);
+    if (ferror(f) || fclose(f) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                std::string("Cannot write ").append(filename));
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <QMutex>
+
+
+/* Performance statistics of the simulation pipeline.
+ *
+ * For each stage, CPU times and (for stages that run on the GPU) GPU times
+ * are collected in microseconds. Additionally, the numbers of primitives and
+ * fragments are counted per simulated frame.
+ *
+ * Only a fixed number of recent samples is kept, for a status display. If
+ * totals are enabled, then the count, sum, and a histogram of all samples
+ * are kept as well, so that a whole batch run can be summarized in constant
+ * memory. The histogram has logarithmic bins, so that the percentiles of
+ * the totals are accurate to about one percent.
+ *
+ * The samples come from the GUI thread, the simulation thread, and the
+ * export workers; all functions are thread-safe. */
+
+class Stats
+{
+public:
+    enum stage_t {
+        stage_draw_frame,
+        stage_capture_scene,            // capture_scene() or update_scene()
+        stage_render_oversampled_map,
+        stage_reduction,
+        stage_simulate_phase_img,
+        stage_simulate_result,
+        stage_get_sim_data,
+        stage_export_worker,
+        stages
+    };
+
+    enum counter_t {
+        counter_triangles,              // primitives drawn per frame
+        counter_fragments,              // fragment shader invocations per frame
+        counters
+    };
+
+    class Summary
+    {
+    public:
+        size_t samples;
+        double mean, p50, p99;
+    };
+
+private:
+    class Series
+    {
+    public:
+        std::vector<double> recent;     // ring buffer
+        size_t recent_next;             // next index to write in the ring buffer
+        unsigned long long count;
+        double sum;
+        std::vector<unsigned long long> histogram;
+
+        Series() : recent_next(0), count(0), sum(0.0) {}
+        void add(double value, size_t max_recent, bool keep_totals);
+        Summary recent_summary() const;
+        Summary total_summary() const;
+    };
+
+    mutable QMutex _mutex;
+    size_t _max_recent;
+    bool _keep_totals;
+    Series _cpu_times[stages];
+    Series _gpu_times[stages];
+    Series _counters[counters];
+
+public:
+    Stats(size_t max_recent = 1000);
+
+    static const char* stage_name(stage_t stage);
+    static const char* counter_name(counter_t counter);
+
+    // Keep the totals of all samples from now on
+    void set_keep_totals(bool keep_totals);
+
+    void add_cpu_time(stage_t stage, double usecs);
+    void add_gpu_time(stage_t stage, double usecs);
+    void add_counter(counter_t counter, double value);
+    void clear();
+
+    // Summaries over the recent samples, or over all samples if total is true
+    // (which requires totals to be enabled). Stages or counters without samples
+    // have samples == 0.
+    Summary cpu_summary(stage_t stage, bool total = false) const;
+    Summary gpu_summary(stage_t stage, bool total = false) const;
+    Summary counter_summary(counter_t counter, bool total = false) const;
+
+    // A human-readable table of the recent samples, e.g. for a status display
+    std::string to_string() const;
+
+    // Write the summaries of the totals. The format is chosen from the file
+    // name extension: JSON for .json, CSV otherwise.
+    void save(const std::string& filename) const;
+};
+
+#endif
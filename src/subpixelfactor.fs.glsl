@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#version 120
+
+// This computes all terms of the sensor irradiance that depend only on the
+// viewing ray through a subpixel, not on the scene. Camera and light source
+// are always in (0,0,0), so this map only changes with the simulator
+// parameters.
+
+uniform float lightsource_intensity;    // light source intensity in milliwatt/steradian
+uniform sampler2D lightsource_intensity_table;
+uniform float lightsource_intensity_table_start_x;
+uniform float lightsource_intensity_table_end_x;
+uniform float lightsource_intensity_table_start_y;
+uniform float lightsource_intensity_table_end_y;
+uniform float frac_apdiam_foclen;       // lens: aperture diameter / focal length
+uniform vec2 frustum_extent;            // x/z and y/z extent of the view frustum at z=-1
+
+const float pi = 3.14159265358979323846;
+
+
+void main(void)
+{
+    // Direction of the viewing ray through the center of this subpixel
+    vec2 ndc = 2.0 * gl_TexCoord[0].xy - 1.0;
+    vec3 p = normalize(vec3(ndc * frustum_extent, -1.0));
+    float cos_theta_sensor = clamp(dot(p, vec3(0.0, 0.0, -1.0)), 0.0, 1.0);
+
+    float li = lightsource_intensity;
+    if (li < 0.0f) { // this means we have to read a measured value
+        vec3 p_xz = normalize(vec3(p.x, 0.0, p.z));
+        float theta_sensor_x = acos(clamp(dot(p_xz, vec3(0.0, 0.0, -1.0)), 0.0, 1.0));
+        if (p.x < 0.0)
+            theta_sensor_x = -theta_sensor_x;
+        float theta_sensor_y = acos(clamp(dot(p, p_xz), 0.0, 1.0));
+        if (p.y < 0.0)
+            theta_sensor_y = -theta_sensor_y;
+        float table_ind_x = (theta_sensor_x - lightsource_intensity_table_start_x) /
+            (lightsource_intensity_table_end_x - lightsource_intensity_table_start_x);
+        float table_ind_y = (theta_sensor_y - lightsource_intensity_table_start_y) /
+            (lightsource_intensity_table_end_y - lightsource_intensity_table_start_y);
+        // swap directions, necessary for plausible orientation of the table
+        table_ind_x = 1.0 - table_ind_x;
+        table_ind_y = 1.0 - table_ind_y;
+        li = texture2D(lightsource_intensity_table, vec2(table_ind_x, table_ind_y)).r;
+    }
+    // li: [mW/sr]
+
+    float factor = li * (pi / 4.0) * (frac_apdiam_foclen * frac_apdiam_foclen)
+        * (cos_theta_sensor * cos_theta_sensor * cos_theta_sensor * cos_theta_sensor);
+
+    gl_FragColor = vec4(factor, 0.0, 0.0, 0.0);
+}
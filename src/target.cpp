@@ -52,6 +52,39 @@ Target::Target(variant_t v) :
 {
 }
 
+bool Target::operator==(const Target& t) const
+{
+    return variant == t.variant
+        && model_filename == t.model_filename
+        && number_of_bars == t.number_of_bars
+        && first_bar_width == t.first_bar_width
+        && first_bar_height == t.first_bar_height
+        && first_offset_x == t.first_offset_x
+        && first_offset_y == t.first_offset_y
+        && first_offset_z == t.first_offset_z
+        && next_bar_width_factor == t.next_bar_width_factor
+        && next_bar_width_offset == t.next_bar_width_offset
+        && next_bar_height_factor == t.next_bar_height_factor
+        && next_bar_height_offset == t.next_bar_height_offset
+        && next_offset_x_factor == t.next_offset_x_factor
+        && next_offset_x_offset == t.next_offset_x_offset
+        && next_offset_y_factor == t.next_offset_y_factor
+        && next_offset_y_offset == t.next_offset_y_offset
+        && next_offset_z_factor == t.next_offset_z_factor
+        && next_offset_z_offset == t.next_offset_z_offset
+        && bar_background_near_side == t.bar_background_near_side
+        && bar_background_dist_near == t.bar_background_dist_near
+        && bar_background_dist_far == t.bar_background_dist_far
+        && bar_rotation == t.bar_rotation
+        && star_spokes == t.star_spokes
+        && star_radius == t.star_radius
+        && star_background_dist_center == t.star_background_dist_center
+        && star_background_dist_rim == t.star_background_dist_rim
+        && background_planar_width == t.background_planar_width
+        && background_planar_height == t.background_planar_height
+        && background_planar_dist == t.background_planar_dist;
+}
+
 void Target::save(const std::string& filename) const
 {
     FILE* f = fopen(filename.c_str(), "wb");
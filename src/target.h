@@ -96,6 +96,9 @@ public:
      */
     Target(variant_t v = variant_star);
 
+    /** \brief Compare all parameters */
+    bool operator==(const Target& t) const;
+
     /** \brief Save target description to a file
      *
      * This throws a std::exception on failure. */
@@ -6,7 +6,12 @@
  * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
  */
 
+#include <cstddef>
+#include <cmath>
+#include <limits>
+
 #include "trianglepatch.h"
+#include "hash.h"
 
 
 TrianglePatch::TrianglePatch() : texture(0)
@@ -14,4 +19,70 @@ TrianglePatch::TrianglePatch() : texture(0)
     for (int i = 0; i < 4; i++)
         for (int j = 0; j < 4; j++)
             transformation[i * 4 + j] = (i == j ? 1.0f : 0.0f);
+    compute_bounding_box();
+    compute_hash();
+}
+
+void TrianglePatch::compute_normals()
+{
+    std::vector<float> normals(vertex_array.size(), 0.0f);
+    for (size_t i = 0; i + 2 < index_array.size(); i += 3) {
+        const float* v0 = &vertex_array[3 * index_array[i + 0]];
+        const float* v1 = &vertex_array[3 * index_array[i + 1]];
+        const float* v2 = &vertex_array[3 * index_array[i + 2]];
+        float e1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+        float e2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+        // The cross product has the length of twice the triangle area
+        float n[3] = {
+            e1[1] * e2[2] - e1[2] * e2[1],
+            e1[2] * e2[0] - e1[0] * e2[2],
+            e1[0] * e2[1] - e1[1] * e2[0]
+        };
+        for (int j = 0; j < 3; j++)
+            for (int k = 0; k < 3; k++)
+                normals[3 * index_array[i + j] + k] += n[k];
+    }
+    for (size_t i = 0; i < normals.size(); i += 3) {
+        float l = std::sqrt(normals[i] * normals[i] + normals[i + 1] * normals[i + 1] + normals[i + 2] * normals[i + 2]);
+        if (l > 0.0f)
+            for (int k = 0; k < 3; k++)
+                normals[i + k] /= l;
+    }
+    normal_array = SharedArray<float>(std::move(normals));
+}
+
+void TrianglePatch::compute_bounding_box()
+{
+    for (int i = 0; i < 3; i++) {
+        bounding_box[i] = +std::numeric_limits<float>::max();
+        bounding_box[3 + i] = -std::numeric_limits<float>::max();
+    }
+    for (size_t v = 0; v < vertex_array.size(); v += 3) {
+        for (int i = 0; i < 3; i++) {
+            if (vertex_array[v + i] < bounding_box[i])
+                bounding_box[i] = vertex_array[v + i];
+            if (vertex_array[v + i] > bounding_box[3 + i])
+                bounding_box[3 + i] = vertex_array[v + i];
+        }
+    }
+}
+
+template<typename T>
+static unsigned long long hash_array(const SharedArray<T>& array, unsigned long long hash)
+{
+    size_t size = array.size();
+    hash = hash_data(&size, sizeof(size), hash);
+    if (size > 0)
+        hash = hash_data(array.data(), size * sizeof(T), hash);
+    return hash;
+}
+
+void TrianglePatch::compute_hash()
+{
+    hash = hash_init;
+    hash = hash_array(vertex_array, hash);
+    hash = hash_array(normal_array, hash);
+    hash = hash_array(color_array, hash);
+    hash = hash_array(texcoord_array, hash);
+    hash = hash_array(index_array, hash);
 }
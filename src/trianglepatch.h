@@ -9,7 +9,9 @@
 #ifndef TRIANGLEPATCH_H
 #define TRIANGLEPATCH_H
 
+#include <cstddef>
 #include <vector>
+#include <memory>
 
 /**
  * \file trianglepatch.h
@@ -20,6 +22,69 @@
  * the scene).
  */
 
+/**
+ * \brief The SharedArray class.
+ *
+ * A read-only array that shares ownership of its data. The data can be owned
+ * by a std::vector or by any other object, e.g. an OpenSceneGraph array. This
+ * way, scene data is neither copied when it is extracted from the scene graph
+ * nor when triangle patches are copied.
+ */
+template<typename T>
+class SharedArray
+{
+private:
+    std::shared_ptr<const void> _owner;
+    const T* _data;
+    size_t _size;
+
+public:
+    /** \brief Constructor: creates an empty array */
+    SharedArray() : _owner(), _data(NULL), _size(0)
+    {
+    }
+
+    /** \brief Constructor: takes over the contents of a vector */
+    explicit SharedArray(std::vector<T>&& v)
+    {
+        std::shared_ptr<std::vector<T> > owner = std::make_shared<std::vector<T> >(std::move(v));
+        _owner = owner;
+        _data = (owner->empty() ? NULL : &((*owner)[0]));
+        _size = owner->size();
+    }
+
+    /** \brief Constructor: references size elements at data, which stay valid
+     * as long as owner exists */
+    SharedArray(const std::shared_ptr<const void>& owner, const T* data, size_t size) :
+        _owner(owner), _data(data), _size(size)
+    {
+    }
+
+    /** \brief Return the number of elements */
+    size_t size() const
+    {
+        return _size;
+    }
+
+    /** \brief Return whether the array is empty */
+    bool empty() const
+    {
+        return _size == 0;
+    }
+
+    /** \brief Return the data */
+    const T* data() const
+    {
+        return _data;
+    }
+
+    /** \brief Return element i */
+    const T& operator[](size_t i) const
+    {
+        return _data[i];
+    }
+};
+
 /**
  * \brief The TrianglePatch class.
  *
@@ -29,17 +94,23 @@
  *
  * If a vertex attribute is not present, the corresponding array is empty. Otherwise,
  * the attribute must be available for each vertex.
+ *
+ * The arrays share their data with the scene graph that the patch was extracted
+ * from, and with all copies of the patch.
  */
 class TrianglePatch
 {
 public:
-    std::vector<float> vertex_array;            /**< \brief Vertex information (x, y, z) */
-    std::vector<float> normal_array;            /**< \brief Vertex attribute: normals (n.x, n.y, n.z) */
-    std::vector<float> color_array;             /**< \brief Vertex attribute: color (r, g, b, a) */
-    std::vector<float> texcoord_array;          /**< \brief Vertex attribute: texture coordinates (s, t) */
-    std::vector<unsigned int> index_array;      /**< \brief Indices into the arrays, for rendering */
+    SharedArray<float> vertex_array;            /**< \brief Vertex information (x, y, z) */
+    SharedArray<float> normal_array;            /**< \brief Vertex attribute: normals (n.x, n.y, n.z) */
+    SharedArray<float> color_array;             /**< \brief Vertex attribute: color (r, g, b, a) */
+    SharedArray<float> texcoord_array;          /**< \brief Vertex attribute: texture coordinates (s, t) */
+    SharedArray<unsigned int> index_array;      /**< \brief Indices into the arrays, for rendering */
     float transformation[16];                   /**< \brief Transformation matrix, 4x4 column-major */
     unsigned int texture;                       /**< \brief Texture associated with this patch, or zero. */
+    float bounding_box[6];                      /**< \brief Axis-aligned bounding box of the vertices, untransformed
+                                                  (min x, min y, min z, max x, max y, max z). */
+    unsigned long long hash;                    /**< \brief Hash of the vertex data and indices; identifies the geometry. */
 
 public:
     /** \brief Constructor
@@ -47,6 +118,26 @@ public:
      * Constructs an empty patch.
      */
     TrianglePatch();
+
+    /** \brief Compute vertex normals
+     *
+     * Replaces the normal array with vertex normals computed from the vertex
+     * and index arrays: each vertex normal is the area-weighted average of the
+     * normals of all triangles that share the vertex. */
+    void compute_normals();
+
+    /** \brief Compute the bounding box
+     *
+     * Computes the bounding box from the vertex array. This must be called
+     * whenever the vertex array changes. */
+    void compute_bounding_box();
+
+    /** \brief Compute the hash
+     *
+     * Computes the hash from the vertex attribute arrays and the index array.
+     * This must be called whenever these arrays change. Patches with identical
+     * geometry have identical hashes, regardless of their transformation. */
+    void compute_hash();
 };
 
 #endif
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+
+/* A lock-free triple buffer for handing data from one producer thread to one
+ * consumer thread.
+ *
+ * The producer fills back() and then calls publish(). The consumer calls
+ * update() and then reads front(). Neither side ever waits for the other: the
+ * producer always has a buffer to write to, and the consumer always gets the
+ * most recently published data. Data that is published faster than it is
+ * consumed is skipped.
+ *
+ * The three buffers are identified by indices. The producer owns the back
+ * buffer, the consumer owns the front buffer, and the third (middle) buffer is
+ * swapped atomically with either of them. A flag in the middle index tells
+ * whether the middle buffer holds data that the consumer has not seen yet. */
+
+template<typename T>
+class TripleBuffer
+{
+private:
+    static const int fresh = 4;
+
+    T _buffers[3];
+    int _back;                  // used by the producer only
+    std::atomic<int> _middle;   // index of the middle buffer, plus the fresh flag
+    int _front;                 // used by the consumer only
+
+public:
+    TripleBuffer() : _back(0), _middle(1), _front(2)
+    {
+    }
+
+    // Producer side
+    T& back()
+    {
+        return _buffers[_back];
+    }
+
+    void publish()
+    {
+        _back = _middle.exchange(_back | fresh) & 3;
+    }
+
+    // Consumer side. Returns true if front() changed.
+    bool update()
+    {
+        if (!(_middle.load() & fresh))
+            return false;
+        _front = _middle.exchange(_front) & 3;
+        return true;
+    }
+
+    const T& front() const
+    {
+        return _buffers[_front];
+    }
+};
+
+#endif
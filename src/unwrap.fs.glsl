@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2017
+ * Computer Graphics Group, University of Siegen, Germany.
+ * http://www.cg.informatik.uni-siegen.de/
+ * All rights reserved.
+ * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
+ */
+
+#version 120
+
+uniform sampler2D result_tex_0; // Result of the main modulation frequency: depth, amplitude, intensity
+uniform sampler2D result_tex_1; // Result of the first additional modulation frequency
+uniform sampler2D result_tex_2; // Result of the second additional modulation frequency (if any)
+
+uniform int frequencies;        // number of modulation frequencies, 2 or 3
+uniform float ambiguity_range[3];   // ambiguity range per frequency, in meters
+uniform int max_wraps;          // number of ambiguity ranges of the main frequency to search
+
+void main(void)
+{
+    vec3 r0 = texture2D(result_tex_0, gl_TexCoord[0].xy).rgb;
+    vec3 r1 = texture2D(result_tex_1, gl_TexCoord[0].xy).rgb;
+    vec3 r2 = (frequencies > 2 ? texture2D(result_tex_2, gl_TexCoord[0].xy).rgb : vec3(0.0));
+
+    // The depths computed in simresult.fs.glsl are in [-R/2,R/2] for ambiguity
+    // range R; map them to [0,R).
+    float d0 = (r0.r < 0.0 ? r0.r + ambiguity_range[0] : r0.r);
+    float d1 = (r1.r < 0.0 ? r1.r + ambiguity_range[1] : r1.r);
+    float d2 = (r2.r < 0.0 ? r2.r + ambiguity_range[2] : r2.r);
+
+    // Search the number of wraps of the main frequency for which the depths of the
+    // other frequencies agree best, each with its own nearest number of wraps.
+    float best_err = 1e38;
+    float best_depth = 0.0;
+    for (int n = 0; n < max_wraps; n++) {
+        float D0 = d0 + float(n) * ambiguity_range[0];
+        float D1 = d1 + floor((D0 - d1) / ambiguity_range[1] + 0.5) * ambiguity_range[1];
+        float err = (D1 - D0) * (D1 - D0);
+        float sum = D0 + D1;
+        if (frequencies > 2) {
+            float D2 = d2 + floor((D0 - d2) / ambiguity_range[2] + 0.5) * ambiguity_range[2];
+            err += (D2 - D0) * (D2 - D0);
+            sum += D2;
+        }
+        if (err < best_err) {
+            best_err = err;
+            best_depth = sum / float(frequencies);
+        }
+    }
+
+    // Pixels without signal keep the depth 0
+    if (r0.g <= 0.0)
+        best_depth = 0.0;
+
+    gl_FragColor = vec4(best_depth, r0.g, r0.b, 0.0);
+}
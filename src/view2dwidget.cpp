@@ -6,6 +6,8 @@
  * Written by Martin Lambers <martin.lambers@uni-siegen.de>.
  */
 
+#include <cassert>
+
 #include <GL/glew.h>
 
 #include "view2dwidget.h"
@@ -13,19 +15,29 @@
 #include "view2d.fs.glsl.h"
 
 
-View2DWidget::View2DWidget(QGLWidget* sharing_widget) : GLWidget(sharing_widget), _prg(0)
+View2DWidget::View2DWidget(QGLWidget* sharing_widget) : GLWidget(sharing_widget), _prg(0),
+    _last_tex(0), _last_ar(1.0f), _last_channel(0), _last_minval(0.0f), _last_maxval(1.0f),
+    _last_high_dynamic_range(false),
+    _data_tex(0), _data_tex_w(0), _data_tex_h(0), _data_tex_components(0)
 {
+    std::vector<ProgramSource> programs(1);
+    programs[0].prg = &_prg;
+    programs[0].vs_src = NULL;
+    programs[0].fs_src = VIEW2D_FS_GLSL_STR;
+    programs[0].where = XGL_HERE;
+    build_programs(programs);
 }
 
 void View2DWidget::view(GLuint tex, float ar, int channel, float minval, float maxval, bool high_dynamic_range)
 {
     makeCurrent();
 
-    if (_prg == 0) {
-        GLuint fshader = xglCompileShader(GL_FRAGMENT_SHADER, VIEW2D_FS_GLSL_STR, XGL_HERE);
-        _prg = xglCreateProgram(0, 0, fshader);
-        xglLinkProgram(_prg);
-    }
+    _last_tex = tex;
+    _last_ar = ar;
+    _last_channel = channel;
+    _last_minval = minval;
+    _last_maxval = maxval;
+    _last_high_dynamic_range = high_dynamic_range;
 
     int viewport[4];
     float clearcolor[3];
@@ -64,3 +76,37 @@ void View2DWidget::view(GLuint tex, float ar, int channel, float minval, float m
 
     swapBuffers();
 }
+
+void View2DWidget::view(const std::vector<float>& data, int components, int w, int h,
+        float ar, int channel, float minval, float maxval, bool high_dynamic_range)
+{
+    assert(components == 3 || components == 4);
+    assert(data.size() == static_cast<size_t>(components * w * h));
+
+    makeCurrent();
+    GLenum format = (components == 4 ? GL_RGBA : GL_RGB);
+    if (_data_tex == 0 || _data_tex_w != w || _data_tex_h != h || _data_tex_components != components) {
+        if (_data_tex == 0)
+            glGenTextures(1, &_data_tex);
+        glBindTexture(GL_TEXTURE_2D, _data_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, components == 4 ? GL_RGBA32F : GL_RGB32F, w, h, 0,
+                format, GL_FLOAT, &(data[0]));
+        _data_tex_w = w;
+        _data_tex_h = h;
+        _data_tex_components = components;
+    } else {
+        glBindTexture(GL_TEXTURE_2D, _data_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, format, GL_FLOAT, &(data[0]));
+    }
+    view(_data_tex, ar, channel, minval, maxval, high_dynamic_range);
+}
+
+void View2DWidget::paintGL()
+{
+    if (_last_tex != 0)
+        view(_last_tex, _last_ar, _last_channel, _last_minval, _last_maxval, _last_high_dynamic_range);
+}
@@ -18,6 +18,15 @@ class View2DWidget : public GLWidget
 
 private:
     GLuint _prg;
+    // Parameters of the last view() call, to redraw on expose events
+    GLuint _last_tex;
+    float _last_ar;
+    int _last_channel;
+    float _last_minval, _last_maxval;
+    bool _last_high_dynamic_range;
+    // Texture for images given as CPU data
+    GLuint _data_tex;
+    int _data_tex_w, _data_tex_h, _data_tex_components;
 
 public:
     View2DWidget(QGLWidget* sharing_widget);
@@ -26,6 +35,15 @@ public:
     void view(GLuint tex, float ar = 1.0f, int channel = 0,
             float minval = 0.0f, float maxval = 1.0f,
             bool high_dynamic_range = false);
+    // View an image given as CPU data with 3 (RGB) or 4 (RGBA) components per pixel
+    void view(const std::vector<float>& data, int components, int w, int h,
+            float ar = 1.0f, int channel = 0,
+            float minval = 0.0f, float maxval = 1.0f,
+            bool high_dynamic_range = false);
+
+    // Redraw the last view, e.g. when the widget is exposed or resized while
+    // the simulation does not produce new images.
+    virtual void paintGL();
 
 private:
     #include "simviewhelper.inl"